@@ -0,0 +1,133 @@
+-- Compares ProddyUtils' native functions with the equivalent plain Lua. Prints results with print(), run it wherever that's visible.
+if not ProddyUtils then
+	local luaCPath = utils.get_appdata_path("PopstarDevs\\2Take1Menu\\scripts\\lib", "?.dll")
+	if not package.cpath:find(luaCPath, 1, true) then
+		package.cpath = package.cpath .. ";" .. luaCPath
+	end
+	ProddyUtils = require("ProddyUtils")
+end
+
+local function Time(Name, Iterations, Func)
+	local Start = ProddyUtils.OS.GetTimeMicro()
+	for i = 1, Iterations do
+		Func()
+	end
+	local Elapsed = ProddyUtils.OS.GetTimeMicro() - Start
+	print(string.format("%-32s %10.2f us", Name, Elapsed / Iterations))
+	return Elapsed
+end
+
+-- Typed arrays
+do
+	local Count = 100000
+	local Samples, Other = {}, {}
+	for i = 1, Count do
+		Samples[i] = math.random() * 100
+		Other[i] = math.random()
+	end
+	local Array = ProddyUtils.Float64Array.New(Samples)
+	local OtherArray = ProddyUtils.Float64Array.New(Other)
+
+	print(string.format("Float64Array, %d elements", Count))
+	Time("Lua Sum", 100, function()
+		local Sum = 0
+		for i = 1, #Samples do
+			Sum = Sum + Samples[i]
+		end
+		return Sum
+	end)
+	Time("Float64Array:Sum", 100, function() return Array:Sum() end)
+	Time("Lua Min/Max", 100, function()
+		local Min, Max = Samples[1], Samples[1]
+		for i = 2, #Samples do
+			local Value = Samples[i]
+			if Value < Min then Min = Value end
+			if Value > Max then Max = Value end
+		end
+		return Min, Max
+	end)
+	Time("Float64Array:Min/Max", 100, function() return Array:Min(), Array:Max() end)
+	Time("Lua Dot", 100, function()
+		local Sum = 0
+		for i = 1, #Samples do
+			Sum = Sum + Samples[i] * Other[i]
+		end
+		return Sum
+	end)
+	Time("Float64Array:Dot", 100, function() return Array:Dot(OtherArray) end)
+	Time("Lua Scale", 100, function()
+		for i = 1, #Samples do
+			Samples[i] = Samples[i] * 1.0001
+		end
+	end)
+	Time("Float64Array:Scale", 100, function() Array:Scale(1.0001) end)
+end
+
+-- Sorting
+do
+	local Count = 50000
+	local Players = {}
+	for i = 1, Count do
+		Players[i] = {Name = string.format("Player%06d", math.random(1, 999999)), Score = math.random(0, 1000000)}
+	end
+	local function Copy()
+		local Result = {}
+		for i = 1, #Players do
+			Result[i] = Players[i]
+		end
+		return Result
+	end
+
+	print(string.format("Sorting, %d tables", Count))
+	Time("table.sort by Score", 10, function()
+		table.sort(Copy(), function(a, b) return a.Score > b.Score end)
+	end)
+	Time("Table.SortBy Score", 10, function()
+		ProddyUtils.Table.SortBy(Copy(), "Score", {Descending = true})
+	end)
+	Time("table.sort by Name", 10, function()
+		table.sort(Copy(), function(a, b) return a.Name < b.Name end)
+	end)
+	Time("Table.SortBy Name", 10, function()
+		ProddyUtils.Table.SortBy(Copy(), "Name")
+	end)
+end
+
+-- Encoding
+do
+	-- A multiple of 3, so the Lua version doesn't need padding.
+	local Size = 3 * 512 * 1024
+	local Bytes = {}
+	for i = 1, Size do
+		Bytes[i] = string.char(math.random(0, 255))
+	end
+	local Data = table.concat(Bytes)
+
+	local Alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"
+	local Chars = {}
+	for i = 1, 64 do
+		Chars[i - 1] = Alphabet:sub(i, i)
+	end
+	local function LuaBase64(Input)
+		local Out = {}
+		for i = 1, #Input, 3 do
+			local a, b, c = Input:byte(i, i + 2)
+			local v = a * 65536 + b * 256 + c
+			Out[#Out + 1] = Chars[v // 262144] .. Chars[v // 4096 % 64] .. Chars[v // 64 % 64] .. Chars[v % 64]
+		end
+		return table.concat(Out)
+	end
+	local function Throughput(Name, Iterations, Func)
+		local Elapsed = Time(Name, Iterations, Func)
+		print(string.format("%-32s %10.2f MB/s", "", Size * Iterations / Elapsed))
+	end
+	local Encoded = ProddyUtils.Encoding.Base64Encode(Data)
+	local Hex = ProddyUtils.Encoding.HexEncode(Data)
+
+	print(string.format("Encoding, %d bytes", Size))
+	Throughput("Lua Base64", 1, function() return LuaBase64(Data) end)
+	Throughput("Encoding.Base64Encode", 20, function() return ProddyUtils.Encoding.Base64Encode(Data) end)
+	Throughput("Encoding.Base64Decode", 20, function() return ProddyUtils.Encoding.Base64Decode(Encoded) end)
+	Throughput("Encoding.HexEncode", 20, function() return ProddyUtils.Encoding.HexEncode(Data) end)
+	Throughput("Encoding.HexDecode", 20, function() return ProddyUtils.Encoding.HexDecode(Hex) end)
+end
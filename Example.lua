@@ -11,6 +11,15 @@ if not (ProddyUtils.CheckVersion and ProddyUtils.CheckVersion(1, 5)) then -- Che
 	return -- Exit because wrong version
 end
 
+-- ProddyUtils.Cache
+local PageCache = ProddyUtils.Cache.New({maxItems = 100, maxBytes = 4 * 1024 * 1024, ttlMs = 60000})
+local Page = PageCache:Get("/Test.txt")
+if Page == nil then
+	-- Not cached or expired, fetch it and store it
+	PageCache:Set("/Test.txt", "Page body")
+end
+local Stats = PageCache:Stats() -- Stats.items, Stats.bytes, Stats.hits, Stats.misses, Stats.evictions, Stats.expirations
+
 -- ProddyUtils.Clipboard
 local ClipboardText = ProddyUtils.Clipboard.GetText()
 if ClipboardText ~= nil then
@@ -91,6 +100,14 @@ else
 	-- Iteration was returned false
 end
 
+local Watcher = ProddyUtils.Loader.Watch(os.getenv("APPDATA") .. "\\PopstarDevs\\2Take1Menu\\scripts", function(Name, Removed)
+	-- Name is relative to the watched directory. Only called once the file's contents have changed.
+end, 200, true)
+if Watcher then
+	Watcher:Poll() -- Call every tick (or however often you want to check), runs the callback for each changed file
+	Watcher:Close() -- Stops watching, also done when the watcher is garbage collected
+end
+
 if ProddyUtils.Keyboard.IsKeyPressed(ProddyUtils.Keyboard.Keys.Control, ProddyUtils.Keyboard.Keys.W) then
 	-- Either Left or Right Control is pressed and W
 else
@@ -114,4 +131,204 @@ if success then
 	-- res is page body
 else
 	-- res is HTTP Status Code
-end
\ No newline at end of file
+end
+
+-- ProddyUtils.PriorityQueue
+local Queue = ProddyUtils.PriorityQueue.New() -- Pass true to pop the highest priority first
+local Handle = Queue:Push("Far target", 250.0)
+Queue:PushAll({"Near target", "Middle target"}, {10.0, 100.0})
+Queue:Update(Handle, 5.0) -- "Far target" moved closer, it's now at the front
+local Value, Priority = Queue:Pop() -- "Far target", 5.0
+local Size = Queue:Size() -- 2
+
+-- ProddyUtils.OrderedMap
+local Events = ProddyUtils.OrderedMap.New()
+Events:Insert(1500, "Joined")
+Events:Insert(1000, "Loaded")
+Events:Insert(2500, "Left")
+local Time, Event = Events:Floor(2000) -- 1500, "Joined"
+for Time, Event in Events:Range(1000, 2000) do
+	-- 1000 "Loaded", then 1500 "Joined"
+end
+
+-- ProddyUtils.Float64Array / ProddyUtils.Int32Array
+local FrameTimes = ProddyUtils.Float64Array.New({16.6, 16.8, 33.3, 16.7})
+FrameTimes:Set(3, 17.0)
+local Average, Worst = FrameTimes:Mean(), FrameTimes:Max()
+local Weights = ProddyUtils.Float64Array.New(FrameTimes:Size())
+Weights:Fill(0.25)
+local Weighted = FrameTimes:Dot(Weights)
+local Counts = ProddyUtils.Int32Array.New(4)
+Counts:Add(1) -- {1, 1, 1, 1}
+local Total = Counts:Sum() -- 4
+
+-- ProddyUtils.Vec3Array
+local Positions = ProddyUtils.Vec3Array.New()
+Positions:Push(0, 0, 0)
+Positions:Push({x = 10, y = 0, z = 0}) -- Tables and v3 work too
+Positions:Push(100, 100, 0)
+local Distances = Positions:Distances(5, 0, 0) -- Float64Array {5, 5, 137.93...}
+local Nearby = Positions:WithinRadius(5, 0, 0, 20) -- {1, 2}
+local Order = Positions:SortByDistance(100, 90, 0) -- {3, 2, 1}
+
+-- ProddyUtils.SpatialIndex
+local Players = ProddyUtils.SpatialIndex.New(50)
+Players:Update(0, 100, 200, 30) -- Call again whenever a player moves
+Players:Update(1, {x = 120, y = 210, z = 30})
+local Results = {}
+Players:QueryRadius(110, 200, 30, 25, Results) -- Results = {0, 1}, reuses the table
+local Nearest = Players:KNearest(0, 0, 0, 1) -- {0}
+Players:Remove(1)
+
+-- ProddyUtils.BloomFilter / ProddyUtils.HyperLogLog
+local Blocked = ProddyUtils.BloomFilter.New(500000, 0.001)
+Blocked:AddAll({123456789, 987654321})
+if Blocked:Test(123456789) then
+	-- Probably blocked, confirm with an exact lookup if false positives matter
+end
+local Saved = Blocked:Serialize() -- Write this to a file and load it later with ProddyUtils.BloomFilter.Deserialize(Saved)
+
+local SeenPlayers = ProddyUtils.HyperLogLog.New()
+SeenPlayers:Add(123456789)
+SeenPlayers:Add(123456789)
+local Distinct = SeenPlayers:Count() -- 1
+
+-- ProddyUtils.TimeSeries
+local FPS = ProddyUtils.TimeSeries.New(60 * 60 * 5) -- Five minutes at 60 samples per second
+FPS:Push(59.8) -- Timestamped with the current time, or pass your own as the second argument
+local Count, Min, Max, Mean = FPS:Stats(10000) -- Over the last 10 seconds
+local Low = FPS:Percentile(1, 10000) -- 1% low
+local Values, Times = FPS:Downsample(200) -- 200 points to draw a graph with
+
+-- ProddyUtils.Bitset
+local Modders = ProddyUtils.Bitset.New(32)
+local Friends = ProddyUtils.Bitset.New(32)
+Modders:Set(3)
+Modders:Set(7)
+Friends:Set(7)
+local ModdersNotFriends = Modders:Clone():AndNot(Friends)
+for Player in ModdersNotFriends:Iterate() do
+	-- 3
+end
+local ModderCount = Modders:Count() -- 2
+
+-- ProddyUtils.IdSet
+local Seen = ProddyUtils.IdSet.New(100000)
+Seen:Load({123456789, 987654321})
+if Seen:Add(555) then
+	-- First time seeing 555
+end
+local Kills = ProddyUtils.IdMap.New()
+Kills:Add(123456789)
+Kills:Add(123456789)
+local KillCount = Kills:Get(123456789) -- 2
+
+-- ProddyUtils.Trie
+local Vehicles = ProddyUtils.Trie.New({"Ambulance", "Armadillo", "Apache"})
+Vehicles:Insert("Armored Car", 5) -- Weighted names come first
+local Names, Weights = Vehicles:PrefixSearch("ar", 3) -- {"Armored Car", "Armadillo"}
+
+-- ProddyUtils.Table
+local Leaderboard = {{Name = "Bob", Score = 20}, {Name = "alice", Score = 35}, {Name = "Carol", Score = 20}}
+ProddyUtils.Table.SortBy(Leaderboard, "Score", {Descending = true}) -- alice, Bob, Carol
+ProddyUtils.Table.SortBy(Leaderboard, function(Player) return Player.Name:lower() end)
+
+local Config = {Hotkeys = {Menu = "F4"}, Volume = 0.5}
+local Snapshot = ProddyUtils.Table.DeepCopy(Config)
+local SavedHash = ProddyUtils.Table.Hash(Config)
+Config.Hotkeys.Menu = "F5"
+if ProddyUtils.Table.Hash(Config) ~= SavedHash then
+	-- Changed since the snapshot, ProddyUtils.Table.DeepEqual(Config, Snapshot) is now false
+end
+
+-- ProddyUtils.Pool
+local Positions = ProddyUtils.Pool.New(0, 3)
+local Position = Positions:Acquire()
+Position.x, Position.y, Position.z = 1, 2, 3
+Positions:Release(Position) -- Cleared and handed out again by the next Acquire
+
+-- ProddyUtils.EntityStore
+local World = ProddyUtils.EntityStore.New()
+World:Define("Vehicle", {Model = "string", Speed = "number", Locked = "bool"})
+World:Define("Tracked", {Handle = "int"})
+local Car = World:Create()
+World:Add(Car, "Vehicle", {Model = "adder", Speed = 0})
+World:Add(Car, "Tracked", {Handle = 123456})
+for Entity in World:Query("Vehicle", "Tracked") do
+	World:Set(Entity, "Vehicle", "Speed", World:Get(Entity, "Vehicle", "Speed") + 1)
+end
+
+-- ProddyUtils.JSON
+local Data, Error = ProddyUtils.JSON.Decode('{"players": [{"name": "Bob", "rid": 123456789}], "motd": null}', {Null = ProddyUtils.JSON.Null})
+if Data then
+	local Name = Data.players[1].name -- "Bob"
+	local HasMOTD = Data.motd ~= ProddyUtils.JSON.Null -- false
+end
+
+local Save = {Version = 2, Friends = {123456789, 987654321}, Settings = {Volume = 0.5}}
+local Text = ProddyUtils.JSON.Encode(Save, {SortKeys = true}) -- {"Friends":[123456789,987654321],"Settings":{"Volume":0.5},"Version":2}
+ProddyUtils.JSON.Encode(Save, {Pretty = true, File = utils.get_appdata_path("PopstarDevs\\2Take1Menu\\scripts", "Save.json")})
+
+local Vehicles = {}
+local Stream = ProddyUtils.JSON.Stream(function(Vehicle)
+	Vehicles[#Vehicles + 1] = Vehicle.model
+end, {Path = {"data", "vehicles"}})
+Stream:Feed('{"data": {"count": 2, "vehicles": [{"model": "adder"}, {"mod')
+Stream:Feed('el": "zentorno"}]}}') -- Vehicles is now {"adder", "zentorno"}
+Stream:Close()
+
+-- ProddyUtils.MsgPack
+local Snapshot = ProddyUtils.MsgPack.Pack({Tick = 1200, Position = {1.5, -20.25, 31.0}, Players = {[123456789] = "Bob"}})
+local File = io.open(utils.get_appdata_path("PopstarDevs\\2Take1Menu\\scripts", "Snapshot.bin"), "wb")
+File:write(Snapshot)
+File:close()
+local Restored, Offset = ProddyUtils.MsgPack.Unpack(Snapshot) -- Restored.Tick is still an integer, Offset is #Snapshot + 1
+
+-- ProddyUtils.CSV
+local Folder = utils.get_appdata_path("PopstarDevs\\2Take1Menu\\scripts", "")
+local Writer = ProddyUtils.CSV.Writer(Folder .. "Sessions.csv")
+Writer:Write({"Name", "Kills", "Note"})
+Writer:Write({"Bob", 12, "said \"gg\", left"})
+Writer:Close()
+
+for Row, Number in ProddyUtils.CSV.Open(Folder .. "Sessions.csv", {Header = true}) do
+	print(Number, Row.Name, tonumber(Row.Kills), Row.Note) -- 2 Bob 12 said "gg", left
+end
+
+-- ProddyUtils.Encoding
+local Encoded = ProddyUtils.Encoding.Base64Encode("ProddyUtils") -- "UHJvZGR5VXRpbHM="
+local Decoded = ProddyUtils.Encoding.Base64Decode(Encoded) -- "ProddyUtils"
+local Token = ProddyUtils.Encoding.Base64Encode("\255\254", true) -- "__4"
+local Hex = ProddyUtils.Encoding.HexEncode("\1\171") -- "01ab"
+
+-- ProddyUtils.Hash
+local Digest = ProddyUtils.Hash.SHA256("abc") -- "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"
+local Checksum = ProddyUtils.Hash.CRC32C("123456789") -- 0xE3069283
+local Hasher = ProddyUtils.Hash.Hasher("XXH3")
+Hasher:Update("Proddy"):Update("Utils")
+print(Hasher:Digest() == ProddyUtils.Hash.XXH3("ProddyUtils")) -- true
+local FileDigest, Err = ProddyUtils.Hash.File(utils.get_appdata_path("PopstarDevs\\2Take1Menu\\scripts", "") .. "Sessions.csv")
+
+-- ProddyUtils.Compress
+local Log = string.rep("Player joined\n", 1000)
+local Packed = ProddyUtils.Compress.LZ4(Log)
+print(#Log, #Packed, ProddyUtils.Decompress.LZ4(Packed) == Log) -- 14000 105 true
+
+local Compressor = ProddyUtils.Compress.Compressor("LZ4")
+local Parts = {}
+for i = 1, 100 do
+	Parts[#Parts + 1] = Compressor:Update(string.format("Tick %d\n", i))
+end
+Parts[#Parts + 1] = Compressor:Finish()
+local Decompressor = ProddyUtils.Decompress.Decompressor("LZ4")
+local Text = Decompressor:Update(table.concat(Parts)) .. Decompressor:Finish()
+
+local Archive = ProddyUtils.Compress.Gzip(Log, 9)
+print(ProddyUtils.Decompress.Gzip(Archive) == Log) -- true
+local GzipReader = ProddyUtils.Decompress.Decompressor("Gzip")
+local Unpacked = {}
+for i = 1, #Archive, 16 do
+	Unpacked[#Unpacked + 1] = GzipReader:Update(Archive:sub(i, i + 15))
+end
+Unpacked[#Unpacked + 1] = GzipReader:Finish()
+print(table.concat(Unpacked) == Log) -- true
\ No newline at end of file
@@ -3,6 +3,12 @@
 #include <sstream>
 #include <chrono>
 #include <algorithm>
+#include <charconv>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <type_traits>
+#include <intrin.h>
 #include "lua.hpp"
 #include "httplib.h"
 #include <windows.h>
@@ -132,6 +138,109 @@ inline void lua_pushlstring(lua_State* L, const std::wstring& str)
 }
 #pragma endregion
 
+#pragma region Userdata
+template <typename T>
+T* lua_checkobject(lua_State* L, int idx)
+{
+	return static_cast<T*>(luaL_checkudata(L, idx, T::MetaName));
+}
+
+template <typename T, typename... Args>
+T* lua_newobject(lua_State* L, Args&&... args)
+{
+	auto obj = new (lua_newuserdata(L, sizeof(T))) T(std::forward<Args>(args)...);
+	luaL_setmetatable(L, T::MetaName);
+	return obj;
+}
+
+template <typename T>
+static int lua_gcobject(lua_State* L)
+{
+	lua_checkobject<T>(L, 1)->~T();
+	return 0;
+}
+
+// Creates the metatable for T with Methods as __index. Types holding registry refs pass their own __gc.
+template <typename T>
+void lua_registerobject(lua_State* L, const luaL_Reg* Methods, lua_CFunction gc = lua_gcobject<T>)
+{
+	luaL_newmetatable(L, T::MetaName);
+	lua_newtable(L);
+	luaL_setfuncs(L, Methods, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+}
+
+// Output buffer for one encode or compress call. Kept in a userdata on the caller's stack so that each
+// lua_State, and so each thread, has its own, and the GC frees it if a Lua error unwinds the call.
+struct ScratchBuffer
+{
+	static constexpr const char* MetaName = "ProddyUtils.ScratchBuffer";
+	std::string Data;
+};
+
+static const luaL_Reg ScratchBufferMethods[] = {
+	{nullptr, nullptr}
+};
+
+static std::string& lua_newscratchbuffer(lua_State* L)
+{
+	return lua_newobject<ScratchBuffer>(L)->Data;
+}
+
+// Pushes the finished output and releases its memory now rather than at the next collection.
+static void lua_pushscratchbuffer(lua_State* L, std::string& buffer)
+{
+	lua_pushlstring(L, buffer);
+	std::string().swap(buffer);
+}
+#pragma endregion
+
+#pragma region CPU
+struct CPUFeatures
+{
+	bool POPCNT = false;
+	bool SSSE3 = false;
+	bool SSE42 = false;
+	bool AVX2 = false;
+	// SHA extensions, only used alongside the SSE4.1 and SSSE3 shuffles they need.
+	bool SHA = false;
+
+	CPUFeatures()
+	{
+		int info[4];
+		__cpuid(info, 0);
+		auto maxLeaf = info[0];
+		__cpuid(info, 1);
+		// AVX state must be enabled by the OS as well as supported by the CPU.
+		auto bYMM = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+		POPCNT = (info[2] & (1 << 23)) != 0;
+		SSSE3 = (info[2] & (1 << 9)) != 0;
+		SSE42 = (info[2] & (1 << 20)) != 0;
+		auto bSSE41 = (info[2] & (1 << 19)) != 0;
+		if (maxLeaf >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			AVX2 = bYMM && (info[1] & (1 << 5)) != 0;
+			SHA = SSSE3 && bSSE41 && (info[1] & (1 << 29)) != 0;
+		}
+	}
+};
+static const CPUFeatures CPU;
+
+inline uint64_t PopCount(uint64_t x)
+{
+	if (CPU.POPCNT)
+		return __popcnt64(x);
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (x * 0x0101010101010101ULL) >> 56;
+}
+#pragma endregion
+
 #pragma region Clipboard
 bool SetClipboard(const std::wstring& str)
 {
@@ -521,7 +630,7 @@ static int lua_downloadstring(lua_State* L)
 		if (res->status == 200)
 		{
 			lua_pushboolean(L, true);
-			lua_pushstring(L, res->body.c_str());
+			lua_pushlstring(L, res->body);
 		}
 		else
 		{
@@ -538,64 +647,10985 @@ static int lua_downloadstring(lua_State* L)
 }
 #pragma endregion
 
-#pragma region LuaOpen
-static const struct luaL_Reg ProddyUtils[] = {
-	{"CheckVersion", lua_checkversion},
-	{"GetVersion", lua_getversion},
-	{"GetMetatable", lua_getmetatable},
-	{"GetTop", lua_top},
-	{NULL, NULL}
-};
-static const struct luaL_Reg Clipboard[] = {
-	{"GetText", lua_getclipboard},
-	{"SetText", lua_setclipboard},
-	{NULL, NULL}
-};
-static const struct luaL_Reg IO[] = {
-	{"CreateDirectory", lua_createdirectory},
-	{"DirExists", lua_direxists},
-	{"Exists", lua_exists},
-	{"FileExists", lua_fileexists},
-	{"GetFiles", lua_getfiles},
-	{"IterateDirectory", lua_iteratedirectory},
-	{NULL, NULL}
-};
-static const struct luaL_Reg Keyboard[] = {
-	{"IsKeyPressed", lua_iskeypressed},
-	{"KeyDown", lua_keydown},
-	{"KeyUp", lua_keyup},
-	{NULL, NULL}
-};
-static const struct luaL_Reg MsgBox[] = {
-	{"Show", lua_msgbox},
-	{NULL, NULL}
-};
-static const struct luaL_Reg OS[] = {
-	{"GetTimeMillis", lua_gettimemillis},
-	{"GetTimeMicro", lua_gettimemicro},
-	{"GetTimeNano", lua_gettimenano},
-	{NULL, NULL}
-};
-static const struct luaL_Reg Net[] = {
-	{"DownloadString", lua_downloadstring},
-	{NULL, NULL}
+#pragma region Loader
+bool HashFile(const std::wstring& strPath, uint64_t& hash)
+{
+	HANDLE hFile = CreateFileW(strPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	// FNV-1a
+	hash = 14695981039346656037ULL;
+	std::vector<unsigned char> buffer(64 * 1024);
+	DWORD read = 0;
+	while (ReadFile(hFile, buffer.data(), (DWORD)buffer.size(), &read, nullptr) && read > 0)
+	{
+		for (DWORD i = 0; i < read; i++)
+		{
+			hash ^= buffer[i];
+			hash *= 1099511628211ULL;
+		}
+	}
+	CloseHandle(hFile);
+	return true;
+}
+
+struct Watcher
+{
+	static constexpr const char* MetaName = "ProddyUtils.Watcher";
+
+	std::wstring Root;
+	bool Recursive;
+	std::chrono::milliseconds Debounce;
+	int Callback = LUA_NOREF;
+	HANDLE hDir = INVALID_HANDLE_VALUE;
+	HANDLE hEvent = nullptr;
+	OVERLAPPED Overlapped = {};
+	std::vector<DWORD> Buffer = std::vector<DWORD>(16 * 1024);
+	std::unordered_map<std::wstring, std::chrono::steady_clock::time_point> Pending;
+	std::unordered_map<std::wstring, uint64_t> Hashes;
+
+	Watcher(const std::wstring& strRoot, bool bRecursive, std::chrono::milliseconds debounce) : Root(strRoot), Recursive(bRecursive), Debounce(debounce) {}
+
+	~Watcher()
+	{
+		Stop();
+	}
+
+	bool Start()
+	{
+		hDir = CreateFileW(Root.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+		if (hDir == INVALID_HANDLE_VALUE)
+			return false;
+		hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+		if (hEvent == nullptr)
+		{
+			Stop();
+			return false;
+		}
+		Scan(false);
+		if (!Issue())
+		{
+			Stop();
+			return false;
+		}
+		return true;
+	}
+
+	void Stop()
+	{
+		if (hDir != INVALID_HANDLE_VALUE)
+		{
+			CancelIo(hDir);
+			DWORD bytes;
+			GetOverlappedResult(hDir, &Overlapped, &bytes, TRUE);
+			CloseHandle(hDir);
+			hDir = INVALID_HANDLE_VALUE;
+		}
+		if (hEvent != nullptr)
+		{
+			CloseHandle(hEvent);
+			hEvent = nullptr;
+		}
+	}
+
+	bool Issue()
+	{
+		Overlapped = {};
+		Overlapped.hEvent = hEvent;
+		return ReadDirectoryChangesW(hDir, Buffer.data(), (DWORD)(Buffer.size() * sizeof(DWORD)), Recursive, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE, nullptr, &Overlapped, nullptr) != 0;
+	}
+
+	// Hashes every file under Root. When bMarkPending is set the files are queued instead, used after the notification buffer overflowed.
+	void Scan(bool bMarkPending)
+	{
+		std::error_code ec;
+		auto now = std::chrono::steady_clock::now();
+		auto visit = [&](const std::filesystem::directory_entry& entry) {
+			if (!entry.is_regular_file(ec))
+				return;
+			auto strName = entry.path().lexically_relative(Root).wstring();
+			if (bMarkPending)
+				Pending[strName] = now;
+			else
+			{
+				uint64_t hash;
+				if (HashFile(entry.path().wstring(), hash))
+					Hashes[strName] = hash;
+			}
+		};
+		if (Recursive)
+		{
+			for (auto& entry : std::filesystem::recursive_directory_iterator(Root, std::filesystem::directory_options::skip_permission_denied, ec))
+				visit(entry);
+		}
+		else
+		{
+			for (auto& entry : std::filesystem::directory_iterator(Root, ec))
+				visit(entry);
+		}
+		if (bMarkPending)
+		{
+			for (auto& hash : Hashes)
+				Pending[hash.first] = now;
+		}
+	}
+
+	// Drains completed notifications without blocking, queueing each touched file for the debounce window.
+	void Drain()
+	{
+		auto now = std::chrono::steady_clock::now();
+		DWORD bytes = 0;
+		while (hDir != INVALID_HANDLE_VALUE && GetOverlappedResult(hDir, &Overlapped, &bytes, FALSE))
+		{
+			if (bytes == 0)
+				Scan(true);
+			else
+			{
+				auto pBuffer = reinterpret_cast<const BYTE*>(Buffer.data());
+				for (;;)
+				{
+					auto pInfo = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(pBuffer);
+					Pending[std::wstring(pInfo->FileName, pInfo->FileNameLength / sizeof(WCHAR))] = now;
+					if (pInfo->NextEntryOffset == 0)
+						break;
+					pBuffer += pInfo->NextEntryOffset;
+				}
+			}
+			if (!Issue())
+				Stop();
+		}
+	}
+
+	struct Change
+	{
+		std::wstring Name;
+		bool bRemoved;
+		uint64_t Hash;
+	};
+
+	// Collects files that have been quiet for the debounce window and whose content hash changed.
+	// They stay pending until Commit, so a callback that errors doesn't lose the changes queued after it.
+	void Collect(std::vector<Change>& changes)
+	{
+		auto now = std::chrono::steady_clock::now();
+		for (auto it = Pending.begin(); it != Pending.end();)
+		{
+			if (now - it->second < Debounce)
+			{
+				++it;
+				continue;
+			}
+			uint64_t hash;
+			auto known = Hashes.find(it->first);
+			auto path = Root + L"\\" + it->first;
+			if (HashFile(path, hash))
+			{
+				if (known == Hashes.end() || known->second != hash)
+				{
+					changes.push_back({ it->first, false, hash });
+					++it;
+					continue;
+				}
+			}
+			else if (std::error_code ec; !std::filesystem::exists(path, ec))
+			{
+				if (known != Hashes.end())
+				{
+					changes.push_back({ it->first, true, 0 });
+					++it;
+					continue;
+				}
+			}
+			else if (!std::filesystem::is_directory(path, ec))
+			{
+				// Still locked by the writer, new or not, try again next poll.
+				it->second = now;
+				++it;
+				continue;
+			}
+			it = Pending.erase(it);
+		}
+	}
+
+	// Records a change once its callback has returned.
+	void Commit(const Change& change)
+	{
+		if (change.bRemoved)
+			Hashes.erase(change.Name);
+		else
+			Hashes[change.Name] = change.Hash;
+		Pending.erase(change.Name);
+	}
 };
 
-extern "C" __declspec(dllexport) int luaopen_ProddyUtils(lua_State * L)
+static int lua_watch(lua_State* L)
 {
-	luaL_newlib(L, ProddyUtils);
+	size_t len;
+	auto text = luaL_checklstring(L, 1, &len);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	auto debounce = luaL_optinteger(L, 3, 200);
+	auto recursive = lua_toboolean(L, 4) != 0;
+	auto watcher = lua_newobject<Watcher>(L, UTF8ToUTF16(text, len), recursive, std::chrono::milliseconds(debounce));
+	if (!watcher->Start())
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushvalue(L, 2);
+	watcher->Callback = luaL_ref(L, LUA_REGISTRYINDEX);
+	return 1;
+}
 
-	luaL_newlib(L, Clipboard);
-	lua_setfield(L, -2, "Clipboard");
+static int lua_watcherpoll(lua_State* L)
+{
+	auto watcher = lua_checkobject<Watcher>(L, 1);
+	if (watcher->Callback == LUA_NOREF)
+	{
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+	std::vector<Watcher::Change> changes;
+	watcher->Drain();
+	watcher->Collect(changes);
+	size_t fired = 0;
+	// A callback may close the watcher, which frees the callback's ref.
+	for (size_t i = 0; i < changes.size() && watcher->Callback != LUA_NOREF; i++)
+	{
+		lua_rawgeti(L, LUA_REGISTRYINDEX, watcher->Callback);
+		lua_pushlstring(L, changes[i].Name);
+		lua_pushboolean(L, changes[i].bRemoved);
+		lua_call(L, 2, 0);
+		watcher->Commit(changes[i]);
+		fired++;
+	}
+	lua_pushinteger(L, fired);
+	return 1;
+}
 
-	luaL_newlib(L, IO);
-	lua_setfield(L, -2, "IO");
+static int lua_watcherclose(lua_State* L)
+{
+	auto watcher = lua_checkobject<Watcher>(L, 1);
+	watcher->Stop();
+	luaL_unref(L, LUA_REGISTRYINDEX, watcher->Callback);
+	watcher->Callback = LUA_NOREF;
+	return 0;
+}
 
-	luaL_newlib(L, OS);
-	lua_setfield(L, -2, "OS");
+static int lua_watchergc(lua_State* L)
+{
+	lua_watcherclose(L);
+	return lua_gcobject<Watcher>(L);
+}
+#pragma endregion
 
-	luaL_newlib(L, Net);
-	lua_setfield(L, -2, "Net");
+#pragma region Cache
+// Encodes a string, number or boolean into a byte key. Floats with integral values encode as integers, matching Lua table semantics.
+bool lua_tokey(lua_State* L, int idx, std::string& key)
+{
+	switch (lua_type(L, idx))
+	{
+	case LUA_TSTRING:
+	{
+		size_t len;
+		auto text = lua_tolstring(L, idx, &len);
+		key.assign(1, 's');
+		key.append(text, len);
+		return true;
+	}
+	case LUA_TNUMBER:
+	{
+		lua_Integer i;
+		int isnum;
+		i = lua_tointegerx(L, idx, &isnum);
+		if (isnum)
+		{
+			key.assign(1, 'i');
+			key.append(reinterpret_cast<const char*>(&i), sizeof(i));
+		}
+		else
+		{
+			auto n = lua_tonumber(L, idx);
+			key.assign(1, 'n');
+			key.append(reinterpret_cast<const char*>(&n), sizeof(n));
+		}
+		return true;
+	}
+	case LUA_TBOOLEAN:
+		key.assign(1, lua_toboolean(L, idx) ? 't' : 'f');
+		return true;
+	default:
+		return false;
+	}
+}
+
+struct LRUCache
+{
+	static constexpr const char* MetaName = "ProddyUtils.Cache";
+
+	struct Entry
+	{
+		int Ref;
+		size_t Size;
+		std::chrono::steady_clock::time_point Expires;
+		Entry* Prev;
+		Entry* Next;
+		const std::string* Key;
+	};
+
+	size_t MaxItems;
+	size_t MaxBytes;
+	std::chrono::milliseconds TTL;
+	std::unordered_map<std::string, Entry> Entries;
+	// Sentinel of the circular LRU list. Head.Next is the most recently used entry.
+	Entry Head = {};
+	size_t Bytes = 0;
+	lua_Integer Hits = 0;
+	lua_Integer Misses = 0;
+	lua_Integer Evictions = 0;
+	lua_Integer Expirations = 0;
+
+	LRUCache(size_t maxItems, size_t maxBytes, std::chrono::milliseconds ttl) : MaxItems(maxItems), MaxBytes(maxBytes), TTL(ttl)
+	{
+		Head.Prev = Head.Next = &Head;
+	}
+
+	void Unlink(Entry* entry)
+	{
+		entry->Prev->Next = entry->Next;
+		entry->Next->Prev = entry->Prev;
+	}
+
+	void PushFront(Entry* entry)
+	{
+		entry->Prev = &Head;
+		entry->Next = Head.Next;
+		Head.Next->Prev = entry;
+		Head.Next = entry;
+	}
+
+	void Remove(lua_State* L, std::unordered_map<std::string, Entry>::iterator it)
+	{
+		Unlink(&it->second);
+		luaL_unref(L, LUA_REGISTRYINDEX, it->second.Ref);
+		Bytes -= it->second.Size;
+		Entries.erase(it);
+	}
+
+	bool Expired(const Entry& entry, std::chrono::steady_clock::time_point now) const
+	{
+		return TTL.count() > 0 && now >= entry.Expires;
+	}
+
+	// Evicts least recently used entries until the limits are satisfied. The entry just written is never evicted.
+	void Trim(lua_State* L, const Entry* keep)
+	{
+		while (Head.Prev != &Head && ((MaxItems > 0 && Entries.size() > MaxItems) || (MaxBytes > 0 && Bytes > MaxBytes)))
+		{
+			auto victim = Head.Prev;
+			if (victim == keep)
+				break;
+			Remove(L, Entries.find(*victim->Key));
+			Evictions++;
+		}
+	}
+
+	void Clear(lua_State* L)
+	{
+		for (auto& entry : Entries)
+			luaL_unref(L, LUA_REGISTRYINDEX, entry.second.Ref);
+		Entries.clear();
+		Head.Prev = Head.Next = &Head;
+		Bytes = 0;
+	}
+};
+
+static size_t lua_getfieldsize(lua_State* L, int idx, const char* k)
+{
+	lua_getfield(L, idx, k);
+	auto value = luaL_optinteger(L, -1, 0);
+	lua_pop(L, 1);
+	return value > 0 ? (size_t)value : 0;
+}
+
+static int lua_cachenew(lua_State* L)
+{
+	size_t maxItems = 0;
+	size_t maxBytes = 0;
+	size_t ttl = 0;
+	if (!lua_isnoneornil(L, 1))
+	{
+		luaL_checktype(L, 1, LUA_TTABLE);
+		maxItems = lua_getfieldsize(L, 1, "maxItems");
+		maxBytes = lua_getfieldsize(L, 1, "maxBytes");
+		ttl = lua_getfieldsize(L, 1, "ttlMs");
+	}
+	lua_newobject<LRUCache>(L, maxItems, maxBytes, std::chrono::milliseconds(ttl));
+	return 1;
+}
+
+static int lua_cacheget(lua_State* L)
+{
+	auto cache = lua_checkobject<LRUCache>(L, 1);
+	std::string key;
+	luaL_argcheck(L, lua_tokey(L, 2, key), 2, "string, number or boolean expected");
+	auto it = cache->Entries.find(key);
+	if (it == cache->Entries.end())
+	{
+		cache->Misses++;
+		lua_pushnil(L);
+		return 1;
+	}
+	if (cache->Expired(it->second, std::chrono::steady_clock::now()))
+	{
+		cache->Remove(L, it);
+		cache->Expirations++;
+		cache->Misses++;
+		lua_pushnil(L);
+		return 1;
+	}
+	cache->Hits++;
+	cache->Unlink(&it->second);
+	cache->PushFront(&it->second);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, it->second.Ref);
+	return 1;
+}
+
+static int lua_cacheset(lua_State* L)
+{
+	auto cache = lua_checkobject<LRUCache>(L, 1);
+	std::string key;
+	luaL_argcheck(L, lua_tokey(L, 2, key), 2, "string, number or boolean expected");
+	auto bytes = luaL_optinteger(L, 4, lua_type(L, 3) == LUA_TSTRING ? (lua_Integer)lua_rawlen(L, 3) : 0);
+	luaL_argcheck(L, bytes >= 0, 4, "bytes must not be negative");
+	auto size = (size_t)bytes;
+	auto it = cache->Entries.find(key);
+	if (lua_isnil(L, 3))
+	{
+		if (it != cache->Entries.end())
+			cache->Remove(L, it);
+		return 0;
+	}
+	lua_pushvalue(L, 3);
+	auto ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	if (it == cache->Entries.end())
+	{
+		it = cache->Entries.emplace(std::move(key), LRUCache::Entry()).first;
+		it->second.Key = &it->first;
+	}
+	else
+	{
+		luaL_unref(L, LUA_REGISTRYINDEX, it->second.Ref);
+		cache->Bytes -= it->second.Size;
+		cache->Unlink(&it->second);
+	}
+	it->second.Ref = ref;
+	it->second.Size = size;
+	it->second.Expires = std::chrono::steady_clock::now() + cache->TTL;
+	cache->Bytes += size;
+	cache->PushFront(&it->second);
+	cache->Trim(L, &it->second);
+	return 0;
+}
+
+static int lua_cachedelete(lua_State* L)
+{
+	auto cache = lua_checkobject<LRUCache>(L, 1);
+	std::string key;
+	luaL_argcheck(L, lua_tokey(L, 2, key), 2, "string, number or boolean expected");
+	auto it = cache->Entries.find(key);
+	auto bFound = it != cache->Entries.end();
+	if (bFound)
+		cache->Remove(L, it);
+	lua_pushboolean(L, bFound);
+	return 1;
+}
+
+static int lua_cachestats(lua_State* L)
+{
+	auto cache = lua_checkobject<LRUCache>(L, 1);
+	lua_createtable(L, 0, 6);
+	lua_pushinteger(L, cache->Entries.size());
+	lua_setfield(L, -2, "items");
+	lua_pushinteger(L, cache->Bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushinteger(L, cache->Hits);
+	lua_setfield(L, -2, "hits");
+	lua_pushinteger(L, cache->Misses);
+	lua_setfield(L, -2, "misses");
+	lua_pushinteger(L, cache->Evictions);
+	lua_setfield(L, -2, "evictions");
+	lua_pushinteger(L, cache->Expirations);
+	lua_setfield(L, -2, "expirations");
+	return 1;
+}
+
+static int lua_cachegc(lua_State* L)
+{
+	lua_checkobject<LRUCache>(L, 1)->Clear(L);
+	return lua_gcobject<LRUCache>(L);
+}
+#pragma endregion
+
+#pragma region PriorityQueue
+struct PriorityHeap
+{
+	static constexpr const char* MetaName = "ProddyUtils.PriorityQueue";
+	static constexpr uint32_t None = UINT32_MAX;
+
+	struct Node
+	{
+		double Priority;
+		uint32_t Slot;
+	};
+
+	bool Max;
+	std::vector<Node> Heap;
+	// Heap index of each slot's node, None when the slot is free.
+	std::vector<uint32_t> Positions;
+	// Bumped whenever a slot is freed, so handles to an earlier value in the same slot stop working.
+	std::vector<uint32_t> Generations;
+	std::vector<uint32_t> Free;
+
+	PriorityHeap(bool bMax) : Max(bMax) {}
+
+	bool Before(const Node& a, const Node& b) const
+	{
+		return Max ? a.Priority > b.Priority : a.Priority < b.Priority;
+	}
+
+	void Place(size_t i, const Node& node)
+	{
+		Heap[i] = node;
+		Positions[node.Slot] = (uint32_t)i;
+	}
+
+	void SiftUp(size_t i)
+	{
+		auto node = Heap[i];
+		while (i > 0)
+		{
+			auto parent = (i - 1) / 2;
+			if (!Before(node, Heap[parent]))
+				break;
+			Place(i, Heap[parent]);
+			i = parent;
+		}
+		Place(i, node);
+	}
+
+	void SiftDown(size_t i)
+	{
+		auto node = Heap[i];
+		auto size = Heap.size();
+		for (;;)
+		{
+			auto child = i * 2 + 1;
+			if (child >= size)
+				break;
+			if (child + 1 < size && Before(Heap[child + 1], Heap[child]))
+				child++;
+			if (!Before(Heap[child], node))
+				break;
+			Place(i, Heap[child]);
+			i = child;
+		}
+		Place(i, node);
+	}
+
+	uint32_t Allocate()
+	{
+		if (!Free.empty())
+		{
+			auto slot = Free.back();
+			Free.pop_back();
+			return slot;
+		}
+		Positions.push_back(None);
+		Generations.push_back(0);
+		return (uint32_t)Positions.size() - 1;
+	}
+
+	// The generation in the high bits, then Slot + 1.
+	lua_Integer Handle(uint32_t slot) const
+	{
+		return (lua_Integer)Generations[slot] << 32 | (slot + 1);
+	}
+
+	// Appends without restoring the heap property, callers follow up with SiftUp or Heapify.
+	uint32_t Append(double priority)
+	{
+		auto slot = Allocate();
+		Heap.push_back({ priority, slot });
+		Positions[slot] = (uint32_t)Heap.size() - 1;
+		return slot;
+	}
+
+	void Heapify()
+	{
+		for (auto i = Heap.size() / 2; i-- > 0;)
+			SiftDown(i);
+	}
+
+	uint32_t PopFront()
+	{
+		auto slot = Heap[0].Slot;
+		Positions[slot] = None;
+		Generations[slot] = (Generations[slot] + 1) & 0x7FFFFFFF;
+		Free.push_back(slot);
+		auto last = Heap.back();
+		Heap.pop_back();
+		if (!Heap.empty())
+		{
+			Heap[0] = last;
+			SiftDown(0);
+		}
+		return slot;
+	}
+
+	bool Update(lua_Integer handle, double priority)
+	{
+		auto slot = (uint32_t)(handle & 0xFFFFFFFF) - 1;
+		if (slot >= Positions.size() || Positions[slot] == None || handle >> 32 != Generations[slot])
+			return false;
+		auto i = Positions[slot];
+		auto old = Heap[i].Priority;
+		Heap[i].Priority = priority;
+		if (Before(Heap[i], Node{ old, slot }))
+			SiftUp(i);
+		else
+			SiftDown(i);
+		return true;
+	}
+};
+
+static int lua_pqnew(lua_State* L)
+{
+	auto bMax = lua_toboolean(L, 1) != 0;
+	lua_newobject<PriorityHeap>(L, bMax);
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+	return 1;
+}
+
+static int lua_pqpush(lua_State* L)
+{
+	auto pq = lua_checkobject<PriorityHeap>(L, 1);
+	luaL_checkany(L, 2);
+	auto priority = luaL_checknumber(L, 3);
+	auto slot = pq->Append(priority);
+	pq->SiftUp(pq->Heap.size() - 1);
+	lua_getuservalue(L, 1);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, slot + 1);
+	lua_pushinteger(L, pq->Handle(slot));
+	return 1;
+}
+
+static int lua_pqpushall(lua_State* L)
+{
+	auto pq = lua_checkobject<PriorityHeap>(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	auto count = lua_rawlen(L, 2);
+	luaL_argcheck(L, lua_rawlen(L, 3) == count, 3, "priorities must match values");
+	lua_getuservalue(L, 1);
+	pq->Heap.reserve(pq->Heap.size() + count);
+	for (size_t i = 1; i <= count; i++)
+	{
+		lua_rawgeti(L, 3, i);
+		int isnum;
+		auto priority = lua_tonumberx(L, -1, &isnum);
+		lua_pop(L, 1);
+		if (!isnum)
+		{
+			pq->Heapify();
+			return luaL_error(L, "priority %d is not a number", (int)i);
+		}
+		auto slot = pq->Append(priority);
+		lua_rawgeti(L, 2, i);
+		lua_rawseti(L, -2, slot + 1);
+	}
+	pq->Heapify();
+	lua_pushinteger(L, count);
+	return 1;
+}
+
+static int lua_pqpeek(lua_State* L)
+{
+	auto pq = lua_checkobject<PriorityHeap>(L, 1);
+	if (pq->Heap.empty())
+		return 0;
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, pq->Heap[0].Slot + 1);
+	lua_pushnumber(L, pq->Heap[0].Priority);
+	lua_pushinteger(L, pq->Handle(pq->Heap[0].Slot));
+	return 3;
+}
+
+static int lua_pqpop(lua_State* L)
+{
+	auto pq = lua_checkobject<PriorityHeap>(L, 1);
+	if (pq->Heap.empty())
+		return 0;
+	auto priority = pq->Heap[0].Priority;
+	auto slot = pq->PopFront();
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, slot + 1);
+	lua_pushnil(L);
+	lua_rawseti(L, -3, slot + 1);
+	lua_pushnumber(L, priority);
+	return 2;
+}
+
+static int lua_pqupdate(lua_State* L)
+{
+	auto pq = lua_checkobject<PriorityHeap>(L, 1);
+	auto handle = luaL_checkinteger(L, 2);
+	auto priority = luaL_checknumber(L, 3);
+	lua_pushboolean(L, pq->Update(handle, priority));
+	return 1;
+}
+
+static int lua_pqsize(lua_State* L)
+{
+	auto pq = lua_checkobject<PriorityHeap>(L, 1);
+	lua_pushinteger(L, pq->Heap.size());
+	return 1;
+}
+#pragma endregion
+
+#pragma region OrderedMap
+struct OrderedKey
+{
+	enum : uint8_t { Integer, Float, String } Type = Integer;
+	lua_Integer Int = 0;
+	double Num = 0;
+	std::string Str;
+
+	// Compares exactly, the way Lua's own number comparison does. Converting i to double would round above 2^53 and break transitivity.
+	static int CompareIntFloat(lua_Integer i, double f)
+	{
+		if (f >= 9223372036854775808.0)
+			return -1;
+		if (f < -9223372036854775808.0)
+			return 1;
+		auto whole = std::floor(f);
+		auto fi = (lua_Integer)whole;
+		if (i != fi)
+			return i < fi ? -1 : 1;
+		return f > whole ? -1 : 0;
+	}
+
+	// Numbers order before strings. Strings compare bytewise.
+	int Compare(const OrderedKey& other) const
+	{
+		if (Type == String || other.Type == String)
+		{
+			if (Type != other.Type)
+				return Type == String ? 1 : -1;
+			auto result = Str.compare(other.Str);
+			return result < 0 ? -1 : result > 0 ? 1 : 0;
+		}
+		if (Type == Integer && other.Type == Integer)
+			return Int < other.Int ? -1 : Int > other.Int ? 1 : 0;
+		if (Type == Integer)
+			return CompareIntFloat(Int, other.Num);
+		if (other.Type == Integer)
+			return -CompareIntFloat(other.Int, Num);
+		return Num < other.Num ? -1 : Num > other.Num ? 1 : 0;
+	}
+
+	bool operator<(const OrderedKey& other) const
+	{
+		return Compare(other) < 0;
+	}
+};
+
+bool lua_toorderedkey(lua_State* L, int idx, OrderedKey& key)
+{
+	switch (lua_type(L, idx))
+	{
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, idx))
+		{
+			key.Type = OrderedKey::Integer;
+			key.Int = lua_tointeger(L, idx);
+			return true;
+		}
+		key.Num = lua_tonumber(L, idx);
+		// Integral floats are stored as integers, as Lua does for table keys, so 2.0 and 2 are the same key.
+		if (key.Num >= -9223372036854775808.0 && key.Num < 9223372036854775808.0 && std::floor(key.Num) == key.Num)
+		{
+			key.Type = OrderedKey::Integer;
+			key.Int = (lua_Integer)key.Num;
+			return true;
+		}
+		key.Type = OrderedKey::Float;
+		return key.Num == key.Num;
+	case LUA_TSTRING:
+	{
+		size_t len;
+		auto text = lua_tolstring(L, idx, &len);
+		key.Type = OrderedKey::String;
+		key.Str.assign(text, len);
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+void lua_pushorderedkey(lua_State* L, const OrderedKey& key)
+{
+	switch (key.Type)
+	{
+	case OrderedKey::Integer:
+		lua_pushinteger(L, key.Int);
+		break;
+	case OrderedKey::Float:
+		lua_pushnumber(L, key.Num);
+		break;
+	default:
+		lua_pushlstring(L, key.Str);
+		break;
+	}
+}
+
+// B+ tree. Leaves hold the keys and are linked for range iteration, values live in the userdata's uservalue table indexed by slot.
+struct BTreeMap
+{
+	static constexpr const char* MetaName = "ProddyUtils.OrderedMap";
+	// Nodes hold up to Order - 1 keys, the spare slot absorbs an insert before splitting.
+	static constexpr int Order = 32;
+	static constexpr int MinKeys = (Order - 1) / 2;
+
+	struct Node
+	{
+		bool Leaf;
+		int Count = 0;
+		OrderedKey Keys[Order];
+
+		Node(bool bLeaf) : Leaf(bLeaf) {}
+
+		// Index of the first key >= key.
+		int LowerBound(const OrderedKey& key) const
+		{
+			int lo = 0, hi = Count;
+			while (lo < hi)
+			{
+				int mid = (lo + hi) / 2;
+				if (Keys[mid] < key)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return lo;
+		}
+
+		// Index of the first key > key.
+		int UpperBound(const OrderedKey& key) const
+		{
+			int lo = 0, hi = Count;
+			while (lo < hi)
+			{
+				int mid = (lo + hi) / 2;
+				if (key < Keys[mid])
+					hi = mid;
+				else
+					lo = mid + 1;
+			}
+			return lo;
+		}
+	};
+
+	struct LeafNode : Node
+	{
+		int Values[Order];
+		LeafNode* Prev = nullptr;
+		LeafNode* Next = nullptr;
+
+		LeafNode() : Node(true) {}
+	};
+
+	struct InnerNode : Node
+	{
+		Node* Children[Order + 1];
+
+		InnerNode() : Node(false) {}
+	};
+
+	Node* Root = new LeafNode();
+	size_t Size = 0;
+	// Bumped whenever keys move between nodes, so live iterators know to seek again.
+	uint64_t Version = 0;
+	int NextSlot = 1;
+	std::vector<int> Free;
+
+	~BTreeMap()
+	{
+		Destroy(Root);
+	}
+
+	static void Destroy(Node* node)
+	{
+		if (node->Leaf)
+			delete static_cast<LeafNode*>(node);
+		else
+		{
+			auto inner = static_cast<InnerNode*>(node);
+			for (int i = 0; i <= inner->Count; i++)
+				Destroy(inner->Children[i]);
+			delete inner;
+		}
+	}
+
+	int AllocateSlot()
+	{
+		if (Free.empty())
+			return NextSlot++;
+		auto slot = Free.back();
+		Free.pop_back();
+		return slot;
+	}
+
+	LeafNode* FindLeaf(const OrderedKey& key) const
+	{
+		auto node = Root;
+		while (!node->Leaf)
+		{
+			auto inner = static_cast<InnerNode*>(node);
+			node = inner->Children[inner->UpperBound(key)];
+		}
+		return static_cast<LeafNode*>(node);
+	}
+
+	// Returns the value slot for key, or 0.
+	int Find(const OrderedKey& key) const
+	{
+		auto leaf = FindLeaf(key);
+		auto i = leaf->LowerBound(key);
+		return i < leaf->Count && leaf->Keys[i].Compare(key) == 0 ? leaf->Values[i] : 0;
+	}
+
+	// Position of the first key >= key (> key when bStrict, the smallest key when bFirst), leaf is null when there is none.
+	void Seek(const OrderedKey& key, bool bStrict, LeafNode*& leaf, int& i, bool bFirst = false) const
+	{
+		leaf = bFirst ? First() : FindLeaf(key);
+		i = bFirst ? 0 : bStrict ? leaf->UpperBound(key) : leaf->LowerBound(key);
+		while (leaf != nullptr && i >= leaf->Count)
+		{
+			leaf = leaf->Next;
+			i = 0;
+		}
+	}
+
+	// Position of the last key <= key, leaf is null when there is none.
+	void SeekFloor(const OrderedKey& key, LeafNode*& leaf, int& i) const
+	{
+		leaf = FindLeaf(key);
+		i = leaf->UpperBound(key) - 1;
+		while (leaf != nullptr && i < 0)
+		{
+			leaf = leaf->Prev;
+			i = leaf != nullptr ? leaf->Count - 1 : 0;
+		}
+	}
+
+	LeafNode* First() const
+	{
+		auto node = Root;
+		while (!node->Leaf)
+			node = static_cast<InnerNode*>(node)->Children[0];
+		return static_cast<LeafNode*>(node);
+	}
+
+	// Inserts key with a fresh slot, or returns the existing slot. bInserted reports which.
+	int Insert(const OrderedKey& key, bool& bInserted)
+	{
+		OrderedKey separator;
+		Node* sibling = nullptr;
+		auto slot = Insert(Root, key, bInserted, separator, sibling);
+		if (sibling != nullptr)
+		{
+			auto root = new InnerNode();
+			root->Keys[0] = std::move(separator);
+			root->Children[0] = Root;
+			root->Children[1] = sibling;
+			root->Count = 1;
+			Root = root;
+		}
+		if (bInserted)
+		{
+			Size++;
+			Version++;
+		}
+		return slot;
+	}
+
+	int Insert(Node* node, const OrderedKey& key, bool& bInserted, OrderedKey& separator, Node*& sibling)
+	{
+		sibling = nullptr;
+		int slot;
+		if (node->Leaf)
+		{
+			auto leaf = static_cast<LeafNode*>(node);
+			auto i = leaf->LowerBound(key);
+			if (i < leaf->Count && leaf->Keys[i].Compare(key) == 0)
+			{
+				bInserted = false;
+				return leaf->Values[i];
+			}
+			bInserted = true;
+			slot = AllocateSlot();
+			std::move_backward(leaf->Keys + i, leaf->Keys + leaf->Count, leaf->Keys + leaf->Count + 1);
+			std::move_backward(leaf->Values + i, leaf->Values + leaf->Count, leaf->Values + leaf->Count + 1);
+			leaf->Keys[i] = key;
+			leaf->Values[i] = slot;
+			leaf->Count++;
+			if (leaf->Count == Order)
+			{
+				auto right = new LeafNode();
+				auto half = Order / 2;
+				right->Count = Order - half;
+				std::move(leaf->Keys + half, leaf->Keys + Order, right->Keys);
+				std::copy(leaf->Values + half, leaf->Values + Order, right->Values);
+				leaf->Count = half;
+				right->Next = leaf->Next;
+				right->Prev = leaf;
+				if (leaf->Next != nullptr)
+					leaf->Next->Prev = right;
+				leaf->Next = right;
+				separator = right->Keys[0];
+				sibling = right;
+			}
+			return slot;
+		}
+		auto inner = static_cast<InnerNode*>(node);
+		auto i = inner->UpperBound(key);
+		OrderedKey childSeparator;
+		Node* childSibling;
+		slot = Insert(inner->Children[i], key, bInserted, childSeparator, childSibling);
+		if (childSibling == nullptr)
+			return slot;
+		std::move_backward(inner->Keys + i, inner->Keys + inner->Count, inner->Keys + inner->Count + 1);
+		std::move_backward(inner->Children + i + 1, inner->Children + inner->Count + 1, inner->Children + inner->Count + 2);
+		inner->Keys[i] = std::move(childSeparator);
+		inner->Children[i + 1] = childSibling;
+		inner->Count++;
+		if (inner->Count == Order)
+		{
+			auto right = new InnerNode();
+			auto mid = Order / 2;
+			separator = std::move(inner->Keys[mid]);
+			right->Count = Order - mid - 1;
+			std::move(inner->Keys + mid + 1, inner->Keys + Order, right->Keys);
+			std::copy(inner->Children + mid + 1, inner->Children + Order + 1, right->Children);
+			inner->Count = mid;
+			sibling = right;
+		}
+		return slot;
+	}
+
+	// Removes key and returns its slot, or 0 if it wasn't present.
+	int Erase(const OrderedKey& key)
+	{
+		auto slot = Erase(Root, key);
+		if (slot == 0)
+			return 0;
+		if (!Root->Leaf && Root->Count == 0)
+		{
+			auto inner = static_cast<InnerNode*>(Root);
+			Root = inner->Children[0];
+			delete inner;
+		}
+		Free.push_back(slot);
+		Size--;
+		Version++;
+		return slot;
+	}
+
+	int Erase(Node* node, const OrderedKey& key)
+	{
+		if (node->Leaf)
+		{
+			auto leaf = static_cast<LeafNode*>(node);
+			auto i = leaf->LowerBound(key);
+			if (i >= leaf->Count || leaf->Keys[i].Compare(key) != 0)
+				return 0;
+			auto slot = leaf->Values[i];
+			std::move(leaf->Keys + i + 1, leaf->Keys + leaf->Count, leaf->Keys + i);
+			std::move(leaf->Values + i + 1, leaf->Values + leaf->Count, leaf->Values + i);
+			leaf->Count--;
+			return slot;
+		}
+		auto inner = static_cast<InnerNode*>(node);
+		auto i = inner->UpperBound(key);
+		auto slot = Erase(inner->Children[i], key);
+		if (slot != 0 && inner->Children[i]->Count < MinKeys)
+			Rebalance(inner, i);
+		return slot;
+	}
+
+	// Refills Children[i] from a sibling, or merges it with one.
+	void Rebalance(InnerNode* parent, int i)
+	{
+		auto child = parent->Children[i];
+		auto left = i > 0 ? parent->Children[i - 1] : nullptr;
+		auto right = i < parent->Count ? parent->Children[i + 1] : nullptr;
+		if (child->Leaf)
+		{
+			auto leaf = static_cast<LeafNode*>(child);
+			if (right != nullptr && right->Count > MinKeys)
+			{
+				auto from = static_cast<LeafNode*>(right);
+				leaf->Keys[leaf->Count] = std::move(from->Keys[0]);
+				leaf->Values[leaf->Count] = from->Values[0];
+				leaf->Count++;
+				std::move(from->Keys + 1, from->Keys + from->Count, from->Keys);
+				std::move(from->Values + 1, from->Values + from->Count, from->Values);
+				from->Count--;
+				parent->Keys[i] = from->Keys[0];
+			}
+			else if (left != nullptr && left->Count > MinKeys)
+			{
+				auto from = static_cast<LeafNode*>(left);
+				std::move_backward(leaf->Keys, leaf->Keys + leaf->Count, leaf->Keys + leaf->Count + 1);
+				std::move_backward(leaf->Values, leaf->Values + leaf->Count, leaf->Values + leaf->Count + 1);
+				from->Count--;
+				leaf->Keys[0] = std::move(from->Keys[from->Count]);
+				leaf->Values[0] = from->Values[from->Count];
+				leaf->Count++;
+				parent->Keys[i - 1] = leaf->Keys[0];
+			}
+			else if (right != nullptr)
+				MergeLeaves(parent, i);
+			else
+				MergeLeaves(parent, i - 1);
+			return;
+		}
+		auto inner = static_cast<InnerNode*>(child);
+		if (right != nullptr && right->Count > MinKeys)
+		{
+			auto from = static_cast<InnerNode*>(right);
+			inner->Keys[inner->Count] = std::move(parent->Keys[i]);
+			inner->Children[inner->Count + 1] = from->Children[0];
+			inner->Count++;
+			parent->Keys[i] = std::move(from->Keys[0]);
+			std::move(from->Keys + 1, from->Keys + from->Count, from->Keys);
+			std::copy(from->Children + 1, from->Children + from->Count + 1, from->Children);
+			from->Count--;
+		}
+		else if (left != nullptr && left->Count > MinKeys)
+		{
+			auto from = static_cast<InnerNode*>(left);
+			std::move_backward(inner->Keys, inner->Keys + inner->Count, inner->Keys + inner->Count + 1);
+			std::copy_backward(inner->Children, inner->Children + inner->Count + 1, inner->Children + inner->Count + 2);
+			inner->Keys[0] = std::move(parent->Keys[i - 1]);
+			inner->Children[0] = from->Children[from->Count];
+			inner->Count++;
+			parent->Keys[i - 1] = std::move(from->Keys[from->Count - 1]);
+			from->Count--;
+		}
+		else if (right != nullptr)
+			MergeInner(parent, i);
+		else
+			MergeInner(parent, i - 1);
+	}
+
+	// Removes the parent's key i and child i + 1 after child i + 1 was merged into child i.
+	static void RemoveSeparator(InnerNode* parent, int i)
+	{
+		std::move(parent->Keys + i + 1, parent->Keys + parent->Count, parent->Keys + i);
+		std::copy(parent->Children + i + 2, parent->Children + parent->Count + 1, parent->Children + i + 1);
+		parent->Count--;
+	}
+
+	static void MergeLeaves(InnerNode* parent, int i)
+	{
+		auto left = static_cast<LeafNode*>(parent->Children[i]);
+		auto right = static_cast<LeafNode*>(parent->Children[i + 1]);
+		std::move(right->Keys, right->Keys + right->Count, left->Keys + left->Count);
+		std::copy(right->Values, right->Values + right->Count, left->Values + left->Count);
+		left->Count += right->Count;
+		left->Next = right->Next;
+		if (right->Next != nullptr)
+			right->Next->Prev = left;
+		delete right;
+		RemoveSeparator(parent, i);
+	}
+
+	static void MergeInner(InnerNode* parent, int i)
+	{
+		auto left = static_cast<InnerNode*>(parent->Children[i]);
+		auto right = static_cast<InnerNode*>(parent->Children[i + 1]);
+		left->Keys[left->Count] = std::move(parent->Keys[i]);
+		std::move(right->Keys, right->Keys + right->Count, left->Keys + left->Count + 1);
+		std::copy(right->Children, right->Children + right->Count + 1, left->Children + left->Count + 1);
+		left->Count += right->Count + 1;
+		delete right;
+		RemoveSeparator(parent, i);
+	}
+};
+
+struct BTreeCursor
+{
+	static constexpr const char* MetaName = "ProddyUtils.OrderedMapCursor";
+
+	BTreeMap::LeafNode* Leaf = nullptr;
+	int Index = 0;
+	uint64_t Version = 0;
+	bool Started = false;
+	bool HasLow = false;
+	bool HasHigh = false;
+	OrderedKey Last;
+	OrderedKey Low;
+	OrderedKey High;
+};
+
+static int lua_orderedmapnew(lua_State* L)
+{
+	lua_newobject<BTreeMap>(L);
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+	return 1;
+}
+
+static OrderedKey lua_checkorderedkey(lua_State* L, int idx)
+{
+	OrderedKey key;
+	if (!lua_toorderedkey(L, idx, key))
+		luaL_argerror(L, idx, "number or string expected");
+	return key;
+}
+
+static int lua_orderedmaperase(lua_State* L)
+{
+	auto map = lua_checkobject<BTreeMap>(L, 1);
+	auto slot = map->Erase(lua_checkorderedkey(L, 2));
+	if (slot != 0)
+	{
+		lua_getuservalue(L, 1);
+		lua_pushnil(L);
+		lua_rawseti(L, -2, slot);
+		lua_pop(L, 1);
+	}
+	lua_pushboolean(L, slot != 0);
+	return 1;
+}
+
+static int lua_orderedmapinsert(lua_State* L)
+{
+	auto map = lua_checkobject<BTreeMap>(L, 1);
+	luaL_checkany(L, 3);
+	if (lua_isnil(L, 3))
+		return lua_orderedmaperase(L);
+	bool bInserted;
+	auto slot = map->Insert(lua_checkorderedkey(L, 2), bInserted);
+	lua_getuservalue(L, 1);
+	lua_pushvalue(L, 3);
+	lua_rawseti(L, -2, slot);
+	lua_pushboolean(L, bInserted);
+	return 1;
+}
+
+static int lua_orderedmapfind(lua_State* L)
+{
+	auto map = lua_checkobject<BTreeMap>(L, 1);
+	auto slot = map->Find(lua_checkorderedkey(L, 2));
+	if (slot == 0)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, slot);
+	return 1;
+}
+
+static int lua_pushorderedentry(lua_State* L, const BTreeMap::LeafNode* leaf, int i)
+{
+	if (leaf == nullptr)
+		return 0;
+	lua_pushorderedkey(L, leaf->Keys[i]);
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, leaf->Values[i]);
+	lua_remove(L, -2);
+	return 2;
+}
+
+static int lua_orderedmapfloor(lua_State* L)
+{
+	auto map = lua_checkobject<BTreeMap>(L, 1);
+	BTreeMap::LeafNode* leaf;
+	int i;
+	map->SeekFloor(lua_checkorderedkey(L, 2), leaf, i);
+	return lua_pushorderedentry(L, leaf, i);
+}
+
+static int lua_orderedmapceil(lua_State* L)
+{
+	auto map = lua_checkobject<BTreeMap>(L, 1);
+	BTreeMap::LeafNode* leaf;
+	int i;
+	map->Seek(lua_checkorderedkey(L, 2), false, leaf, i);
+	return lua_pushorderedentry(L, leaf, i);
+}
+
+static int lua_orderedmapsize(lua_State* L)
+{
+	auto map = lua_checkobject<BTreeMap>(L, 1);
+	lua_pushinteger(L, map->Size);
+	return 1;
+}
+
+// Upvalues are the map and the cursor. Seeks again by the last key returned if the map changed shape since the previous step.
+static int lua_orderedmaprangestep(lua_State* L)
+{
+	auto map = static_cast<BTreeMap*>(lua_touserdata(L, lua_upvalueindex(1)));
+	auto cursor = static_cast<BTreeCursor*>(lua_touserdata(L, lua_upvalueindex(2)));
+	if (!cursor->Started)
+	{
+		if (cursor->HasLow)
+			map->Seek(cursor->Low, false, cursor->Leaf, cursor->Index);
+		else
+			map->Seek(OrderedKey(), false, cursor->Leaf, cursor->Index, true);
+		cursor->Started = true;
+		cursor->Version = map->Version;
+	}
+	else if (cursor->Leaf == nullptr)
+		return 0;
+	else if (cursor->Version != map->Version)
+	{
+		map->Seek(cursor->Last, true, cursor->Leaf, cursor->Index);
+		cursor->Version = map->Version;
+	}
+	else if (++cursor->Index >= cursor->Leaf->Count)
+	{
+		cursor->Leaf = cursor->Leaf->Next;
+		cursor->Index = 0;
+	}
+	auto leaf = cursor->Leaf;
+	if (leaf == nullptr || (cursor->HasHigh && cursor->High < leaf->Keys[cursor->Index]))
+	{
+		cursor->Leaf = nullptr;
+		return 0;
+	}
+	cursor->Last = leaf->Keys[cursor->Index];
+	lua_pushorderedkey(L, leaf->Keys[cursor->Index]);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_getuservalue(L, -1);
+	lua_rawgeti(L, -1, leaf->Values[cursor->Index]);
+	lua_remove(L, -2);
+	lua_remove(L, -2);
+	return 2;
+}
+
+static int lua_orderedmaprange(lua_State* L)
+{
+	lua_checkobject<BTreeMap>(L, 1);
+	auto cursor = lua_newobject<BTreeCursor>(L);
+	if (!lua_isnoneornil(L, 2))
+	{
+		cursor->Low = lua_checkorderedkey(L, 2);
+		cursor->HasLow = true;
+	}
+	if (!lua_isnoneornil(L, 3))
+	{
+		cursor->High = lua_checkorderedkey(L, 3);
+		cursor->HasHigh = true;
+	}
+	lua_pushvalue(L, 1);
+	lua_insert(L, -2);
+	lua_pushcclosure(L, lua_orderedmaprangestep, 2);
+	return 1;
+}
+#pragma endregion
+
+#pragma region TypedArrays
+double ArraySum(const double* p, size_t n)
+{
+	size_t i = 0;
+	double sum = 0;
+	if (CPU.AVX2 && n >= 8)
+	{
+		auto acc0 = _mm256_setzero_pd();
+		auto acc1 = _mm256_setzero_pd();
+		for (; i + 8 <= n; i += 8)
+		{
+			acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(p + i));
+			acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(p + i + 4));
+		}
+		alignas(32) double lanes[4];
+		_mm256_store_pd(lanes, _mm256_add_pd(acc0, acc1));
+		_mm256_zeroupper();
+		sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	}
+	for (; i < n; i++)
+		sum += p[i];
+	return sum;
+}
+
+double ArrayMin(const double* p, size_t n)
+{
+	size_t i = 1;
+	double result = p[0];
+	if (CPU.AVX2 && n >= 4)
+	{
+		auto acc = _mm256_loadu_pd(p);
+		for (i = 4; i + 4 <= n; i += 4)
+			acc = _mm256_min_pd(acc, _mm256_loadu_pd(p + i));
+		alignas(32) double lanes[4];
+		_mm256_store_pd(lanes, acc);
+		_mm256_zeroupper();
+		result = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+	}
+	for (; i < n; i++)
+		result = std::min(result, p[i]);
+	return result;
+}
+
+double ArrayMax(const double* p, size_t n)
+{
+	size_t i = 1;
+	double result = p[0];
+	if (CPU.AVX2 && n >= 4)
+	{
+		auto acc = _mm256_loadu_pd(p);
+		for (i = 4; i + 4 <= n; i += 4)
+			acc = _mm256_max_pd(acc, _mm256_loadu_pd(p + i));
+		alignas(32) double lanes[4];
+		_mm256_store_pd(lanes, acc);
+		_mm256_zeroupper();
+		result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+	}
+	for (; i < n; i++)
+		result = std::max(result, p[i]);
+	return result;
+}
+
+double ArrayDot(const double* a, const double* b, size_t n)
+{
+	size_t i = 0;
+	double sum = 0;
+	if (CPU.AVX2 && n >= 8)
+	{
+		auto acc0 = _mm256_setzero_pd();
+		auto acc1 = _mm256_setzero_pd();
+		for (; i + 8 <= n; i += 8)
+		{
+			acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+			acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+		}
+		alignas(32) double lanes[4];
+		_mm256_store_pd(lanes, _mm256_add_pd(acc0, acc1));
+		_mm256_zeroupper();
+		sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	}
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+void ArrayScale(double* p, size_t n, double k)
+{
+	size_t i = 0;
+	if (CPU.AVX2)
+	{
+		auto factor = _mm256_set1_pd(k);
+		for (; i + 4 <= n; i += 4)
+			_mm256_storeu_pd(p + i, _mm256_mul_pd(_mm256_loadu_pd(p + i), factor));
+		_mm256_zeroupper();
+	}
+	for (; i < n; i++)
+		p[i] *= k;
+}
+
+void ArrayAdd(double* p, const double* other, size_t n)
+{
+	size_t i = 0;
+	if (CPU.AVX2)
+	{
+		for (; i + 4 <= n; i += 4)
+			_mm256_storeu_pd(p + i, _mm256_add_pd(_mm256_loadu_pd(p + i), _mm256_loadu_pd(other + i)));
+		_mm256_zeroupper();
+	}
+	for (; i < n; i++)
+		p[i] += other[i];
+}
+
+void ArrayAdd(double* p, size_t n, double k)
+{
+	size_t i = 0;
+	if (CPU.AVX2)
+	{
+		auto addend = _mm256_set1_pd(k);
+		for (; i + 4 <= n; i += 4)
+			_mm256_storeu_pd(p + i, _mm256_add_pd(_mm256_loadu_pd(p + i), addend));
+		_mm256_zeroupper();
+	}
+	for (; i < n; i++)
+		p[i] += k;
+}
+
+// Int32 sums and dot products accumulate in 64 bits, Scale and Add wrap like 32 bit integers.
+int64_t ArraySum(const int32_t* p, size_t n)
+{
+	size_t i = 0;
+	int64_t sum = 0;
+	if (CPU.AVX2 && n >= 8)
+	{
+		auto acc = _mm256_setzero_si256();
+		for (; i + 8 <= n; i += 8)
+		{
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+			acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+			acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+		}
+		alignas(32) int64_t lanes[4];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+		_mm256_zeroupper();
+		sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	for (; i < n; i++)
+		sum += p[i];
+	return sum;
+}
+
+int32_t ArrayMin(const int32_t* p, size_t n)
+{
+	size_t i = 1;
+	int32_t result = p[0];
+	if (CPU.AVX2 && n >= 8)
+	{
+		auto acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		for (i = 8; i + 8 <= n; i += 8)
+			acc = _mm256_min_epi32(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)));
+		alignas(32) int32_t lanes[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+		_mm256_zeroupper();
+		result = *std::min_element(lanes, lanes + 8);
+	}
+	for (; i < n; i++)
+		result = std::min(result, p[i]);
+	return result;
+}
+
+int32_t ArrayMax(const int32_t* p, size_t n)
+{
+	size_t i = 1;
+	int32_t result = p[0];
+	if (CPU.AVX2 && n >= 8)
+	{
+		auto acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		for (i = 8; i + 8 <= n; i += 8)
+			acc = _mm256_max_epi32(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)));
+		alignas(32) int32_t lanes[8];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+		_mm256_zeroupper();
+		result = *std::max_element(lanes, lanes + 8);
+	}
+	for (; i < n; i++)
+		result = std::max(result, p[i]);
+	return result;
+}
+
+int64_t ArrayDot(const int32_t* a, const int32_t* b, size_t n)
+{
+	size_t i = 0;
+	int64_t sum = 0;
+	if (CPU.AVX2 && n >= 8)
+	{
+		auto acc = _mm256_setzero_si256();
+		for (; i + 8 <= n; i += 8)
+		{
+			auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+			auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+			// mul_epi32 multiplies the even lanes into 64 bits, shifting brings the odd lanes down.
+			acc = _mm256_add_epi64(acc, _mm256_mul_epi32(va, vb));
+			acc = _mm256_add_epi64(acc, _mm256_mul_epi32(_mm256_srli_epi64(va, 32), _mm256_srli_epi64(vb, 32)));
+		}
+		alignas(32) int64_t lanes[4];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+		_mm256_zeroupper();
+		sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	for (; i < n; i++)
+		sum += (int64_t)a[i] * b[i];
+	return sum;
+}
+
+void ArrayScale(int32_t* p, size_t n, int32_t k)
+{
+	size_t i = 0;
+	if (CPU.AVX2)
+	{
+		auto factor = _mm256_set1_epi32(k);
+		for (; i + 8 <= n; i += 8)
+		{
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i), _mm256_mullo_epi32(v, factor));
+		}
+		_mm256_zeroupper();
+	}
+	for (; i < n; i++)
+		p[i] = (int32_t)((uint32_t)p[i] * (uint32_t)k);
+}
+
+void ArrayAdd(int32_t* p, const int32_t* other, size_t n)
+{
+	size_t i = 0;
+	if (CPU.AVX2)
+	{
+		for (; i + 8 <= n; i += 8)
+		{
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+			auto w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(other + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i), _mm256_add_epi32(v, w));
+		}
+		_mm256_zeroupper();
+	}
+	for (; i < n; i++)
+		p[i] = (int32_t)((uint32_t)p[i] + (uint32_t)other[i]);
+}
+
+void ArrayAdd(int32_t* p, size_t n, int32_t k)
+{
+	size_t i = 0;
+	if (CPU.AVX2)
+	{
+		auto addend = _mm256_set1_epi32(k);
+		for (; i + 8 <= n; i += 8)
+		{
+			auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i), _mm256_add_epi32(v, addend));
+		}
+		_mm256_zeroupper();
+	}
+	for (; i < n; i++)
+		p[i] = (int32_t)((uint32_t)p[i] + (uint32_t)k);
+}
+
+template <typename T>
+struct TypedArray
+{
+	std::vector<T> Data;
+
+	TypedArray(size_t size) : Data(size) {}
+};
+
+struct F64Array : TypedArray<double>
+{
+	static constexpr const char* MetaName = "ProddyUtils.Float64Array";
+
+	using TypedArray::TypedArray;
+
+	static void Push(lua_State* L, double value)
+	{
+		lua_pushnumber(L, value);
+	}
+
+	static bool To(lua_State* L, int idx, double& value)
+	{
+		int isnum;
+		auto n = lua_tonumberx(L, idx, &isnum);
+		if (!isnum)
+			return false;
+		value = n;
+		return true;
+	}
+};
+
+struct I32Array : TypedArray<int32_t>
+{
+	static constexpr const char* MetaName = "ProddyUtils.Int32Array";
+
+	using TypedArray::TypedArray;
+
+	static void Push(lua_State* L, int32_t value)
+	{
+		lua_pushinteger(L, value);
+	}
+
+	static bool To(lua_State* L, int idx, int32_t& value)
+	{
+		int isnum;
+		auto i = lua_tointegerx(L, idx, &isnum);
+		if (!isnum || i < INT32_MIN || i > INT32_MAX)
+			return false;
+		value = (int32_t)i;
+		return true;
+	}
+};
+
+template <typename A>
+static auto lua_checkelement(lua_State* L, int idx)
+{
+	typename decltype(A::Data)::value_type value;
+	if (!A::To(L, idx, value))
+		luaL_argerror(L, idx, std::is_same<A, I32Array>::value ? "32 bit integer expected" : "number expected");
+	return value;
+}
+
+// Copies the array part of the table at idx into the array, resizing it to match. The array is left untouched if any element is invalid.
+template <typename A>
+static void lua_filltypedarray(lua_State* L, A* array, int idx)
+{
+	auto size = lua_rawlen(L, idx);
+	size_t invalid = 0;
+	{
+		decltype(A::Data) data(size);
+		for (size_t i = 0; i < size && invalid == 0; i++)
+		{
+			lua_rawgeti(L, idx, i + 1);
+			if (!A::To(L, -1, data[i]))
+				invalid = i + 1;
+			lua_pop(L, 1);
+		}
+		if (invalid == 0)
+			array->Data.swap(data);
+	}
+	// Raised once the scratch vector is gone, as the error doesn't unwind C++ frames.
+	if (invalid != 0)
+		luaL_error(L, "element %d is not a valid %s", (int)invalid, std::is_same<A, I32Array>::value ? "32 bit integer" : "number");
+}
+
+template <typename A>
+static size_t lua_checkindex(lua_State* L, A* array, int idx)
+{
+	auto i = luaL_checkinteger(L, idx);
+	luaL_argcheck(L, i >= 1 && (lua_Unsigned)i <= array->Data.size(), idx, "index out of range");
+	return (size_t)(i - 1);
+}
+
+template <typename A>
+static int lua_typedarraynew(lua_State* L)
+{
+	if (lua_istable(L, 1))
+	{
+		auto array = lua_newobject<A>(L, 0);
+		lua_filltypedarray(L, array, 1);
+		return 1;
+	}
+	auto size = luaL_optinteger(L, 1, 0);
+	luaL_argcheck(L, size >= 0, 1, "size must not be negative");
+	lua_newobject<A>(L, (size_t)size);
+	return 1;
+}
+
+template <typename A>
+static int lua_typedarraysize(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	lua_pushinteger(L, array->Data.size());
+	return 1;
+}
+
+template <typename A>
+static int lua_typedarrayresize(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	auto size = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, size >= 0, 2, "size must not be negative");
+	array->Data.resize((size_t)size);
+	return 0;
+}
+
+template <typename A>
+static int lua_typedarrayget(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	A::Push(L, array->Data[lua_checkindex(L, array, 2)]);
+	return 1;
+}
+
+template <typename A>
+static int lua_typedarrayset(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	auto i = lua_checkindex(L, array, 2);
+	array->Data[i] = lua_checkelement<A>(L, 3);
+	return 0;
+}
+
+template <typename A>
+static int lua_typedarrayfill(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	if (lua_istable(L, 2))
+		lua_filltypedarray(L, array, 2);
+	else
+	{
+		auto value = lua_checkelement<A>(L, 2);
+		std::fill(array->Data.begin(), array->Data.end(), value);
+	}
+	return 0;
+}
+
+template <typename A>
+static int lua_typedarraytotable(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	auto size = array->Data.size();
+	lua_createtable(L, (int)size, 0);
+	for (size_t i = 0; i < size; i++)
+	{
+		A::Push(L, array->Data[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 1;
+}
+
+template <typename A>
+static int lua_typedarraysum(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	auto sum = ArraySum(array->Data.data(), array->Data.size());
+	if (std::is_same<A, I32Array>::value)
+		lua_pushinteger(L, (lua_Integer)sum);
+	else
+		lua_pushnumber(L, (lua_Number)sum);
+	return 1;
+}
+
+template <typename A>
+static int lua_typedarraymean(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	if (array->Data.empty())
+		return 0;
+	lua_pushnumber(L, (lua_Number)ArraySum(array->Data.data(), array->Data.size()) / array->Data.size());
+	return 1;
+}
+
+template <typename A>
+static int lua_typedarraymin(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	if (array->Data.empty())
+		return 0;
+	A::Push(L, ArrayMin(array->Data.data(), array->Data.size()));
+	return 1;
+}
+
+template <typename A>
+static int lua_typedarraymax(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	if (array->Data.empty())
+		return 0;
+	A::Push(L, ArrayMax(array->Data.data(), array->Data.size()));
+	return 1;
+}
+
+template <typename A>
+static int lua_typedarraydot(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	auto other = lua_checkobject<A>(L, 2);
+	luaL_argcheck(L, other->Data.size() == array->Data.size(), 2, "arrays must be the same size");
+	auto dot = ArrayDot(array->Data.data(), other->Data.data(), array->Data.size());
+	if (std::is_same<A, I32Array>::value)
+		lua_pushinteger(L, (lua_Integer)dot);
+	else
+		lua_pushnumber(L, (lua_Number)dot);
+	return 1;
+}
+
+template <typename A>
+static int lua_typedarrayscale(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	auto k = lua_checkelement<A>(L, 2);
+	ArrayScale(array->Data.data(), array->Data.size(), k);
+	return 0;
+}
+
+template <typename A>
+static int lua_typedarrayadd(lua_State* L)
+{
+	auto array = lua_checkobject<A>(L, 1);
+	if (lua_isuserdata(L, 2))
+	{
+		auto other = lua_checkobject<A>(L, 2);
+		luaL_argcheck(L, other->Data.size() == array->Data.size(), 2, "arrays must be the same size");
+		ArrayAdd(array->Data.data(), other->Data.data(), array->Data.size());
+	}
+	else
+	{
+		auto k = lua_checkelement<A>(L, 2);
+		ArrayAdd(array->Data.data(), array->Data.size(), k);
+	}
+	return 0;
+}
+#pragma endregion
+
+#pragma region Vec3Array
+// Structure of arrays so each component streams through its own SIMD register.
+struct Vec3SoA
+{
+	static constexpr const char* MetaName = "ProddyUtils.Vec3Array";
+
+	std::vector<double> X;
+	std::vector<double> Y;
+	std::vector<double> Z;
+
+	Vec3SoA(size_t size) : X(size), Y(size), Z(size) {}
+
+	size_t Size() const
+	{
+		return X.size();
+	}
+
+	void Resize(size_t size)
+	{
+		X.resize(size);
+		Y.resize(size);
+		Z.resize(size);
+	}
+
+	// Squared distances when bSquared, otherwise distances.
+	void Distances(const double p[3], double* out, bool bSquared) const
+	{
+		size_t i = 0;
+		auto n = Size();
+		if (CPU.AVX2)
+		{
+			auto px = _mm256_set1_pd(p[0]);
+			auto py = _mm256_set1_pd(p[1]);
+			auto pz = _mm256_set1_pd(p[2]);
+			for (; i + 4 <= n; i += 4)
+			{
+				auto dx = _mm256_sub_pd(_mm256_loadu_pd(&X[i]), px);
+				auto dy = _mm256_sub_pd(_mm256_loadu_pd(&Y[i]), py);
+				auto dz = _mm256_sub_pd(_mm256_loadu_pd(&Z[i]), pz);
+				auto d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+				_mm256_storeu_pd(out + i, bSquared ? d : _mm256_sqrt_pd(d));
+			}
+			_mm256_zeroupper();
+		}
+		for (; i < n; i++)
+		{
+			auto dx = X[i] - p[0];
+			auto dy = Y[i] - p[1];
+			auto dz = Z[i] - p[2];
+			auto d = dx * dx + dy * dy + dz * dz;
+			out[i] = bSquared ? d : std::sqrt(d);
+		}
+	}
+
+	// Appends the 0 based indexes of entries within radius of p.
+	void WithinRadius(const double p[3], double radius, std::vector<uint32_t>& out) const
+	{
+		size_t i = 0;
+		auto n = Size();
+		auto r2 = radius * radius;
+		if (CPU.AVX2)
+		{
+			auto px = _mm256_set1_pd(p[0]);
+			auto py = _mm256_set1_pd(p[1]);
+			auto pz = _mm256_set1_pd(p[2]);
+			auto limit = _mm256_set1_pd(r2);
+			for (; i + 4 <= n; i += 4)
+			{
+				auto dx = _mm256_sub_pd(_mm256_loadu_pd(&X[i]), px);
+				auto dy = _mm256_sub_pd(_mm256_loadu_pd(&Y[i]), py);
+				auto dz = _mm256_sub_pd(_mm256_loadu_pd(&Z[i]), pz);
+				auto d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+				auto mask = _mm256_movemask_pd(_mm256_cmp_pd(d, limit, _CMP_LE_OQ));
+				for (int lane = 0; mask != 0; lane++, mask >>= 1)
+				{
+					if (mask & 1)
+						out.push_back((uint32_t)(i + lane));
+				}
+			}
+			_mm256_zeroupper();
+		}
+		for (; i < n; i++)
+		{
+			auto dx = X[i] - p[0];
+			auto dy = Y[i] - p[1];
+			auto dz = Z[i] - p[2];
+			if (dx * dx + dy * dy + dz * dz <= r2)
+				out.push_back((uint32_t)i);
+		}
+	}
+
+	void Dot(const double p[3], double* out) const
+	{
+		size_t i = 0;
+		auto n = Size();
+		if (CPU.AVX2)
+		{
+			auto px = _mm256_set1_pd(p[0]);
+			auto py = _mm256_set1_pd(p[1]);
+			auto pz = _mm256_set1_pd(p[2]);
+			for (; i + 4 <= n; i += 4)
+			{
+				auto d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(&X[i]), px), _mm256_mul_pd(_mm256_loadu_pd(&Y[i]), py)), _mm256_mul_pd(_mm256_loadu_pd(&Z[i]), pz));
+				_mm256_storeu_pd(out + i, d);
+			}
+			_mm256_zeroupper();
+		}
+		for (; i < n; i++)
+			out[i] = X[i] * p[0] + Y[i] * p[1] + Z[i] * p[2];
+	}
+
+	// Replaces every entry with entry x p.
+	void Cross(const double p[3])
+	{
+		size_t i = 0;
+		auto n = Size();
+		if (CPU.AVX2)
+		{
+			auto px = _mm256_set1_pd(p[0]);
+			auto py = _mm256_set1_pd(p[1]);
+			auto pz = _mm256_set1_pd(p[2]);
+			for (; i + 4 <= n; i += 4)
+			{
+				auto x = _mm256_loadu_pd(&X[i]);
+				auto y = _mm256_loadu_pd(&Y[i]);
+				auto z = _mm256_loadu_pd(&Z[i]);
+				_mm256_storeu_pd(&X[i], _mm256_sub_pd(_mm256_mul_pd(y, pz), _mm256_mul_pd(z, py)));
+				_mm256_storeu_pd(&Y[i], _mm256_sub_pd(_mm256_mul_pd(z, px), _mm256_mul_pd(x, pz)));
+				_mm256_storeu_pd(&Z[i], _mm256_sub_pd(_mm256_mul_pd(x, py), _mm256_mul_pd(y, px)));
+			}
+			_mm256_zeroupper();
+		}
+		for (; i < n; i++)
+		{
+			auto x = X[i], y = Y[i], z = Z[i];
+			X[i] = y * p[2] - z * p[1];
+			Y[i] = z * p[0] - x * p[2];
+			Z[i] = x * p[1] - y * p[0];
+		}
+	}
+
+	// Zero length entries are left as they are.
+	void Normalize()
+	{
+		size_t i = 0;
+		auto n = Size();
+		if (CPU.AVX2)
+		{
+			auto zero = _mm256_setzero_pd();
+			auto one = _mm256_set1_pd(1.0);
+			for (; i + 4 <= n; i += 4)
+			{
+				auto x = _mm256_loadu_pd(&X[i]);
+				auto y = _mm256_loadu_pd(&Y[i]);
+				auto z = _mm256_loadu_pd(&Z[i]);
+				auto length = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y)), _mm256_mul_pd(z, z)));
+				auto inverse = _mm256_blendv_pd(_mm256_div_pd(one, length), one, _mm256_cmp_pd(length, zero, _CMP_EQ_OQ));
+				_mm256_storeu_pd(&X[i], _mm256_mul_pd(x, inverse));
+				_mm256_storeu_pd(&Y[i], _mm256_mul_pd(y, inverse));
+				_mm256_storeu_pd(&Z[i], _mm256_mul_pd(z, inverse));
+			}
+			_mm256_zeroupper();
+		}
+		for (; i < n; i++)
+		{
+			auto length = std::sqrt(X[i] * X[i] + Y[i] * Y[i] + Z[i] * Z[i]);
+			if (length == 0)
+				continue;
+			X[i] /= length;
+			Y[i] /= length;
+			Z[i] /= length;
+		}
+	}
+};
+
+// Reads a vector given either as three numbers or as anything with x, y and z fields (tables, v3). Returns the next argument index.
+static int lua_checkvec3(lua_State* L, int idx, double v[3])
+{
+	if (lua_type(L, idx) == LUA_TNUMBER)
+	{
+		v[0] = luaL_checknumber(L, idx);
+		v[1] = luaL_checknumber(L, idx + 1);
+		v[2] = luaL_checknumber(L, idx + 2);
+		return idx + 3;
+	}
+	luaL_argcheck(L, lua_istable(L, idx) || lua_isuserdata(L, idx), idx, "vector or x, y, z expected");
+	lua_getfield(L, idx, "x");
+	lua_getfield(L, idx, "y");
+	lua_getfield(L, idx, "z");
+	int isnum[3];
+	v[0] = lua_tonumberx(L, -3, &isnum[0]);
+	v[1] = lua_tonumberx(L, -2, &isnum[1]);
+	v[2] = lua_tonumberx(L, -1, &isnum[2]);
+	lua_pop(L, 3);
+	luaL_argcheck(L, isnum[0] && isnum[1] && isnum[2], idx, "vector must have numeric x, y and z");
+	return idx + 1;
+}
+
+static void lua_fillvec3array(lua_State* L, Vec3SoA* array, int idx)
+{
+	auto size = lua_rawlen(L, idx);
+	array->Resize(size);
+	for (size_t i = 0; i < size; i++)
+	{
+		lua_rawgeti(L, idx, i + 1);
+		double v[3];
+		lua_checkvec3(L, lua_gettop(L), v);
+		lua_pop(L, 1);
+		array->X[i] = v[0];
+		array->Y[i] = v[1];
+		array->Z[i] = v[2];
+	}
+}
+
+// Returns the Float64Array at idx resized to size, or pushes a new one if idx is none or nil. Either way the result is on top of the stack.
+static F64Array* lua_pushoutarray(lua_State* L, int idx, size_t size)
+{
+	if (lua_isnoneornil(L, idx))
+		return lua_newobject<F64Array>(L, size);
+	auto out = lua_checkobject<F64Array>(L, idx);
+	out->Data.resize(size);
+	lua_pushvalue(L, idx);
+	return out;
+}
+
+// Writes values + offset into the table at idx, or a new table if idx is none or nil, clearing anything after them. Leaves the table on top of the stack.
+template <typename T>
+static void lua_pushintegers(lua_State* L, int idx, const std::vector<T>& values, lua_Integer offset = 0)
+{
+	size_t old = 0;
+	if (lua_isnoneornil(L, idx))
+		lua_createtable(L, (int)values.size(), 0);
+	else
+	{
+		luaL_checktype(L, idx, LUA_TTABLE);
+		old = lua_rawlen(L, idx);
+		lua_pushvalue(L, idx);
+	}
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		lua_pushinteger(L, (lua_Integer)values[i] + offset);
+		lua_rawseti(L, -2, i + 1);
+	}
+	for (auto i = values.size() + 1; i <= old; i++)
+	{
+		lua_pushnil(L);
+		lua_rawseti(L, -2, i);
+	}
+}
+
+static int lua_vec3arraynew(lua_State* L)
+{
+	if (lua_istable(L, 1))
+	{
+		auto array = lua_newobject<Vec3SoA>(L, 0);
+		lua_fillvec3array(L, array, 1);
+		return 1;
+	}
+	auto size = luaL_optinteger(L, 1, 0);
+	luaL_argcheck(L, size >= 0, 1, "size must not be negative");
+	lua_newobject<Vec3SoA>(L, (size_t)size);
+	return 1;
+}
+
+static int lua_vec3arraysize(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	lua_pushinteger(L, array->Size());
+	return 1;
+}
+
+static int lua_vec3arrayresize(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	auto size = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, size >= 0, 2, "size must not be negative");
+	array->Resize((size_t)size);
+	return 0;
+}
+
+static int lua_vec3arrayfill(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_fillvec3array(L, array, 2);
+	return 0;
+}
+
+static int lua_vec3arrayget(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	auto i = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, i >= 1 && (lua_Unsigned)i <= array->Size(), 2, "index out of range");
+	lua_pushnumber(L, array->X[i - 1]);
+	lua_pushnumber(L, array->Y[i - 1]);
+	lua_pushnumber(L, array->Z[i - 1]);
+	return 3;
+}
+
+static int lua_vec3arrayset(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	auto i = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, i >= 1 && (lua_Unsigned)i <= array->Size(), 2, "index out of range");
+	double v[3];
+	lua_checkvec3(L, 3, v);
+	array->X[i - 1] = v[0];
+	array->Y[i - 1] = v[1];
+	array->Z[i - 1] = v[2];
+	return 0;
+}
+
+static int lua_vec3arraypush(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	double v[3];
+	lua_checkvec3(L, 2, v);
+	array->X.push_back(v[0]);
+	array->Y.push_back(v[1]);
+	array->Z.push_back(v[2]);
+	lua_pushinteger(L, array->Size());
+	return 1;
+}
+
+static int lua_vec3arraydistances(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	double p[3];
+	auto next = lua_checkvec3(L, 2, p);
+	auto out = lua_pushoutarray(L, next, array->Size());
+	array->Distances(p, out->Data.data(), false);
+	return 1;
+}
+
+static int lua_vec3arraywithinradius(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	double p[3];
+	auto next = lua_checkvec3(L, 2, p);
+	auto radius = luaL_checknumber(L, next);
+	std::vector<uint32_t> indexes;
+	array->WithinRadius(p, radius, indexes);
+	lua_pushintegers(L, next + 1, indexes, 1);
+	return 1;
+}
+
+static int lua_vec3arraysortbydistance(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	double p[3];
+	auto next = lua_checkvec3(L, 2, p);
+	auto size = array->Size();
+	std::vector<double> distances(size);
+	array->Distances(p, distances.data(), true);
+	std::vector<uint32_t> indexes(size);
+	for (size_t i = 0; i < size; i++)
+		indexes[i] = (uint32_t)i;
+	std::stable_sort(indexes.begin(), indexes.end(), [&](uint32_t a, uint32_t b) { return distances[a] < distances[b]; });
+	lua_pushintegers(L, next, indexes, 1);
+	return 1;
+}
+
+static int lua_vec3arraydot(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	double p[3];
+	auto next = lua_checkvec3(L, 2, p);
+	auto out = lua_pushoutarray(L, next, array->Size());
+	array->Dot(p, out->Data.data());
+	return 1;
+}
+
+static int lua_vec3arraycross(lua_State* L)
+{
+	auto array = lua_checkobject<Vec3SoA>(L, 1);
+	double p[3];
+	lua_checkvec3(L, 2, p);
+	array->Cross(p);
+	return 0;
+}
+
+static int lua_vec3arraynormalize(lua_State* L)
+{
+	lua_checkobject<Vec3SoA>(L, 1)->Normalize();
+	return 0;
+}
+#pragma endregion
+
+#pragma region SpatialIndex
+// Uniform hash grid. Points moving within their cell only update coordinates, so per frame updates stay cheap.
+struct SpatialGrid
+{
+	static constexpr const char* MetaName = "ProddyUtils.SpatialIndex";
+
+	struct Point
+	{
+		double Pos[3];
+		lua_Integer Id;
+		uint64_t Cell;
+		uint32_t Slot;
+	};
+
+	double CellSize;
+	std::vector<Point> Points;
+	std::unordered_map<lua_Integer, uint32_t> Index;
+	std::unordered_map<uint64_t, std::vector<uint32_t>> Cells;
+
+	SpatialGrid(double cellSize) : CellSize(cellSize) {}
+
+	int64_t Coord(double v) const
+	{
+		return (int64_t)std::floor(v / CellSize);
+	}
+
+	// Packs 21 bits per axis. Far apart cells can share a key, queries always check real positions.
+	static uint64_t Key(int64_t x, int64_t y, int64_t z)
+	{
+		return ((uint64_t)x & 0x1FFFFF) | (((uint64_t)y & 0x1FFFFF) << 21) | (((uint64_t)z & 0x1FFFFF) << 42);
+	}
+
+	uint64_t KeyOf(const double p[3]) const
+	{
+		return Key(Coord(p[0]), Coord(p[1]), Coord(p[2]));
+	}
+
+	void Link(uint32_t i)
+	{
+		auto& cell = Cells[Points[i].Cell];
+		Points[i].Slot = (uint32_t)cell.size();
+		cell.push_back(i);
+	}
+
+	void Unlink(uint32_t i)
+	{
+		auto it = Cells.find(Points[i].Cell);
+		auto& cell = it->second;
+		auto slot = Points[i].Slot;
+		cell[slot] = cell.back();
+		Points[cell[slot]].Slot = slot;
+		cell.pop_back();
+		if (cell.empty())
+			Cells.erase(it);
+	}
+
+	void Update(lua_Integer id, const double p[3])
+	{
+		auto key = KeyOf(p);
+		auto it = Index.find(id);
+		if (it == Index.end())
+		{
+			auto i = (uint32_t)Points.size();
+			Points.push_back({ { p[0], p[1], p[2] }, id, key, 0 });
+			Index.emplace(id, i);
+			Link(i);
+			return;
+		}
+		auto& point = Points[it->second];
+		std::copy(p, p + 3, point.Pos);
+		if (point.Cell != key)
+		{
+			Unlink(it->second);
+			point.Cell = key;
+			Link(it->second);
+		}
+	}
+
+	bool Remove(lua_Integer id)
+	{
+		auto it = Index.find(id);
+		if (it == Index.end())
+			return false;
+		auto i = it->second;
+		Index.erase(it);
+		Unlink(i);
+		auto last = (uint32_t)Points.size() - 1;
+		if (i != last)
+		{
+			Points[i] = Points[last];
+			Index[Points[i].Id] = i;
+			Cells[Points[i].Cell][Points[i].Slot] = i;
+		}
+		Points.pop_back();
+		return true;
+	}
+
+	static double Distance2(const Point& point, const double p[3])
+	{
+		auto dx = point.Pos[0] - p[0];
+		auto dy = point.Pos[1] - p[1];
+		auto dz = point.Pos[2] - p[2];
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	// Calls visit with every point in cells overlapping the box. Scans all points instead when that touches fewer.
+	template <typename F>
+	void VisitBox(const double lo[3], const double hi[3], F visit) const
+	{
+		int64_t a[3], b[3];
+		double cells = 1;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			a[axis] = Coord(lo[axis]);
+			b[axis] = Coord(hi[axis]);
+			cells *= (double)(b[axis] - a[axis] + 1);
+		}
+		if (cells >= (double)Cells.size() || cells >= (double)Points.size())
+		{
+			for (auto& point : Points)
+				visit(point);
+			return;
+		}
+		for (auto x = a[0]; x <= b[0]; x++)
+		{
+			for (auto y = a[1]; y <= b[1]; y++)
+			{
+				for (auto z = a[2]; z <= b[2]; z++)
+				{
+					auto key = Key(x, y, z);
+					auto it = Cells.find(key);
+					if (it == Cells.end())
+						continue;
+					for (auto i : it->second)
+					{
+						// Aliased cells can hold points from elsewhere, skip those so nothing is visited twice.
+						if (Coord(Points[i].Pos[0]) == x && Coord(Points[i].Pos[1]) == y && Coord(Points[i].Pos[2]) == z)
+							visit(Points[i]);
+					}
+				}
+			}
+		}
+	}
+
+	void QueryRadius(const double p[3], double radius, std::vector<lua_Integer>& out) const
+	{
+		double lo[3] = { p[0] - radius, p[1] - radius, p[2] - radius };
+		double hi[3] = { p[0] + radius, p[1] + radius, p[2] + radius };
+		auto r2 = radius * radius;
+		VisitBox(lo, hi, [&](const Point& point) {
+			if (Distance2(point, p) <= r2)
+				out.push_back(point.Id);
+		});
+	}
+
+	void QueryBox(const double lo[3], const double hi[3], std::vector<lua_Integer>& out) const
+	{
+		VisitBox(lo, hi, [&](const Point& point) {
+			if (point.Pos[0] >= lo[0] && point.Pos[0] <= hi[0] && point.Pos[1] >= lo[1] && point.Pos[1] <= hi[1] && point.Pos[2] >= lo[2] && point.Pos[2] <= hi[2])
+				out.push_back(point.Id);
+		});
+	}
+
+	// Searches shells of cells outwards from p until the k nearest found are closer than any unvisited cell.
+	void KNearest(const double p[3], size_t k, std::vector<lua_Integer>& out) const
+	{
+		std::vector<std::pair<double, lua_Integer>> best;
+		if (k == 0 || Points.empty())
+			return;
+		auto consider = [&](const Point& point) {
+			auto d = Distance2(point, p);
+			if (best.size() < k)
+			{
+				best.emplace_back(d, point.Id);
+				std::push_heap(best.begin(), best.end());
+			}
+			else if (d < best.front().first)
+			{
+				std::pop_heap(best.begin(), best.end());
+				best.back() = { d, point.Id };
+				std::push_heap(best.begin(), best.end());
+			}
+		};
+		int64_t c[3] = { Coord(p[0]), Coord(p[1]), Coord(p[2]) };
+		size_t visited = 0;
+		size_t probed = 0;
+		bool bComplete = false;
+		for (int64_t ring = 0;; ring++)
+		{
+			// Once the cells probed outnumber the points, scanning every point is cheaper than carrying on with the grid.
+			auto side = (size_t)(ring * 2 + 1);
+			probed += ring == 0 ? 1 : side * side * side - (side - 2) * (side - 2) * (side - 2);
+			if (probed > Points.size())
+				break;
+			for (auto x = c[0] - ring; x <= c[0] + ring; x++)
+			{
+				for (auto y = c[1] - ring; y <= c[1] + ring; y++)
+				{
+					bool bEdge = std::abs(x - c[0]) == ring || std::abs(y - c[1]) == ring;
+					// Interior columns only need their two end cells, the rest were visited by earlier rings.
+					for (auto z = c[2] - ring; z <= c[2] + ring; z += bEdge || ring == 0 ? 1 : ring * 2)
+					{
+						auto it = Cells.find(Key(x, y, z));
+						if (it == Cells.end())
+							continue;
+						for (auto i : it->second)
+						{
+							auto& point = Points[i];
+							if (Coord(point.Pos[0]) == x && Coord(point.Pos[1]) == y && Coord(point.Pos[2]) == z)
+							{
+								consider(point);
+								visited++;
+							}
+						}
+					}
+				}
+			}
+			// Cells beyond this ring are at least ring * CellSize away.
+			auto reach = ring * CellSize;
+			if (visited == Points.size() || (best.size() == k && best.front().first <= reach * reach))
+			{
+				bComplete = true;
+				break;
+			}
+		}
+		if (!bComplete)
+		{
+			best.clear();
+			for (auto& point : Points)
+				consider(point);
+		}
+		std::sort_heap(best.begin(), best.end());
+		for (auto& entry : best)
+			out.push_back(entry.second);
+	}
+};
+
+static int lua_spatialindexnew(lua_State* L)
+{
+	auto cellSize = luaL_optnumber(L, 1, 50.0);
+	luaL_argcheck(L, cellSize > 0, 1, "cell size must be positive");
+	lua_newobject<SpatialGrid>(L, cellSize);
+	return 1;
+}
+
+static int lua_spatialindexupdate(lua_State* L)
+{
+	auto grid = lua_checkobject<SpatialGrid>(L, 1);
+	auto id = luaL_checkinteger(L, 2);
+	double p[3];
+	lua_checkvec3(L, 3, p);
+	grid->Update(id, p);
+	return 0;
+}
+
+static int lua_spatialindexremove(lua_State* L)
+{
+	auto grid = lua_checkobject<SpatialGrid>(L, 1);
+	lua_pushboolean(L, grid->Remove(luaL_checkinteger(L, 2)));
+	return 1;
+}
+
+static int lua_spatialindexget(lua_State* L)
+{
+	auto grid = lua_checkobject<SpatialGrid>(L, 1);
+	auto it = grid->Index.find(luaL_checkinteger(L, 2));
+	if (it == grid->Index.end())
+		return 0;
+	auto& point = grid->Points[it->second];
+	lua_pushnumber(L, point.Pos[0]);
+	lua_pushnumber(L, point.Pos[1]);
+	lua_pushnumber(L, point.Pos[2]);
+	return 3;
+}
+
+static int lua_spatialindexsize(lua_State* L)
+{
+	auto grid = lua_checkobject<SpatialGrid>(L, 1);
+	lua_pushinteger(L, grid->Points.size());
+	return 1;
+}
+
+static int lua_spatialindexclear(lua_State* L)
+{
+	auto grid = lua_checkobject<SpatialGrid>(L, 1);
+	grid->Points.clear();
+	grid->Index.clear();
+	grid->Cells.clear();
+	return 0;
+}
+
+static int lua_spatialindexqueryradius(lua_State* L)
+{
+	auto grid = lua_checkobject<SpatialGrid>(L, 1);
+	double p[3];
+	auto next = lua_checkvec3(L, 2, p);
+	auto radius = luaL_checknumber(L, next);
+	std::vector<lua_Integer> ids;
+	grid->QueryRadius(p, radius, ids);
+	lua_pushintegers(L, next + 1, ids);
+	return 1;
+}
+
+static int lua_spatialindexknearest(lua_State* L)
+{
+	auto grid = lua_checkobject<SpatialGrid>(L, 1);
+	double p[3];
+	auto next = lua_checkvec3(L, 2, p);
+	auto k = luaL_checkinteger(L, next);
+	std::vector<lua_Integer> ids;
+	grid->KNearest(p, k > 0 ? (size_t)k : 0, ids);
+	lua_pushintegers(L, next + 1, ids);
+	return 1;
+}
+
+static int lua_spatialindexquerybox(lua_State* L)
+{
+	auto grid = lua_checkobject<SpatialGrid>(L, 1);
+	double lo[3], hi[3];
+	auto next = lua_checkvec3(L, lua_checkvec3(L, 2, lo), hi);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (lo[axis] > hi[axis])
+			std::swap(lo[axis], hi[axis]);
+	}
+	std::vector<lua_Integer> ids;
+	grid->QueryBox(lo, hi, ids);
+	lua_pushintegers(L, next, ids);
+	return 1;
+}
+#pragma endregion
+
+#pragma region Sketches
+// MurmurHash64A
+uint64_t Murmur64(const void* key, size_t len, uint64_t seed = 0)
+{
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	uint64_t h = seed ^ (len * m);
+	auto data = static_cast<const unsigned char*>(key);
+	auto end = data + (len & ~(size_t)7);
+	for (; data != end; data += 8)
+	{
+		uint64_t k;
+		memcpy(&k, data, 8);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+	switch (len & 7)
+	{
+	case 7: h ^= uint64_t(data[6]) << 48;
+	case 6: h ^= uint64_t(data[5]) << 40;
+	case 5: h ^= uint64_t(data[4]) << 32;
+	case 4: h ^= uint64_t(data[3]) << 24;
+	case 3: h ^= uint64_t(data[2]) << 16;
+	case 2: h ^= uint64_t(data[1]) << 8;
+	case 1: h ^= uint64_t(data[0]);
+		h *= m;
+	}
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+static uint64_t lua_checkkeyhash(lua_State* L, int idx)
+{
+	std::string key;
+	if (!lua_tokey(L, idx, key))
+		luaL_argerror(L, idx, "string, number or boolean expected");
+	return Murmur64(key.data(), key.size());
+}
+
+struct BloomFilter
+{
+	static constexpr const char* MetaName = "ProddyUtils.BloomFilter";
+	static constexpr const char* Magic = "PUBF";
+	// More than this only matters for false positive rates far below anything useful.
+	static constexpr uint32_t MaxHashes = 64;
+
+	uint64_t Bits;
+	uint32_t Hashes;
+	uint64_t Count = 0;
+	std::vector<uint64_t> Words;
+
+	BloomFilter(uint64_t bits, uint32_t hashes) : Bits(bits), Hashes(hashes), Words((size_t)((bits + 63) / 64)) {}
+
+	// Kirsch-Mitzenmacher double hashing, the second hash is derived from the first.
+	template <typename F>
+	bool Probe(uint64_t hash, F f)
+	{
+		auto h1 = hash;
+		auto h2 = ((hash >> 33) ^ (hash * 0x9E3779B97F4A7C15ULL)) | 1;
+		for (uint32_t i = 0; i < Hashes; i++)
+		{
+			auto bit = (h1 + i * h2) % Bits;
+			if (!f(Words[(size_t)(bit / 64)], 1ULL << (bit % 64)))
+				return false;
+		}
+		return true;
+	}
+
+	void Add(uint64_t hash)
+	{
+		Probe(hash, [](uint64_t& word, uint64_t mask) { word |= mask; return true; });
+		Count++;
+	}
+
+	bool Test(uint64_t hash)
+	{
+		return Probe(hash, [](uint64_t& word, uint64_t mask) { return (word & mask) != 0; });
+	}
+};
+
+struct HyperLogLog
+{
+	static constexpr const char* MetaName = "ProddyUtils.HyperLogLog";
+
+	int Precision;
+	std::vector<uint8_t> Registers;
+
+	HyperLogLog(int precision) : Precision(precision), Registers((size_t)1 << precision) {}
+
+	void Add(uint64_t hash)
+	{
+		auto index = (size_t)(hash >> (64 - Precision));
+		// Guard bit keeps the rank within 64 - Precision + 1.
+		auto rest = (hash << Precision) | (1ULL << (Precision - 1));
+		unsigned long top;
+		_BitScanReverse64(&top, rest);
+		auto rank = (uint8_t)(64 - top);
+		if (rank > Registers[index])
+			Registers[index] = rank;
+	}
+
+	double Estimate() const
+	{
+		auto m = (double)Registers.size();
+		double sum = 0;
+		size_t zeros = 0;
+		for (auto reg : Registers)
+		{
+			sum += std::ldexp(1.0, -reg);
+			if (reg == 0)
+				zeros++;
+		}
+		auto estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+		// Linear counting is more accurate while many registers are still empty.
+		if (estimate <= 2.5 * m && zeros > 0)
+			estimate = m * std::log(m / zeros);
+		return estimate;
+	}
+};
+
+static int lua_bloomfilternew(lua_State* L)
+{
+	auto items = luaL_checkinteger(L, 1);
+	auto rate = luaL_optnumber(L, 2, 0.01);
+	luaL_argcheck(L, items > 0, 1, "expected item count must be positive");
+	luaL_argcheck(L, rate > 0 && rate < 1, 2, "false positive rate must be between 0 and 1");
+	auto ln2 = std::log(2.0);
+	auto bits = std::max<uint64_t>(64, (uint64_t)std::ceil(-(double)items * std::log(rate) / (ln2 * ln2)));
+	auto hashes = std::clamp<uint32_t>((uint32_t)std::round((double)bits / items * ln2), 1, BloomFilter::MaxHashes);
+	lua_newobject<BloomFilter>(L, bits, hashes);
+	return 1;
+}
+
+static int lua_bloomfilteradd(lua_State* L)
+{
+	auto filter = lua_checkobject<BloomFilter>(L, 1);
+	filter->Add(lua_checkkeyhash(L, 2));
+	return 0;
+}
+
+static int lua_bloomfilteraddall(lua_State* L)
+{
+	auto filter = lua_checkobject<BloomFilter>(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	auto size = lua_rawlen(L, 2);
+	std::string key;
+	for (size_t i = 1; i <= size; i++)
+	{
+		lua_rawgeti(L, 2, i);
+		auto bValid = lua_tokey(L, -1, key);
+		lua_pop(L, 1);
+		if (!bValid)
+			return luaL_error(L, "element %d is not a string, number or boolean", (int)i);
+		filter->Add(Murmur64(key.data(), key.size()));
+	}
+	return 0;
+}
+
+static int lua_bloomfiltertest(lua_State* L)
+{
+	auto filter = lua_checkobject<BloomFilter>(L, 1);
+	lua_pushboolean(L, filter->Test(lua_checkkeyhash(L, 2)));
+	return 1;
+}
+
+static int lua_bloomfiltercount(lua_State* L)
+{
+	auto filter = lua_checkobject<BloomFilter>(L, 1);
+	lua_pushinteger(L, (lua_Integer)filter->Count);
+	return 1;
+}
+
+// Layout: magic, uint32 hash count, uint64 bit count, uint64 item count, then the bit words. Little endian.
+static int lua_bloomfilterserialize(lua_State* L)
+{
+	auto filter = lua_checkobject<BloomFilter>(L, 1);
+	luaL_Buffer b;
+	auto size = 4 + sizeof(uint32_t) + sizeof(uint64_t) * 2 + filter->Words.size() * sizeof(uint64_t);
+	auto p = luaL_buffinitsize(L, &b, size);
+	memcpy(p, BloomFilter::Magic, 4);
+	memcpy(p + 4, &filter->Hashes, sizeof(uint32_t));
+	memcpy(p + 8, &filter->Bits, sizeof(uint64_t));
+	memcpy(p + 16, &filter->Count, sizeof(uint64_t));
+	memcpy(p + 24, filter->Words.data(), filter->Words.size() * sizeof(uint64_t));
+	luaL_pushresultsize(&b, size);
+	return 1;
+}
+
+static int lua_bloomfilterdeserialize(lua_State* L)
+{
+	size_t len;
+	auto data = luaL_checklstring(L, 1, &len);
+	uint32_t hashes;
+	uint64_t bits, count;
+	if (len < 24 || memcmp(data, BloomFilter::Magic, 4) != 0)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+	memcpy(&hashes, data + 4, sizeof(uint32_t));
+	memcpy(&bits, data + 8, sizeof(uint64_t));
+	memcpy(&count, data + 16, sizeof(uint64_t));
+	// The word count comes from the length, so no size in the data can overflow or disagree with it.
+	auto words = (len - 24) / sizeof(uint64_t);
+	if ((len - 24) % sizeof(uint64_t) != 0 || words == 0 || bits == 0 || bits > words * 64 || bits <= (words - 1) * 64 ||
+		hashes == 0 || hashes > BloomFilter::MaxHashes)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+	auto filter = lua_newobject<BloomFilter>(L, bits, hashes);
+	filter->Count = count;
+	memcpy(filter->Words.data(), data + 24, len - 24);
+	return 1;
+}
+
+static int lua_hyperloglognew(lua_State* L)
+{
+	auto precision = luaL_optinteger(L, 1, 14);
+	luaL_argcheck(L, precision >= 4 && precision <= 18, 1, "precision must be between 4 and 18");
+	lua_newobject<HyperLogLog>(L, (int)precision);
+	return 1;
+}
+
+static int lua_hyperloglogadd(lua_State* L)
+{
+	auto hll = lua_checkobject<HyperLogLog>(L, 1);
+	hll->Add(lua_checkkeyhash(L, 2));
+	return 0;
+}
+
+static int lua_hyperloglogcount(lua_State* L)
+{
+	auto hll = lua_checkobject<HyperLogLog>(L, 1);
+	lua_pushinteger(L, (lua_Integer)std::llround(hll->Estimate()));
+	return 1;
+}
+
+static int lua_hyperloglogmerge(lua_State* L)
+{
+	auto hll = lua_checkobject<HyperLogLog>(L, 1);
+	auto other = lua_checkobject<HyperLogLog>(L, 2);
+	luaL_argcheck(L, other->Precision == hll->Precision, 2, "precision must match");
+	for (size_t i = 0; i < hll->Registers.size(); i++)
+		hll->Registers[i] = std::max(hll->Registers[i], other->Registers[i]);
+	return 0;
+}
+
+static int lua_hyperloglogclear(lua_State* L)
+{
+	auto hll = lua_checkobject<HyperLogLog>(L, 1);
+	std::fill(hll->Registers.begin(), hll->Registers.end(), (uint8_t)0);
+	return 0;
+}
+#pragma endregion
+
+#pragma region TimeSeries
+struct TimeSeries
+{
+	static constexpr const char* MetaName = "ProddyUtils.TimeSeries";
+
+	std::vector<double> Times;
+	std::vector<double> Values;
+	// Physical index of the oldest sample.
+	size_t Head = 0;
+	size_t Count = 0;
+	std::vector<double> Scratch;
+
+	TimeSeries(size_t capacity) : Times(capacity), Values(capacity) {}
+
+	size_t Capacity() const
+	{
+		return Times.size();
+	}
+
+	// Maps a logical index (0 is the oldest sample) to the ring.
+	size_t At(size_t i) const
+	{
+		i += Head;
+		return i >= Capacity() ? i - Capacity() : i;
+	}
+
+	void Push(double time, double value)
+	{
+		size_t slot;
+		if (Count < Capacity())
+			slot = At(Count++);
+		else
+		{
+			slot = Head;
+			Head = At(1);
+		}
+		Times[slot] = time;
+		Values[slot] = value;
+	}
+
+	// Logical index of the first sample inside the window ending at the newest sample. Timestamps are assumed to be non-decreasing.
+	size_t WindowStart(double window) const
+	{
+		if (Count == 0 || window <= 0)
+			return 0;
+		auto from = Times[At(Count - 1)] - window;
+		size_t lo = 0, hi = Count;
+		while (lo < hi)
+		{
+			auto mid = (lo + hi) / 2;
+			if (Times[At(mid)] < from)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	template <typename F>
+	void Visit(size_t start, F f) const
+	{
+		for (auto i = start; i < Count; i++)
+		{
+			auto slot = At(i);
+			f(Times[slot], Values[slot]);
+		}
+	}
+
+	double Percentile(size_t start, double p)
+	{
+		Scratch.clear();
+		Visit(start, [&](double, double v) { Scratch.push_back(v); });
+		// Linear interpolation between the closest ranks.
+		auto rank = p / 100.0 * (Scratch.size() - 1);
+		auto lower = (size_t)rank;
+		std::nth_element(Scratch.begin(), Scratch.begin() + lower, Scratch.end());
+		auto a = Scratch[lower];
+		if (lower + 1 >= Scratch.size())
+			return a;
+		auto b = *std::min_element(Scratch.begin() + lower + 1, Scratch.end());
+		return a + (b - a) * (rank - lower);
+	}
+
+	// Largest-Triangle-Three-Buckets, keeps the points that best preserve the shape of the line.
+	void Downsample(size_t start, size_t threshold, std::vector<size_t>& out) const
+	{
+		auto n = Count - start;
+		if (threshold >= n || threshold < 3)
+		{
+			for (auto i = start; i < Count; i++)
+				out.push_back(At(i));
+			return;
+		}
+		auto every = (double)(n - 2) / (threshold - 2);
+		size_t a = start;
+		out.push_back(At(a));
+		for (size_t bucket = 0; bucket < threshold - 2; bucket++)
+		{
+			auto nextStart = start + (size_t)((bucket + 1) * every) + 1;
+			auto nextEnd = std::min(start + (size_t)((bucket + 2) * every) + 1, Count);
+			double avgTime = 0, avgValue = 0;
+			for (auto i = nextStart; i < nextEnd; i++)
+			{
+				avgTime += Times[At(i)];
+				avgValue += Values[At(i)];
+			}
+			auto nextCount = (double)std::max<size_t>(nextEnd - nextStart, 1);
+			avgTime /= nextCount;
+			avgValue /= nextCount;
+			auto from = start + (size_t)(bucket * every) + 1;
+			auto to = start + (size_t)((bucket + 1) * every) + 1;
+			auto at = Times[At(a)], av = Values[At(a)];
+			double bestArea = -1;
+			size_t best = from;
+			for (auto i = from; i < to; i++)
+			{
+				auto area = std::abs((at - avgTime) * (Values[At(i)] - av) - (at - Times[At(i)]) * (avgValue - av));
+				if (area > bestArea)
+				{
+					bestArea = area;
+					best = i;
+				}
+			}
+			out.push_back(At(best));
+			a = best;
+		}
+		out.push_back(At(Count - 1));
+	}
+};
+
+static int lua_timeseriesnew(lua_State* L)
+{
+	auto capacity = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, capacity > 0, 1, "capacity must be positive");
+	lua_newobject<TimeSeries>(L, (size_t)capacity);
+	return 1;
+}
+
+static int lua_timeseriespush(lua_State* L)
+{
+	auto series = lua_checkobject<TimeSeries>(L, 1);
+	auto value = luaL_checknumber(L, 2);
+	auto time = lua_isnoneornil(L, 3) ? (double)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count() : luaL_checknumber(L, 3);
+	series->Push(time, value);
+	return 0;
+}
+
+static int lua_timeseriessize(lua_State* L)
+{
+	auto series = lua_checkobject<TimeSeries>(L, 1);
+	lua_pushinteger(L, series->Count);
+	return 1;
+}
+
+static int lua_timeseriescapacity(lua_State* L)
+{
+	auto series = lua_checkobject<TimeSeries>(L, 1);
+	lua_pushinteger(L, series->Capacity());
+	return 1;
+}
+
+static int lua_timeseriesclear(lua_State* L)
+{
+	auto series = lua_checkobject<TimeSeries>(L, 1);
+	series->Head = 0;
+	series->Count = 0;
+	return 0;
+}
+
+static int lua_timeserieslatest(lua_State* L)
+{
+	auto series = lua_checkobject<TimeSeries>(L, 1);
+	if (series->Count == 0)
+		return 0;
+	auto slot = series->At(series->Count - 1);
+	lua_pushnumber(L, series->Values[slot]);
+	lua_pushnumber(L, series->Times[slot]);
+	return 2;
+}
+
+// Returns count, min, max and mean over the window, or nothing if it's empty.
+static int lua_timeseriesstats(lua_State* L)
+{
+	auto series = lua_checkobject<TimeSeries>(L, 1);
+	auto start = series->WindowStart(luaL_optnumber(L, 2, 0));
+	if (start >= series->Count)
+		return 0;
+	auto min = HUGE_VAL, max = -HUGE_VAL, sum = 0.0;
+	series->Visit(start, [&](double, double v) {
+		min = std::min(min, v);
+		max = std::max(max, v);
+		sum += v;
+	});
+	auto count = series->Count - start;
+	lua_pushinteger(L, count);
+	lua_pushnumber(L, min);
+	lua_pushnumber(L, max);
+	lua_pushnumber(L, sum / count);
+	return 4;
+}
+
+static int lua_timeseriesmin(lua_State* L)
+{
+	lua_settop(L, 2);
+	if (lua_timeseriesstats(L) == 0)
+		return 0;
+	lua_pushvalue(L, -3);
+	return 1;
+}
+
+static int lua_timeseriesmax(lua_State* L)
+{
+	lua_settop(L, 2);
+	if (lua_timeseriesstats(L) == 0)
+		return 0;
+	lua_pushvalue(L, -2);
+	return 1;
+}
+
+static int lua_timeseriesmean(lua_State* L)
+{
+	lua_settop(L, 2);
+	return lua_timeseriesstats(L) == 0 ? 0 : 1;
+}
+
+static int lua_timeseriespercentile(lua_State* L)
+{
+	auto series = lua_checkobject<TimeSeries>(L, 1);
+	auto p = luaL_checknumber(L, 2);
+	luaL_argcheck(L, p >= 0 && p <= 100, 2, "percentile must be between 0 and 100");
+	auto start = series->WindowStart(luaL_optnumber(L, 3, 0));
+	if (start >= series->Count)
+		return 0;
+	lua_pushnumber(L, series->Percentile(start, p));
+	return 1;
+}
+
+static int lua_timeseriesdownsample(lua_State* L)
+{
+	auto series = lua_checkobject<TimeSeries>(L, 1);
+	auto threshold = luaL_checkinteger(L, 2);
+	auto start = series->WindowStart(luaL_optnumber(L, 3, 0));
+	std::vector<size_t> slots;
+	series->Downsample(start, threshold > 0 ? (size_t)threshold : 0, slots);
+	lua_createtable(L, (int)slots.size(), 0);
+	lua_createtable(L, (int)slots.size(), 0);
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		lua_pushnumber(L, series->Values[slots[i]]);
+		lua_rawseti(L, -3, i + 1);
+		lua_pushnumber(L, series->Times[slots[i]]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 2;
+}
+#pragma endregion
+
+#pragma region Bitset
+struct Bitset
+{
+	static constexpr const char* MetaName = "ProddyUtils.Bitset";
+
+	enum class Op { And, Or, Xor, AndNot };
+
+	size_t Size;
+	std::vector<uint64_t> Words;
+
+	Bitset(size_t size) : Size(size), Words((size + 63) / 64) {}
+
+	bool Test(size_t i) const
+	{
+		return (Words[i / 64] >> (i % 64)) & 1;
+	}
+
+	void Set(size_t i, bool bValue)
+	{
+		if (bValue)
+			Words[i / 64] |= 1ULL << (i % 64);
+		else
+			Words[i / 64] &= ~(1ULL << (i % 64));
+	}
+
+	uint64_t Count() const
+	{
+		uint64_t count = 0;
+		for (auto word : Words)
+			count += PopCount(word);
+		return count;
+	}
+
+	// Index of the first set bit at or after i, or Size if there is none.
+	size_t Next(size_t i) const
+	{
+		if (i >= Size)
+			return Size;
+		auto w = i / 64;
+		auto word = Words[w] & (~0ULL << (i % 64));
+		for (;;)
+		{
+			unsigned long bit;
+			if (_BitScanForward64(&bit, word))
+				return std::min(w * 64 + bit, Size);
+			if (++w >= Words.size())
+				return Size;
+			word = Words[w];
+		}
+	}
+
+	void Apply(Op op, const Bitset& other)
+	{
+		auto n = Words.size();
+		auto a = Words.data();
+		auto b = other.Words.data();
+		size_t i = 0;
+		if (CPU.AVX2)
+		{
+			for (; i + 4 <= n; i += 4)
+			{
+				auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+				auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+				__m256i result;
+				switch (op)
+				{
+				case Op::And: result = _mm256_and_si256(va, vb); break;
+				case Op::Or: result = _mm256_or_si256(va, vb); break;
+				case Op::Xor: result = _mm256_xor_si256(va, vb); break;
+				default: result = _mm256_andnot_si256(vb, va); break;
+				}
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i), result);
+			}
+			_mm256_zeroupper();
+		}
+		for (; i < n; i++)
+		{
+			switch (op)
+			{
+			case Op::And: a[i] &= b[i]; break;
+			case Op::Or: a[i] |= b[i]; break;
+			case Op::Xor: a[i] ^= b[i]; break;
+			default: a[i] &= ~b[i]; break;
+			}
+		}
+	}
+};
+
+static size_t lua_checkbit(lua_State* L, Bitset* bits, int idx)
+{
+	auto i = luaL_checkinteger(L, idx);
+	luaL_argcheck(L, i >= 0 && (lua_Unsigned)i < bits->Size, idx, "bit index out of range");
+	return (size_t)i;
+}
+
+static int lua_bitsetnew(lua_State* L)
+{
+	auto size = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, size >= 0, 1, "size must not be negative");
+	lua_newobject<Bitset>(L, (size_t)size);
+	return 1;
+}
+
+static int lua_bitsetset(lua_State* L)
+{
+	auto bits = lua_checkobject<Bitset>(L, 1);
+	auto i = lua_checkbit(L, bits, 2);
+	bits->Set(i, lua_isnone(L, 3) || lua_toboolean(L, 3));
+	return 0;
+}
+
+static int lua_bitsetclear(lua_State* L)
+{
+	auto bits = lua_checkobject<Bitset>(L, 1);
+	if (lua_isnoneornil(L, 2))
+		std::fill(bits->Words.begin(), bits->Words.end(), 0);
+	else
+		bits->Set(lua_checkbit(L, bits, 2), false);
+	return 0;
+}
+
+static int lua_bitsettest(lua_State* L)
+{
+	auto bits = lua_checkobject<Bitset>(L, 1);
+	lua_pushboolean(L, bits->Test(lua_checkbit(L, bits, 2)));
+	return 1;
+}
+
+static int lua_bitsetcount(lua_State* L)
+{
+	auto bits = lua_checkobject<Bitset>(L, 1);
+	lua_pushinteger(L, (lua_Integer)bits->Count());
+	return 1;
+}
+
+static int lua_bitsetsize(lua_State* L)
+{
+	auto bits = lua_checkobject<Bitset>(L, 1);
+	lua_pushinteger(L, bits->Size);
+	return 1;
+}
+
+static int lua_bitsetclone(lua_State* L)
+{
+	auto bits = lua_checkobject<Bitset>(L, 1);
+	auto clone = lua_newobject<Bitset>(L, bits->Size);
+	clone->Words = bits->Words;
+	return 1;
+}
+
+template <Bitset::Op op>
+static int lua_bitsetapply(lua_State* L)
+{
+	auto bits = lua_checkobject<Bitset>(L, 1);
+	auto other = lua_checkobject<Bitset>(L, 2);
+	luaL_argcheck(L, other->Size == bits->Size, 2, "bitsets must be the same size");
+	bits->Apply(op, *other);
+	lua_settop(L, 1);
+	return 1;
+}
+
+// Generic for step: returns the next set bit after the control value.
+static int lua_bitsetnext(lua_State* L)
+{
+	auto bits = lua_checkobject<Bitset>(L, 1);
+	auto last = luaL_checkinteger(L, 2);
+	auto next = bits->Next((size_t)(last + 1));
+	if (next >= bits->Size)
+		return 0;
+	lua_pushinteger(L, next);
+	return 1;
+}
+
+static int lua_bitsetiterate(lua_State* L)
+{
+	lua_checkobject<Bitset>(L, 1);
+	lua_pushcfunction(L, lua_bitsetnext);
+	lua_pushvalue(L, 1);
+	lua_pushinteger(L, -1);
+	return 3;
+}
+#pragma endregion
+
+#pragma region IdTables
+// Open addressing table in the style of SwissTable: one control byte per slot holds 7 bits of the hash,
+// and lookups compare a group of 16 control bytes at once with SSE2.
+template <bool bValues>
+struct IdTable
+{
+	static constexpr int8_t Empty = -128;
+	static constexpr int8_t Deleted = -2;
+	static constexpr size_t GroupSize = 16;
+
+	std::vector<int8_t> Ctrl;
+	std::vector<int64_t> Keys;
+	std::vector<double> Values;
+	size_t Size = 0;
+	size_t Tombstones = 0;
+
+	IdTable(size_t capacity)
+	{
+		Rehash(CapacityFor(capacity));
+	}
+
+	static uint64_t Hash(int64_t key)
+	{
+		auto h = (uint64_t)key;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	// Smallest power of two group count that holds count entries under the 7/8 load limit.
+	static size_t CapacityFor(size_t count)
+	{
+		size_t capacity = GroupSize;
+		while (capacity * 7 / 8 < count)
+			capacity *= 2;
+		return capacity;
+	}
+
+	size_t Capacity() const
+	{
+		return Ctrl.size();
+	}
+
+	static uint32_t Match(__m128i group, int8_t value)
+	{
+		return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+	}
+
+	// Slot holding key, or SIZE_MAX.
+	size_t Find(int64_t key) const
+	{
+		auto hash = Hash(key);
+		auto h2 = (int8_t)(hash & 0x7F);
+		auto mask = Capacity() / GroupSize - 1;
+		auto g = (size_t)(hash >> 7) & mask;
+		for (size_t step = 1;; step++)
+		{
+			auto base = g * GroupSize;
+			auto group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Ctrl[base]));
+			for (auto bits = Match(group, h2); bits != 0; bits &= bits - 1)
+			{
+				unsigned long bit;
+				_BitScanForward(&bit, bits);
+				if (Keys[base + bit] == key)
+					return base + bit;
+			}
+			if (Match(group, Empty) != 0)
+				return SIZE_MAX;
+			g = (g + step) & mask;
+		}
+	}
+
+	// Inserts key if missing and returns its slot. bInserted reports which.
+	size_t Insert(int64_t key, bool& bInserted)
+	{
+		auto slot = Find(key);
+		if (slot != SIZE_MAX)
+		{
+			bInserted = false;
+			return slot;
+		}
+		// Grow when live entries fill the table, otherwise rehash in place to drop tombstones.
+		if (Size + Tombstones + 1 > Capacity() * 7 / 8)
+			Rehash(Size + 1 > Capacity() * 7 / 16 ? Capacity() * 2 : Capacity());
+		bInserted = true;
+		auto hash = Hash(key);
+		auto mask = Capacity() / GroupSize - 1;
+		auto g = (size_t)(hash >> 7) & mask;
+		for (size_t step = 1;; step++)
+		{
+			auto base = g * GroupSize;
+			auto group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Ctrl[base]));
+			// Empty and Deleted are the only negative control bytes.
+			auto free = (uint32_t)_mm_movemask_epi8(group);
+			if (free != 0)
+			{
+				unsigned long bit;
+				_BitScanForward(&bit, free);
+				slot = base + bit;
+				if (Ctrl[slot] == Deleted)
+					Tombstones--;
+				Ctrl[slot] = (int8_t)(hash & 0x7F);
+				Keys[slot] = key;
+				Size++;
+				return slot;
+			}
+			g = (g + step) & mask;
+		}
+	}
+
+	bool Erase(int64_t key)
+	{
+		auto slot = Find(key);
+		if (slot == SIZE_MAX)
+			return false;
+		// A slot can go straight back to empty if its group never filled, since no probe ever continued past it.
+		auto base = slot / GroupSize * GroupSize;
+		auto group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&Ctrl[base]));
+		if (Match(group, Empty) != 0)
+			Ctrl[slot] = Empty;
+		else
+		{
+			Ctrl[slot] = Deleted;
+			Tombstones++;
+		}
+		Size--;
+		return true;
+	}
+
+	void Rehash(size_t capacity)
+	{
+		auto ctrl = std::move(Ctrl);
+		auto keys = std::move(Keys);
+		auto values = std::move(Values);
+		Ctrl.assign(capacity, Empty);
+		Keys.assign(capacity, 0);
+		if (bValues)
+			Values.assign(capacity, 0);
+		Size = 0;
+		Tombstones = 0;
+		for (size_t i = 0; i < ctrl.size(); i++)
+		{
+			if (ctrl[i] < 0)
+				continue;
+			bool bInserted;
+			auto slot = Insert(keys[i], bInserted);
+			if (bValues)
+				Values[slot] = values[i];
+		}
+	}
+
+	void Reserve(size_t count)
+	{
+		if (count > Capacity() * 7 / 8)
+			Rehash(CapacityFor(count));
+	}
+
+	void Clear()
+	{
+		std::fill(Ctrl.begin(), Ctrl.end(), Empty);
+		Size = 0;
+		Tombstones = 0;
+	}
+
+	template <typename F>
+	void Visit(F f) const
+	{
+		for (size_t i = 0; i < Ctrl.size(); i++)
+		{
+			if (Ctrl[i] >= 0)
+				f(i);
+		}
+	}
+};
+
+struct IdSet : IdTable<false>
+{
+	static constexpr const char* MetaName = "ProddyUtils.IdSet";
+
+	using IdTable::IdTable;
+};
+
+struct IdMap : IdTable<true>
+{
+	static constexpr const char* MetaName = "ProddyUtils.IdMap";
+
+	using IdTable::IdTable;
+};
+
+// Values come back as integers when they are whole numbers that a double holds exactly.
+static void lua_pushidvalue(lua_State* L, double value)
+{
+	if (value == std::floor(value) && std::abs(value) <= 9007199254740992.0)
+		lua_pushinteger(L, (lua_Integer)value);
+	else
+		lua_pushnumber(L, value);
+}
+
+template <typename T>
+static int lua_idtablenew(lua_State* L)
+{
+	auto capacity = luaL_optinteger(L, 1, 0);
+	lua_newobject<T>(L, capacity > 0 ? (size_t)capacity : 0);
+	return 1;
+}
+
+template <typename T>
+static int lua_idtablehas(lua_State* L)
+{
+	auto table = lua_checkobject<T>(L, 1);
+	lua_pushboolean(L, table->Find(luaL_checkinteger(L, 2)) != SIZE_MAX);
+	return 1;
+}
+
+template <typename T>
+static int lua_idtableremove(lua_State* L)
+{
+	auto table = lua_checkobject<T>(L, 1);
+	lua_pushboolean(L, table->Erase(luaL_checkinteger(L, 2)));
+	return 1;
+}
+
+template <typename T>
+static int lua_idtablesize(lua_State* L)
+{
+	auto table = lua_checkobject<T>(L, 1);
+	lua_pushinteger(L, table->Size);
+	return 1;
+}
+
+template <typename T>
+static int lua_idtableclear(lua_State* L)
+{
+	lua_checkobject<T>(L, 1)->Clear();
+	return 0;
+}
+
+template <typename T>
+static int lua_idtablememory(lua_State* L)
+{
+	auto table = lua_checkobject<T>(L, 1);
+	lua_pushinteger(L, table->Ctrl.capacity() + table->Keys.capacity() * sizeof(int64_t) + table->Values.capacity() * sizeof(double));
+	return 1;
+}
+
+static int lua_idsetadd(lua_State* L)
+{
+	auto set = lua_checkobject<IdSet>(L, 1);
+	bool bInserted;
+	set->Insert(luaL_checkinteger(L, 2), bInserted);
+	lua_pushboolean(L, bInserted);
+	return 1;
+}
+
+static int lua_idsetload(lua_State* L)
+{
+	auto set = lua_checkobject<IdSet>(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	auto size = lua_rawlen(L, 2);
+	set->Reserve(set->Size + size);
+	for (size_t i = 1; i <= size; i++)
+	{
+		lua_rawgeti(L, 2, i);
+		int isnum;
+		auto id = lua_tointegerx(L, -1, &isnum);
+		lua_pop(L, 1);
+		if (!isnum)
+			return luaL_error(L, "element %d is not an integer", (int)i);
+		bool bInserted;
+		set->Insert(id, bInserted);
+	}
+	return 0;
+}
+
+static int lua_idsettotable(lua_State* L)
+{
+	auto set = lua_checkobject<IdSet>(L, 1);
+	lua_createtable(L, (int)set->Size, 0);
+	lua_Integer n = 0;
+	set->Visit([&](size_t slot) {
+		lua_pushinteger(L, set->Keys[slot]);
+		lua_rawseti(L, -2, ++n);
+	});
+	return 1;
+}
+
+static int lua_idmapset(lua_State* L)
+{
+	auto map = lua_checkobject<IdMap>(L, 1);
+	auto id = luaL_checkinteger(L, 2);
+	if (lua_isnoneornil(L, 3))
+	{
+		map->Erase(id);
+		return 0;
+	}
+	auto value = luaL_checknumber(L, 3);
+	bool bInserted;
+	map->Values[map->Insert(id, bInserted)] = value;
+	return 0;
+}
+
+static int lua_idmapget(lua_State* L)
+{
+	auto map = lua_checkobject<IdMap>(L, 1);
+	auto slot = map->Find(luaL_checkinteger(L, 2));
+	if (slot == SIZE_MAX)
+		lua_pushnil(L);
+	else
+		lua_pushidvalue(L, map->Values[slot]);
+	return 1;
+}
+
+static int lua_idmapadd(lua_State* L)
+{
+	auto map = lua_checkobject<IdMap>(L, 1);
+	auto id = luaL_checkinteger(L, 2);
+	auto delta = luaL_optnumber(L, 3, 1);
+	bool bInserted;
+	auto slot = map->Insert(id, bInserted);
+	map->Values[slot] = bInserted ? delta : map->Values[slot] + delta;
+	lua_pushidvalue(L, map->Values[slot]);
+	return 1;
+}
+
+static int lua_idmapload(lua_State* L)
+{
+	auto map = lua_checkobject<IdMap>(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	// Counting first is cheaper than the rehashes of growing while inserting.
+	size_t count = 0;
+	lua_pushnil(L);
+	while (lua_next(L, 2) != 0)
+	{
+		count++;
+		lua_pop(L, 1);
+	}
+	map->Reserve(map->Size + count);
+	lua_pushnil(L);
+	while (lua_next(L, 2) != 0)
+	{
+		int isint, isnum;
+		auto id = lua_tointegerx(L, -2, &isint);
+		auto value = lua_tonumberx(L, -1, &isnum);
+		if (!isint || !isnum)
+			return luaL_error(L, "keys must be integers and values numbers");
+		bool bInserted;
+		map->Values[map->Insert(id, bInserted)] = value;
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+static int lua_idmaptotable(lua_State* L)
+{
+	auto map = lua_checkobject<IdMap>(L, 1);
+	lua_createtable(L, 0, (int)map->Size);
+	map->Visit([&](size_t slot) {
+		lua_pushidvalue(L, map->Values[slot]);
+		lua_rawseti(L, -2, map->Keys[slot]);
+	});
+	return 1;
+}
+#pragma endregion
+
+#pragma region Trie
+// Nodes live in parallel arrays and link to their first child and next sibling by index.
+// Siblings are kept sorted by byte so a depth first walk visits words in order.
+struct PrefixTrie
+{
+	static constexpr const char* MetaName = "ProddyUtils.Trie";
+
+	std::vector<int32_t> FirstChild;
+	std::vector<int32_t> NextSibling;
+	std::vector<uint8_t> Byte;
+	std::vector<int32_t> Word;
+	std::vector<double> MaxWeight;
+	std::vector<int32_t> FreeNodes;
+
+	std::vector<std::string> Words;
+	std::vector<double> Weights;
+	std::vector<int32_t> FreeWords;
+
+	bool bCaseSensitive;
+	size_t Size = 0;
+
+	PrefixTrie(bool caseSensitive) : bCaseSensitive(caseSensitive)
+	{
+		NewNode(0);
+	}
+
+	std::string Key(const char* str, size_t len) const
+	{
+		std::string key(str, len);
+		if (bCaseSensitive)
+			return key;
+		bool bASCII = true;
+		for (auto& c : key)
+		{
+			if ((uint8_t)c >= 0x80)
+				bASCII = false;
+			else if (c >= 'A' && c <= 'Z')
+				c += 'a' - 'A';
+		}
+		if (bASCII)
+			return key;
+		auto wide = UTF8ToUTF16(key.c_str(), key.size());
+		CharLowerBuffW(&wide[0], (DWORD)wide.size());
+		return UTF16ToUTF8(wide);
+	}
+
+	int32_t NewNode(uint8_t byte)
+	{
+		int32_t node;
+		if (!FreeNodes.empty())
+		{
+			node = FreeNodes.back();
+			FreeNodes.pop_back();
+		}
+		else
+		{
+			node = (int32_t)Byte.size();
+			FirstChild.push_back(0);
+			NextSibling.push_back(0);
+			Byte.push_back(0);
+			Word.push_back(0);
+			MaxWeight.push_back(0);
+		}
+		FirstChild[node] = -1;
+		NextSibling[node] = -1;
+		Byte[node] = byte;
+		Word[node] = -1;
+		MaxWeight[node] = -HUGE_VAL;
+		return node;
+	}
+
+	int32_t Child(int32_t node, uint8_t byte) const
+	{
+		for (auto child = FirstChild[node]; child != -1 && Byte[child] <= byte; child = NextSibling[child])
+		{
+			if (Byte[child] == byte)
+				return child;
+		}
+		return -1;
+	}
+
+	// Node for key, or -1.
+	int32_t Find(const std::string& key) const
+	{
+		int32_t node = 0;
+		for (size_t i = 0; i < key.size() && node != -1; i++)
+			node = Child(node, (uint8_t)key[i]);
+		return node;
+	}
+
+	void Insert(const char* str, size_t len, double weight)
+	{
+		auto key = Key(str, len);
+		int32_t node = 0;
+		MaxWeight[0] = std::max(MaxWeight[0], weight);
+		for (auto c : key)
+		{
+			auto byte = (uint8_t)c;
+			auto prev = -1;
+			auto child = FirstChild[node];
+			while (child != -1 && Byte[child] < byte)
+			{
+				prev = child;
+				child = NextSibling[child];
+			}
+			if (child == -1 || Byte[child] != byte)
+			{
+				auto created = NewNode(byte);
+				NextSibling[created] = child;
+				if (prev == -1)
+					FirstChild[node] = created;
+				else
+					NextSibling[prev] = created;
+				child = created;
+			}
+			node = child;
+			MaxWeight[node] = std::max(MaxWeight[node], weight);
+		}
+
+		auto word = Word[node];
+		if (word == -1)
+		{
+			if (!FreeWords.empty())
+			{
+				word = FreeWords.back();
+				FreeWords.pop_back();
+			}
+			else
+			{
+				word = (int32_t)Words.size();
+				Words.emplace_back();
+				Weights.push_back(0);
+			}
+			Word[node] = word;
+			Size++;
+		}
+		auto oldWeight = Weights[word];
+		Words[word].assign(str, len);
+		Weights[word] = weight;
+		// A lowered weight can leave stale maximums along the path.
+		if (weight < oldWeight)
+			Refresh(key);
+	}
+
+	// Recomputes MaxWeight bottom up along the path to key, dropping nodes that no longer lead anywhere.
+	void Refresh(const std::string& key)
+	{
+		std::vector<int32_t> path;
+		path.reserve(key.size() + 1);
+		path.push_back(0);
+		for (auto c : key)
+			path.push_back(Child(path.back(), (uint8_t)c));
+		for (auto i = path.size(); i-- > 0;)
+		{
+			auto node = path[i];
+			auto max = Word[node] != -1 ? Weights[Word[node]] : -HUGE_VAL;
+			for (auto child = FirstChild[node]; child != -1; child = NextSibling[child])
+				max = std::max(max, MaxWeight[child]);
+			MaxWeight[node] = max;
+			if (i > 0 && FirstChild[node] == -1 && Word[node] == -1)
+			{
+				auto parent = path[i - 1];
+				if (FirstChild[parent] == node)
+					FirstChild[parent] = NextSibling[node];
+				else
+				{
+					auto prev = FirstChild[parent];
+					while (NextSibling[prev] != node)
+						prev = NextSibling[prev];
+					NextSibling[prev] = NextSibling[node];
+				}
+				FreeNodes.push_back(node);
+			}
+		}
+	}
+
+	bool Remove(const char* str, size_t len)
+	{
+		auto key = Key(str, len);
+		auto node = Find(key);
+		if (node == -1 || Word[node] == -1)
+			return false;
+		auto word = Word[node];
+		Words[word].clear();
+		Words[word].shrink_to_fit();
+		FreeWords.push_back(word);
+		Word[node] = -1;
+		Size--;
+		Refresh(key);
+		return true;
+	}
+
+	// Top limit words under prefix by weight. Ties keep byte order of the key.
+	void Search(const char* str, size_t len, size_t limit, std::vector<int32_t>& out) const
+	{
+		out.clear();
+		if (limit == 0)
+			return;
+		auto node = Find(Key(str, len));
+		if (node == -1)
+			return;
+
+		// Min heap of (weight, order, word) holding the best found so far.
+		struct Hit
+		{
+			double Weight;
+			size_t Order;
+			int32_t Word;
+			bool operator<(const Hit& other) const
+			{
+				return Weight != other.Weight ? Weight > other.Weight : Order < other.Order;
+			}
+		};
+		std::vector<Hit> best;
+		std::vector<int32_t> stack = { node };
+		size_t order = 0;
+		while (!stack.empty())
+		{
+			node = stack.back();
+			stack.pop_back();
+			if (best.size() == limit && MaxWeight[node] <= best.front().Weight)
+				continue;
+			if (Word[node] != -1)
+			{
+				auto weight = Weights[Word[node]];
+				if (best.size() < limit)
+				{
+					best.push_back({ weight, order++, Word[node] });
+					std::push_heap(best.begin(), best.end());
+				}
+				else if (weight > best.front().Weight)
+				{
+					std::pop_heap(best.begin(), best.end());
+					best.back() = { weight, order++, Word[node] };
+					std::push_heap(best.begin(), best.end());
+				}
+			}
+			// Push children in reverse so the smallest byte is visited first.
+			auto mark = stack.size();
+			for (auto child = FirstChild[node]; child != -1; child = NextSibling[child])
+				stack.push_back(child);
+			std::reverse(stack.begin() + mark, stack.end());
+		}
+		std::sort_heap(best.begin(), best.end());
+		for (auto& hit : best)
+			out.push_back(hit.Word);
+	}
+};
+
+static void lua_trieinsertall(lua_State* L, PrefixTrie* trie, int idx)
+{
+	lua_pushnil(L);
+	while (lua_next(L, idx) != 0)
+	{
+		size_t len;
+		if (lua_type(L, -2) == LUA_TSTRING && lua_isnumber(L, -1))
+		{
+			auto str = lua_tolstring(L, -2, &len);
+			trie->Insert(str, len, lua_tonumber(L, -1));
+		}
+		else if (lua_type(L, -1) == LUA_TSTRING)
+		{
+			auto str = lua_tolstring(L, -1, &len);
+			trie->Insert(str, len, 0);
+		}
+		else
+			luaL_error(L, "expected an array of strings or a table of string = weight pairs");
+		lua_pop(L, 1);
+	}
+}
+
+static int lua_trienew(lua_State* L)
+{
+	auto trie = lua_newobject<PrefixTrie>(L, lua_toboolean(L, 2) != 0);
+	if (!lua_isnoneornil(L, 1))
+	{
+		luaL_checktype(L, 1, LUA_TTABLE);
+		lua_trieinsertall(L, trie, 1);
+	}
+	return 1;
+}
+
+static int lua_trieinsert(lua_State* L)
+{
+	auto trie = lua_checkobject<PrefixTrie>(L, 1);
+	size_t len;
+	auto str = luaL_checklstring(L, 2, &len);
+	trie->Insert(str, len, luaL_optnumber(L, 3, 0));
+	return 0;
+}
+
+static int lua_trieinsertmany(lua_State* L)
+{
+	auto trie = lua_checkobject<PrefixTrie>(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_trieinsertall(L, trie, 2);
+	return 0;
+}
+
+static int lua_trieremove(lua_State* L)
+{
+	auto trie = lua_checkobject<PrefixTrie>(L, 1);
+	size_t len;
+	auto str = luaL_checklstring(L, 2, &len);
+	lua_pushboolean(L, trie->Remove(str, len));
+	return 1;
+}
+
+static int lua_trieget(lua_State* L)
+{
+	auto trie = lua_checkobject<PrefixTrie>(L, 1);
+	size_t len;
+	auto str = luaL_checklstring(L, 2, &len);
+	auto node = trie->Find(trie->Key(str, len));
+	if (node == -1 || trie->Word[node] == -1)
+	{
+		lua_pushnil(L);
+		return 1;
+	}
+	lua_pushlstring(L, trie->Words[trie->Word[node]]);
+	lua_pushnumber(L, trie->Weights[trie->Word[node]]);
+	return 2;
+}
+
+static int lua_triesize(lua_State* L)
+{
+	auto trie = lua_checkobject<PrefixTrie>(L, 1);
+	lua_pushinteger(L, trie->Size);
+	return 1;
+}
+
+static int lua_trieprefixsearch(lua_State* L)
+{
+	auto trie = lua_checkobject<PrefixTrie>(L, 1);
+	size_t len;
+	auto str = luaL_checklstring(L, 2, &len);
+	auto limit = luaL_optinteger(L, 3, 10);
+	luaL_argcheck(L, limit >= 0, 3, "limit must not be negative");
+
+	std::vector<int32_t> words;
+	trie->Search(str, len, (size_t)limit, words);
+	lua_createtable(L, (int)words.size(), 0);
+	lua_createtable(L, (int)words.size(), 0);
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		lua_pushlstring(L, trie->Words[words[i]]);
+		lua_rawseti(L, -3, i + 1);
+		lua_pushnumber(L, trie->Weights[words[i]]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	return 2;
+}
+#pragma endregion
+
+#pragma region Table
+// Pattern-defeating quicksort (Orson Peters): introsort that detects sorted runs and bad pivots.
+constexpr ptrdiff_t PdqInsertionSortThreshold = 24;
+constexpr ptrdiff_t PdqNintherThreshold = 128;
+constexpr ptrdiff_t PdqPartialInsertionSortLimit = 8;
+
+template <typename T, typename Compare>
+static void PdqInsertionSort(T* begin, T* end, Compare comp, bool bGuarded)
+{
+	if (begin == end)
+		return;
+	for (auto cur = begin + 1; cur != end; cur++)
+	{
+		auto sift = cur;
+		auto sift1 = cur - 1;
+		if (comp(*sift, *sift1))
+		{
+			auto tmp = std::move(*sift);
+			// Unguarded sorts rely on the element before begin being no greater than anything here.
+			do
+			{
+				*sift-- = std::move(*sift1);
+			} while ((!bGuarded || sift != begin) && comp(tmp, *--sift1));
+			*sift = std::move(tmp);
+		}
+	}
+}
+
+// Insertion sort that gives up after moving a handful of elements.
+template <typename T, typename Compare>
+static bool PdqPartialInsertionSort(T* begin, T* end, Compare comp)
+{
+	if (begin == end)
+		return true;
+	ptrdiff_t limit = 0;
+	for (auto cur = begin + 1; cur != end; cur++)
+	{
+		auto sift = cur;
+		auto sift1 = cur - 1;
+		if (comp(*sift, *sift1))
+		{
+			auto tmp = std::move(*sift);
+			do
+			{
+				*sift-- = std::move(*sift1);
+			} while (sift != begin && comp(tmp, *--sift1));
+			*sift = std::move(tmp);
+			limit += cur - sift;
+		}
+		if (limit > PdqPartialInsertionSortLimit)
+			return false;
+	}
+	return true;
+}
+
+template <typename T, typename Compare>
+static void PdqSort2(T* a, T* b, Compare comp)
+{
+	if (comp(*b, *a))
+		std::iter_swap(a, b);
+}
+
+template <typename T, typename Compare>
+static void PdqSort3(T* a, T* b, T* c, Compare comp)
+{
+	PdqSort2(a, b, comp);
+	PdqSort2(b, c, comp);
+	PdqSort2(a, b, comp);
+}
+
+// Partitions around *begin with equal elements going right. Also reports whether nothing had to move.
+template <typename T, typename Compare>
+static T* PdqPartitionRight(T* begin, T* end, Compare comp, bool& bAlreadyPartitioned)
+{
+	auto pivot = std::move(*begin);
+	auto first = begin;
+	auto last = end;
+	while (comp(*++first, pivot));
+	if (first - 1 == begin)
+		while (first < last && !comp(*--last, pivot));
+	else
+		while (!comp(*--last, pivot));
+	bAlreadyPartitioned = first >= last;
+	while (first < last)
+	{
+		std::iter_swap(first, last);
+		while (comp(*++first, pivot));
+		while (!comp(*--last, pivot));
+	}
+	auto pivotPos = first - 1;
+	*begin = std::move(*pivotPos);
+	*pivotPos = std::move(pivot);
+	return pivotPos;
+}
+
+// Partitions around *begin with equal elements going left, used when many elements equal the pivot.
+template <typename T, typename Compare>
+static T* PdqPartitionLeft(T* begin, T* end, Compare comp)
+{
+	auto pivot = std::move(*begin);
+	auto first = begin;
+	auto last = end;
+	while (comp(pivot, *--last));
+	if (last + 1 == end)
+		while (first < last && !comp(pivot, *++first));
+	else
+		while (!comp(pivot, *++first));
+	while (first < last)
+	{
+		std::iter_swap(first, last);
+		while (comp(pivot, *--last));
+		while (!comp(pivot, *++first));
+	}
+	auto pivotPos = last;
+	*begin = std::move(*pivotPos);
+	*pivotPos = std::move(pivot);
+	return pivotPos;
+}
+
+template <typename T, typename Compare>
+static void PdqSortLoop(T* begin, T* end, Compare comp, int badAllowed, bool bLeftmost)
+{
+	while (true)
+	{
+		auto size = end - begin;
+		if (size < PdqInsertionSortThreshold)
+		{
+			PdqInsertionSort(begin, end, comp, bLeftmost);
+			return;
+		}
+
+		auto s2 = size / 2;
+		if (size > PdqNintherThreshold)
+		{
+			PdqSort3(begin, begin + s2, end - 1, comp);
+			PdqSort3(begin + 1, begin + (s2 - 1), end - 2, comp);
+			PdqSort3(begin + 2, begin + (s2 + 1), end - 3, comp);
+			PdqSort3(begin + (s2 - 1), begin + s2, begin + (s2 + 1), comp);
+			std::iter_swap(begin, begin + s2);
+		}
+		else
+			PdqSort3(begin + s2, begin, end - 1, comp);
+
+		// A pivot equal to the element before this range means everything equal to it can be skipped.
+		if (!bLeftmost && !comp(*(begin - 1), *begin))
+		{
+			begin = PdqPartitionLeft(begin, end, comp) + 1;
+			continue;
+		}
+
+		bool bAlreadyPartitioned;
+		auto pivotPos = PdqPartitionRight(begin, end, comp, bAlreadyPartitioned);
+		auto lSize = pivotPos - begin;
+		auto rSize = end - (pivotPos + 1);
+		if (lSize < size / 8 || rSize < size / 8)
+		{
+			if (--badAllowed == 0)
+			{
+				std::make_heap(begin, end, comp);
+				std::sort_heap(begin, end, comp);
+				return;
+			}
+			// Shuffle some elements around to break up patterns that produce bad pivots.
+			if (lSize >= PdqInsertionSortThreshold)
+			{
+				std::iter_swap(begin, begin + lSize / 4);
+				std::iter_swap(pivotPos - 1, pivotPos - lSize / 4);
+				if (lSize > PdqNintherThreshold)
+				{
+					std::iter_swap(begin + 1, begin + (lSize / 4 + 1));
+					std::iter_swap(begin + 2, begin + (lSize / 4 + 2));
+					std::iter_swap(pivotPos - 2, pivotPos - (lSize / 4 + 1));
+					std::iter_swap(pivotPos - 3, pivotPos - (lSize / 4 + 2));
+				}
+			}
+			if (rSize >= PdqInsertionSortThreshold)
+			{
+				std::iter_swap(pivotPos + 1, pivotPos + (1 + rSize / 4));
+				std::iter_swap(end - 1, end - rSize / 4);
+				if (rSize > PdqNintherThreshold)
+				{
+					std::iter_swap(pivotPos + 2, pivotPos + (2 + rSize / 4));
+					std::iter_swap(pivotPos + 3, pivotPos + (3 + rSize / 4));
+					std::iter_swap(end - 2, end - (1 + rSize / 4));
+					std::iter_swap(end - 3, end - (2 + rSize / 4));
+				}
+			}
+		}
+		else if (bAlreadyPartitioned && PdqPartialInsertionSort(begin, pivotPos, comp) && PdqPartialInsertionSort(pivotPos + 1, end, comp))
+			return;
+
+		PdqSortLoop(begin, pivotPos, comp, badAllowed, bLeftmost);
+		begin = pivotPos + 1;
+		bLeftmost = false;
+	}
+}
+
+template <typename T, typename Compare>
+static void PdqSort(T* begin, T* end, Compare comp)
+{
+	if (end - begin < 2)
+		return;
+	int log2 = 0;
+	for (auto size = end - begin; size > 1; size >>= 1)
+		log2++;
+	PdqSortLoop(begin, end, comp, log2, true);
+}
+
+// LSD radix sort of indexes by 64-bit keys, one byte per pass. Passes where every key has the same byte are skipped.
+static void RadixSort(uint64_t* keys, int32_t* indexes, size_t size, uint64_t* keysTemp, int32_t* indexesTemp)
+{
+	auto result = indexes;
+	std::vector<size_t> counts(8 * 256, 0);
+	for (size_t i = 0; i < size; i++)
+	{
+		for (int pass = 0; pass < 8; pass++)
+			counts[pass * 256 + ((keys[i] >> (pass * 8)) & 0xFF)]++;
+	}
+	for (int pass = 0; pass < 8; pass++)
+	{
+		auto count = &counts[pass * 256];
+		if (count[(keys[0] >> (pass * 8)) & 0xFF] == size)
+			continue;
+		size_t offset = 0;
+		for (int b = 0; b < 256; b++)
+		{
+			auto c = count[b];
+			count[b] = offset;
+			offset += c;
+		}
+		for (size_t i = 0; i < size; i++)
+		{
+			auto pos = count[(keys[i] >> (pass * 8)) & 0xFF]++;
+			keysTemp[pos] = keys[i];
+			indexesTemp[pos] = indexes[i];
+		}
+		std::swap(keys, keysTemp);
+		std::swap(indexes, indexesTemp);
+	}
+	// An odd number of passes leaves the result in the temp array.
+	if (indexes != result)
+		std::copy(indexes, indexes + size, result);
+}
+
+// Maps numbers to unsigned integers with the same order.
+inline uint64_t RadixKey(int64_t value)
+{
+	return (uint64_t)value ^ 0x8000000000000000ULL;
+}
+
+inline uint64_t RadixKey(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x8000000000000000ULL) ? ~bits : bits | 0x8000000000000000ULL;
+}
+
+struct SortStringKey
+{
+	const char* Data;
+	size_t Length;
+
+	bool operator<(const SortStringKey& other) const
+	{
+		auto result = memcmp(Data, other.Data, std::min(Length, other.Length));
+		return result != 0 ? result < 0 : Length < other.Length;
+	}
+};
+
+static int lua_tablesortby(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	auto keyType = lua_type(L, 2);
+	luaL_argcheck(L, keyType == LUA_TNONE || keyType == LUA_TNIL || keyType == LUA_TSTRING || keyType == LUA_TNUMBER || keyType == LUA_TFUNCTION, 2, "expected a field name, index or function");
+	auto field = keyType == LUA_TSTRING ? lua_tostring(L, 2) : nullptr;
+	auto fieldIndex = keyType == LUA_TNUMBER ? luaL_checkinteger(L, 2) : 0;
+	bool bDescending = false;
+	bool bStable = false;
+	if (!lua_isnoneornil(L, 3))
+	{
+		luaL_checktype(L, 3, LUA_TTABLE);
+		lua_getfield(L, 3, "Descending");
+		bDescending = lua_toboolean(L, -1) != 0;
+		lua_getfield(L, 3, "Stable");
+		bStable = lua_toboolean(L, -1) != 0;
+	}
+	lua_settop(L, 3);
+
+	auto size = lua_rawlen(L, 1);
+	luaL_argcheck(L, size <= INT32_MAX, 1, "too many elements");
+	if (size < 2)
+	{
+		lua_settop(L, 1);
+		return 1;
+	}
+
+	// Scratch space is a userdata so nothing leaks if a key function errors.
+	// Keys take 16 bytes per element: a string key, or a number key plus its radix sort temp.
+	auto scratch = static_cast<uint8_t*>(lua_newuserdata(L, size * (sizeof(SortStringKey) + 2 * sizeof(int32_t))));
+	auto stringKeys = reinterpret_cast<SortStringKey*>(scratch);
+	auto numberKeys = reinterpret_cast<uint64_t*>(scratch);
+	auto indexes = reinterpret_cast<int32_t*>(scratch + size * sizeof(SortStringKey));
+	auto indexesTemp = indexes + size;
+
+	// String keys that didn't come straight from the array are kept alive here.
+	if (keyType != LUA_TNONE && keyType != LUA_TNIL)
+		lua_createtable(L, (int)size, 0);
+	auto anchor = lua_gettop(L);
+
+	int sortType = LUA_TNONE;
+	bool bIntegers = true;
+	for (size_t i = 0; i < size; i++)
+	{
+		indexes[i] = (int32_t)i;
+		// Without a key the element itself is the key.
+		lua_rawgeti(L, 1, i + 1);
+		if (field)
+		{
+			lua_getfield(L, -1, field);
+			lua_remove(L, -2);
+		}
+		else if (keyType == LUA_TNUMBER)
+		{
+			lua_geti(L, -1, fieldIndex);
+			lua_remove(L, -2);
+		}
+		else if (keyType == LUA_TFUNCTION)
+		{
+			lua_pushvalue(L, 2);
+			lua_insert(L, -2);
+			lua_call(L, 1, 1);
+		}
+
+		auto type = lua_type(L, -1);
+		if (type != LUA_TNUMBER && type != LUA_TSTRING)
+			return luaL_error(L, "sort key for element %d is a %s, expected a number or string", (int)(i + 1), luaL_typename(L, -1));
+		if (sortType == LUA_TNONE)
+			sortType = type;
+		else if (type != sortType)
+			return luaL_error(L, "sort keys must be all numbers or all strings");
+
+		if (type == LUA_TSTRING)
+		{
+			stringKeys[i].Data = lua_tolstring(L, -1, &stringKeys[i].Length);
+			if (anchor > 4)
+			{
+				lua_pushvalue(L, -1);
+				lua_rawseti(L, anchor, i + 1);
+			}
+		}
+		else if (lua_isinteger(L, -1) && bIntegers)
+			numberKeys[i] = RadixKey((int64_t)lua_tointeger(L, -1));
+		else
+		{
+			// Switching to floats, so redo the integer keys seen so far.
+			if (bIntegers)
+			{
+				for (size_t j = 0; j < i; j++)
+					numberKeys[j] = RadixKey((double)(int64_t)(numberKeys[j] ^ 0x8000000000000000ULL));
+				bIntegers = false;
+			}
+			numberKeys[i] = RadixKey((double)lua_tonumber(L, -1));
+		}
+		lua_pop(L, 1);
+	}
+
+	if (sortType == LUA_TNUMBER)
+	{
+		// Radix sort is stable, and inverting the keys keeps it stable for descending order.
+		if (bDescending)
+		{
+			for (size_t i = 0; i < size; i++)
+				numberKeys[i] = ~numberKeys[i];
+		}
+		RadixSort(numberKeys, indexes, size, numberKeys + size, indexesTemp);
+	}
+	else
+	{
+		auto comp = [stringKeys, bDescending](int32_t a, int32_t b) {
+			return bDescending ? stringKeys[b] < stringKeys[a] : stringKeys[a] < stringKeys[b];
+		};
+		if (bStable)
+			std::stable_sort(indexes, indexes + size, comp);
+		else
+			PdqSort(indexes, indexes + size, comp);
+	}
+
+	// Apply the permutation one cycle at a time, holding one element on the stack.
+	for (size_t start = 0; start < size; start++)
+	{
+		if (indexes[start] == (int32_t)start)
+			continue;
+		lua_rawgeti(L, 1, start + 1);
+		auto pos = start;
+		while (true)
+		{
+			auto from = (size_t)indexes[pos];
+			indexes[pos] = (int32_t)pos;
+			if (from == start)
+				break;
+			lua_rawgeti(L, 1, from + 1);
+			lua_rawseti(L, 1, pos + 1);
+			pos = from;
+		}
+		lua_rawseti(L, 1, pos + 1);
+	}
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+// Nesting limit for the recursive table functions, matching Lua's own C call limit.
+constexpr int MaxTableDepth = 200;
+
+// Pushes a copy of the table at idx. seen maps tables already copied to their copies, so shared and cyclic references are kept.
+static void lua_deepcopy(lua_State* L, int idx, int seen, int depth)
+{
+	if (depth > MaxTableDepth)
+		luaL_error(L, "tables nested too deeply");
+	luaL_checkstack(L, 6, nullptr);
+	idx = lua_absindex(L, idx);
+
+	// Counting first lets the copy be created at its final size.
+	auto narr = (int)lua_rawlen(L, idx);
+	int total = 0;
+	lua_pushnil(L);
+	while (lua_next(L, idx) != 0)
+	{
+		total++;
+		lua_pop(L, 1);
+	}
+	lua_createtable(L, narr, std::max(total - narr, 0));
+	lua_pushvalue(L, idx);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, seen);
+	if (lua_getmetatable(L, idx))
+		lua_setmetatable(L, -2);
+
+	lua_pushnil(L);
+	while (lua_next(L, idx) != 0)
+	{
+		if (lua_type(L, -1) == LUA_TTABLE)
+		{
+			lua_pushvalue(L, -1);
+			if (lua_rawget(L, seen) == LUA_TNIL)
+			{
+				lua_pop(L, 1);
+				lua_deepcopy(L, -1, seen, depth + 1);
+			}
+			lua_remove(L, -2);
+		}
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
+	}
+}
+
+static int lua_tabledeepcopy(lua_State* L)
+{
+	if (lua_type(L, 1) != LUA_TTABLE)
+	{
+		lua_settop(L, 1);
+		return 1;
+	}
+	lua_settop(L, 1);
+	lua_newtable(L);
+	lua_deepcopy(L, 1, 2, 0);
+	return 1;
+}
+
+struct PointerPairHash
+{
+	size_t operator()(const std::pair<const void*, const void*>& p) const
+	{
+		return std::hash<const void*>()(p.first) * 31 + std::hash<const void*>()(p.second);
+	}
+};
+
+// Compares the values at a and b. Pairs of tables already being compared are assumed equal, which settles cycles.
+// Returns -1 if the tables are nested too deeply, so the caller can free its state before raising the error.
+static int lua_deepequal(lua_State* L, int a, int b, std::unordered_set<std::pair<const void*, const void*>, PointerPairHash>& assumed, int depth)
+{
+	if (lua_type(L, a) != LUA_TTABLE || lua_type(L, b) != LUA_TTABLE)
+		return lua_rawequal(L, a, b);
+	if (lua_rawequal(L, a, b))
+		return 1;
+	if (depth > MaxTableDepth || !lua_checkstack(L, 4))
+		return -1;
+	if (!assumed.emplace(lua_topointer(L, a), lua_topointer(L, b)).second)
+		return 1;
+	a = lua_absindex(L, a);
+	b = lua_absindex(L, b);
+
+	int count = 0;
+	lua_pushnil(L);
+	while (lua_next(L, a) != 0)
+	{
+		count++;
+		lua_pushvalue(L, -2);
+		lua_rawget(L, b);
+		auto result = lua_isnil(L, -1) ? 0 : lua_deepequal(L, -2, -1, assumed, depth + 1);
+		if (result != 1)
+		{
+			lua_pop(L, 3);
+			return result;
+		}
+		lua_pop(L, 2);
+	}
+	lua_pushnil(L);
+	while (lua_next(L, b) != 0)
+	{
+		count--;
+		lua_pop(L, 1);
+	}
+	return count == 0;
+}
+
+static int lua_tabledeepequal(lua_State* L)
+{
+	luaL_checkany(L, 1);
+	luaL_checkany(L, 2);
+	int result;
+	{
+		std::unordered_set<std::pair<const void*, const void*>, PointerPairHash> assumed;
+		result = lua_deepequal(L, 1, 2, assumed, 0);
+	}
+	if (result < 0)
+		return luaL_error(L, "tables nested too deeply");
+	lua_pushboolean(L, result);
+	return 1;
+}
+
+// Hashes the value at idx. Table entries are summed so the result doesn't depend on iteration order,
+// and a table reached again through a cycle contributes a fixed value. Returns false if nested too deeply.
+static bool lua_deephash(lua_State* L, int idx, uint64_t& hash, std::unordered_map<const void*, uint64_t>& done, std::unordered_set<const void*>& path, int depth)
+{
+	auto type = lua_type(L, idx);
+	if (type != LUA_TTABLE)
+	{
+		std::string key;
+		if (!lua_tokey(L, idx, key))
+		{
+			auto ptr = lua_topointer(L, idx);
+			key.assign(1, (char)type);
+			key.append(reinterpret_cast<const char*>(&ptr), sizeof(ptr));
+		}
+		hash = Murmur64(key.data(), key.size());
+		return true;
+	}
+
+	auto ptr = lua_topointer(L, idx);
+	auto it = done.find(ptr);
+	if (it != done.end())
+	{
+		hash = it->second;
+		return true;
+	}
+	if (path.count(ptr) != 0)
+	{
+		hash = 0x9e3779b97f4a7c15ULL;
+		return true;
+	}
+	if (depth > MaxTableDepth || !lua_checkstack(L, 3))
+		return false;
+	path.insert(ptr);
+	idx = lua_absindex(L, idx);
+
+	uint64_t sum = 0;
+	lua_pushnil(L);
+	while (lua_next(L, idx) != 0)
+	{
+		uint64_t entry[2];
+		if (!lua_deephash(L, -2, entry[0], done, path, depth + 1) || !lua_deephash(L, -1, entry[1], done, path, depth + 1))
+		{
+			lua_pop(L, 2);
+			return false;
+		}
+		sum += Murmur64(entry, sizeof(entry));
+		lua_pop(L, 1);
+	}
+	hash = Murmur64(&sum, sizeof(sum), 't');
+	path.erase(ptr);
+	done.emplace(ptr, hash);
+	return true;
+}
+
+static int lua_tablehash(lua_State* L)
+{
+	luaL_checkany(L, 1);
+	uint64_t hash;
+	bool bOK;
+	{
+		std::unordered_map<const void*, uint64_t> done;
+		std::unordered_set<const void*> path;
+		bOK = lua_deephash(L, 1, hash, done, path, 0);
+	}
+	if (!bOK)
+		return luaL_error(L, "tables nested too deeply");
+	lua_pushinteger(L, (lua_Integer)hash);
+	return 1;
+}
+
+// True if the table's keys are exactly 1 to n, with count set to n. Empty tables count as arrays.
+static bool lua_isarraytable(lua_State* L, int idx, size_t& count)
+{
+	idx = lua_absindex(L, idx);
+	count = 0;
+	lua_Integer max = 0;
+	lua_pushnil(L);
+	while (lua_next(L, idx) != 0)
+	{
+		lua_pop(L, 1);
+		count++;
+		if (!lua_isinteger(L, -1) || lua_tointeger(L, -1) < 1)
+		{
+			lua_pop(L, 1);
+			return false;
+		}
+		max = std::max(max, lua_tointeger(L, -1));
+	}
+	return (size_t)max == count;
+}
+#pragma endregion
+
+#pragma region Pool
+// Free tables live in the uservalue at 1..Free. The same table also maps each free table to true, so a double release can be caught.
+struct TablePool
+{
+	static constexpr const char* MetaName = "ProddyUtils.Pool";
+
+	int ArraySize;
+	int HashSize;
+	lua_Integer MaxFree;
+	lua_Integer Free = 0;
+	lua_Integer Created = 0;
+	lua_Integer Reused = 0;
+
+	TablePool(int arraySize, int hashSize, lua_Integer maxFree) : ArraySize(arraySize), HashSize(hashSize), MaxFree(maxFree)
+	{
+	}
+};
+
+// Removes every entry and the metatable. Lua keeps the table's allocated size, so refilling it doesn't rehash.
+static void lua_cleartable(lua_State* L, int idx)
+{
+	idx = lua_absindex(L, idx);
+	lua_pushnil(L);
+	while (lua_next(L, idx) != 0)
+	{
+		lua_pop(L, 1);
+		lua_pushvalue(L, -1);
+		lua_pushnil(L);
+		lua_rawset(L, idx);
+	}
+	lua_pushnil(L);
+	lua_setmetatable(L, idx);
+}
+
+static int lua_poolnew(lua_State* L)
+{
+	auto arraySize = luaL_optinteger(L, 1, 0);
+	auto hashSize = luaL_optinteger(L, 2, 0);
+	auto maxFree = luaL_optinteger(L, 3, 1024);
+	luaL_argcheck(L, arraySize >= 0 && arraySize <= INT_MAX, 1, "array size out of range");
+	luaL_argcheck(L, hashSize >= 0 && hashSize <= INT_MAX, 2, "hash size out of range");
+	luaL_argcheck(L, maxFree >= 0, 3, "max free must not be negative");
+	lua_newobject<TablePool>(L, (int)arraySize, (int)hashSize, maxFree);
+	lua_newtable(L);
+	lua_setuservalue(L, -2);
+	return 1;
+}
+
+static int lua_poolacquire(lua_State* L)
+{
+	auto pool = lua_checkobject<TablePool>(L, 1);
+	if (pool->Free == 0)
+	{
+		pool->Created++;
+		lua_createtable(L, pool->ArraySize, pool->HashSize);
+		return 1;
+	}
+	pool->Reused++;
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, pool->Free);
+	lua_pushnil(L);
+	lua_rawseti(L, -3, pool->Free--);
+	lua_pushvalue(L, -1);
+	lua_pushnil(L);
+	lua_rawset(L, -4);
+	return 1;
+}
+
+// Wipes the table at idx and stores it in the free list at free, unless the pool is full.
+static void lua_poolput(lua_State* L, TablePool* pool, int free, int idx)
+{
+	lua_pushvalue(L, idx);
+	if (lua_rawget(L, free) != LUA_TNIL)
+		luaL_error(L, "table was already released");
+	lua_pop(L, 1);
+	lua_cleartable(L, idx);
+	if (pool->Free >= pool->MaxFree)
+		return;
+	lua_pushvalue(L, idx);
+	lua_rawseti(L, free, ++pool->Free);
+	lua_pushvalue(L, idx);
+	lua_pushboolean(L, true);
+	lua_rawset(L, free);
+}
+
+static int lua_poolrelease(lua_State* L)
+{
+	auto pool = lua_checkobject<TablePool>(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 2);
+	lua_getuservalue(L, 1);
+	lua_poolput(L, pool, 3, 2);
+	return 0;
+}
+
+static int lua_poolreleaseall(lua_State* L)
+{
+	auto pool = lua_checkobject<TablePool>(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_settop(L, 2);
+	lua_getuservalue(L, 1);
+	auto count = lua_rawlen(L, 2);
+	for (size_t i = 1; i <= count; i++)
+	{
+		if (lua_rawgeti(L, 2, i) != LUA_TTABLE)
+			return luaL_error(L, "element %d is not a table", (int)i);
+		lua_poolput(L, pool, 3, 4);
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+static int lua_poolstats(lua_State* L)
+{
+	auto pool = lua_checkobject<TablePool>(L, 1);
+	lua_pushinteger(L, pool->Free);
+	lua_pushinteger(L, pool->Created);
+	lua_pushinteger(L, pool->Reused);
+	return 3;
+}
+
+static int lua_poolclear(lua_State* L)
+{
+	auto pool = lua_checkobject<TablePool>(L, 1);
+	pool->Free = 0;
+	lua_newtable(L);
+	lua_setuservalue(L, 1);
+	return 0;
+}
+#pragma endregion
+
+#pragma region EntityStore
+enum class FieldType : uint8_t
+{
+	Number,
+	Int,
+	Bool,
+	String
+};
+
+// One field of a component, packed in entity order of the component's dense array.
+struct ComponentColumn
+{
+	FieldType Type;
+	size_t Stride;
+	std::vector<uint8_t> Data;
+
+	ComponentColumn(FieldType type) : Type(type)
+	{
+		switch (type)
+		{
+		case FieldType::Number: Stride = sizeof(double); break;
+		case FieldType::Int: Stride = sizeof(int64_t); break;
+		case FieldType::Bool: Stride = sizeof(uint8_t); break;
+		default: Stride = sizeof(int32_t); break;
+		}
+	}
+
+	uint8_t* At(size_t index)
+	{
+		return &Data[index * Stride];
+	}
+};
+
+// Sparse set: Sparse maps an entity to its position in Dense, and every column is kept in the same order as Dense.
+struct Component
+{
+	std::vector<int32_t> Sparse;
+	std::vector<int32_t> Dense;
+	std::vector<ComponentColumn> Columns;
+	std::unordered_map<std::string, int> Fields;
+
+	int32_t IndexOf(int32_t entity) const
+	{
+		return (size_t)entity < Sparse.size() ? Sparse[entity] : -1;
+	}
+
+	int32_t Add(int32_t entity)
+	{
+		auto index = IndexOf(entity);
+		if (index != -1)
+			return index;
+		if ((size_t)entity >= Sparse.size())
+			Sparse.resize(entity + 1, -1);
+		index = (int32_t)Dense.size();
+		Sparse[entity] = index;
+		Dense.push_back(entity);
+		for (auto& column : Columns)
+			column.Data.resize(column.Data.size() + column.Stride, 0);
+		return index;
+	}
+
+	// Swaps the last entity into the removed one's place.
+	bool Remove(int32_t entity)
+	{
+		auto index = IndexOf(entity);
+		if (index == -1)
+			return false;
+		auto last = (int32_t)Dense.size() - 1;
+		if (index != last)
+		{
+			Dense[index] = Dense[last];
+			Sparse[Dense[index]] = index;
+			for (auto& column : Columns)
+				memcpy(column.At(index), column.At(last), column.Stride);
+		}
+		Dense.pop_back();
+		for (auto& column : Columns)
+			column.Data.resize(column.Data.size() - column.Stride);
+		Sparse[entity] = -1;
+		return true;
+	}
+};
+
+struct ComponentStore
+{
+	static constexpr const char* MetaName = "ProddyUtils.EntityStore";
+
+	std::vector<Component> Components;
+	std::unordered_map<std::string, int> ComponentIndex;
+	// Indexed by entity index. IDs given to Lua are Generation << 32 | index, and the generation is bumped
+	// on Destroy, so IDs kept from before don't refer to whichever entity reuses the index.
+	std::vector<uint8_t> Alive;
+	std::vector<uint32_t> Generations;
+	std::vector<int32_t> FreeEntities;
+	size_t Count = 0;
+
+	// String fields hold IDs into this table. ID 0 is the empty string.
+	std::vector<std::string> Strings = { "" };
+	std::unordered_map<std::string, int32_t> StringIds = { { "", 0 } };
+
+	int32_t Intern(const char* str, size_t len)
+	{
+		auto it = StringIds.emplace(std::string(str, len), (int32_t)Strings.size());
+		if (it.second)
+			Strings.push_back(it.first->first);
+		return it.first->second;
+	}
+
+	int32_t Create()
+	{
+		int32_t entity;
+		if (!FreeEntities.empty())
+		{
+			entity = FreeEntities.back();
+			FreeEntities.pop_back();
+		}
+		else
+		{
+			entity = (int32_t)Alive.size();
+			Alive.push_back(0);
+			Generations.push_back(0);
+		}
+		Alive[entity] = 1;
+		Count++;
+		return entity;
+	}
+
+	lua_Integer Id(int32_t entity) const
+	{
+		return (lua_Integer)Generations[entity] << 32 | entity;
+	}
+
+	// Index of the entity with this ID, or -1 if it has been destroyed.
+	int32_t Find(lua_Integer id) const
+	{
+		auto entity = (size_t)(id & 0xFFFFFFFF);
+		if (id < 0 || entity >= Alive.size() || !Alive[entity] || id >> 32 != Generations[entity])
+			return -1;
+		return (int32_t)entity;
+	}
+
+	void Destroy(int32_t entity)
+	{
+		for (auto& component : Components)
+			component.Remove(entity);
+		Alive[entity] = 0;
+		Generations[entity] = (Generations[entity] + 1) & 0x7FFFFFFF;
+		FreeEntities.push_back(entity);
+		Count--;
+	}
+};
+
+// Iteration state for ComponentStore:Query. Walks the smallest component's dense array from the back,
+// so removing the current entity only moves an already visited one into its place.
+struct EntityQuery
+{
+	static constexpr const char* MetaName = "ProddyUtils.EntityQuery";
+
+	std::vector<int> Components;
+	int Driver;
+	size_t Position;
+};
+
+static FieldType lua_checkfieldtype(lua_State* L, int idx)
+{
+	static const char* const Names[] = { "number", "int", "bool", "string", NULL };
+	return (FieldType)luaL_checkoption(L, idx, NULL, Names);
+}
+
+static Component* lua_checkcomponent(lua_State* L, ComponentStore* store, int idx, int* index = nullptr)
+{
+	auto name = luaL_checkstring(L, idx);
+	auto it = store->ComponentIndex.find(name);
+	if (it == store->ComponentIndex.end())
+		luaL_error(L, "no component named '%s'", name);
+	if (index)
+		*index = it->second;
+	return &store->Components[it->second];
+}
+
+static ComponentColumn* lua_checkcolumn(lua_State* L, Component* component, int idx)
+{
+	auto name = luaL_checkstring(L, idx);
+	auto it = component->Fields.find(name);
+	if (it == component->Fields.end())
+		luaL_error(L, "no field named '%s'", name);
+	return &component->Columns[it->second];
+}
+
+static int32_t lua_checkentity(lua_State* L, ComponentStore* store, int idx)
+{
+	auto entity = store->Find(luaL_checkinteger(L, idx));
+	luaL_argcheck(L, entity != -1, idx, "entity doesn't exist");
+	return entity;
+}
+
+static void lua_pushcolumnvalue(lua_State* L, ComponentStore* store, ComponentColumn* column, size_t index)
+{
+	auto data = column->At(index);
+	switch (column->Type)
+	{
+	case FieldType::Number:
+	{
+		double value;
+		memcpy(&value, data, sizeof(value));
+		lua_pushnumber(L, value);
+		break;
+	}
+	case FieldType::Int:
+	{
+		int64_t value;
+		memcpy(&value, data, sizeof(value));
+		lua_pushinteger(L, value);
+		break;
+	}
+	case FieldType::Bool:
+		lua_pushboolean(L, *data);
+		break;
+	case FieldType::String:
+	{
+		int32_t id;
+		memcpy(&id, data, sizeof(id));
+		lua_pushlstring(L, store->Strings[id]);
+		break;
+	}
+	}
+}
+
+static void lua_tocolumnvalue(lua_State* L, ComponentStore* store, ComponentColumn* column, size_t index, int idx)
+{
+	auto data = column->At(index);
+	switch (column->Type)
+	{
+	case FieldType::Number:
+	{
+		double value = luaL_checknumber(L, idx);
+		memcpy(data, &value, sizeof(value));
+		break;
+	}
+	case FieldType::Int:
+	{
+		int64_t value = luaL_checkinteger(L, idx);
+		memcpy(data, &value, sizeof(value));
+		break;
+	}
+	case FieldType::Bool:
+		*data = lua_toboolean(L, idx) ? 1 : 0;
+		break;
+	case FieldType::String:
+	{
+		size_t len;
+		auto str = luaL_checklstring(L, idx, &len);
+		auto id = store->Intern(str, len);
+		memcpy(data, &id, sizeof(id));
+		break;
+	}
+	}
+}
+
+static int lua_entitystorenew(lua_State* L)
+{
+	lua_newobject<ComponentStore>(L);
+	return 1;
+}
+
+static int lua_entitystoredefine(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	auto name = luaL_checkstring(L, 2);
+	luaL_checktype(L, 3, LUA_TTABLE);
+	luaL_argcheck(L, store->ComponentIndex.count(name) == 0, 2, "component already defined");
+
+	Component component;
+	lua_pushnil(L);
+	while (lua_next(L, 3) != 0)
+	{
+		if (lua_type(L, -2) != LUA_TSTRING)
+			return luaL_error(L, "field names must be strings");
+		auto type = lua_checkfieldtype(L, -1);
+		component.Fields.emplace(lua_tostring(L, -2), (int)component.Columns.size());
+		component.Columns.emplace_back(type);
+		lua_pop(L, 1);
+	}
+	store->ComponentIndex.emplace(name, (int)store->Components.size());
+	store->Components.push_back(std::move(component));
+	return 0;
+}
+
+static int lua_entitystorecreate(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	luaL_argcheck(L, store->Alive.size() < INT32_MAX || !store->FreeEntities.empty(), 1, "too many entities");
+	lua_pushinteger(L, store->Id(store->Create()));
+	return 1;
+}
+
+static int lua_entitystoredestroy(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	auto entity = store->Find(luaL_checkinteger(L, 2));
+	if (entity != -1)
+		store->Destroy(entity);
+	return 0;
+}
+
+static int lua_entitystorealive(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	lua_pushboolean(L, store->Find(luaL_checkinteger(L, 2)) != -1);
+	return 1;
+}
+
+static int lua_entitystoresize(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	lua_pushinteger(L, store->Count);
+	return 1;
+}
+
+static int lua_entitystoreadd(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	auto entity = lua_checkentity(L, store, 2);
+	auto component = lua_checkcomponent(L, store, 3);
+	auto index = component->Add(entity);
+	if (lua_isnoneornil(L, 4))
+		return 0;
+	luaL_checktype(L, 4, LUA_TTABLE);
+	lua_pushnil(L);
+	while (lua_next(L, 4) != 0)
+	{
+		if (lua_type(L, -2) != LUA_TSTRING)
+			return luaL_error(L, "field names must be strings");
+		lua_pushvalue(L, -2);
+		auto column = lua_checkcolumn(L, component, -1);
+		lua_pop(L, 1);
+		lua_tocolumnvalue(L, store, column, index, -1);
+		lua_pop(L, 1);
+	}
+	return 0;
+}
+
+static int lua_entitystoreremove(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	auto entity = store->Find(luaL_checkinteger(L, 2));
+	auto component = lua_checkcomponent(L, store, 3);
+	lua_pushboolean(L, entity != -1 && component->Remove(entity));
+	return 1;
+}
+
+static int lua_entitystorehas(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	auto entity = store->Find(luaL_checkinteger(L, 2));
+	auto component = lua_checkcomponent(L, store, 3);
+	lua_pushboolean(L, entity != -1 && component->IndexOf(entity) != -1);
+	return 1;
+}
+
+static int lua_entitystoreget(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	auto entity = store->Find(luaL_checkinteger(L, 2));
+	auto component = lua_checkcomponent(L, store, 3);
+	auto column = lua_checkcolumn(L, component, 4);
+	auto index = entity != -1 ? component->IndexOf(entity) : -1;
+	if (index == -1)
+		lua_pushnil(L);
+	else
+		lua_pushcolumnvalue(L, store, column, index);
+	return 1;
+}
+
+static int lua_entitystoreset(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	auto entity = lua_checkentity(L, store, 2);
+	auto component = lua_checkcomponent(L, store, 3);
+	auto column = lua_checkcolumn(L, component, 4);
+	auto index = component->IndexOf(entity);
+	luaL_argcheck(L, index != -1, 3, "entity doesn't have this component");
+	lua_tocolumnvalue(L, store, column, index, 5);
+	return 0;
+}
+
+static int lua_entitystorecount(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	lua_pushinteger(L, lua_checkcomponent(L, store, 2)->Dense.size());
+	return 1;
+}
+
+static int lua_entityqueryiter(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, lua_upvalueindex(1));
+	auto query = lua_checkobject<EntityQuery>(L, lua_upvalueindex(2));
+	auto& dense = store->Components[query->Driver].Dense;
+	query->Position = std::min(query->Position, dense.size());
+	while (query->Position > 0)
+	{
+		auto entity = dense[--query->Position];
+		bool bMatch = true;
+		for (auto c : query->Components)
+		{
+			if (store->Components[c].IndexOf(entity) == -1)
+			{
+				bMatch = false;
+				break;
+			}
+		}
+		if (bMatch)
+		{
+			lua_pushinteger(L, store->Id(entity));
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int lua_entitystorequery(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	auto top = lua_gettop(L);
+	luaL_argcheck(L, top >= 2, 2, "expected at least one component");
+	std::vector<int> components;
+	for (int i = 2; i <= top; i++)
+	{
+		int index;
+		lua_checkcomponent(L, store, i, &index);
+		components.push_back(index);
+	}
+	// The component with the fewest entities drives the iteration, the rest are membership checks.
+	auto driver = *std::min_element(components.begin(), components.end(), [store](int a, int b) {
+		return store->Components[a].Dense.size() < store->Components[b].Dense.size();
+	});
+	components.erase(std::remove(components.begin(), components.end(), driver), components.end());
+
+	lua_pushvalue(L, 1);
+	auto query = lua_newobject<EntityQuery>(L);
+	query->Components = std::move(components);
+	query->Driver = driver;
+	query->Position = store->Components[driver].Dense.size();
+	lua_pushcclosure(L, lua_entityqueryiter, 2);
+	return 1;
+}
+
+// Copies one field of every entity with the component into out, with the entity IDs in a second table.
+static int lua_entitystorecolumn(lua_State* L)
+{
+	auto store = lua_checkobject<ComponentStore>(L, 1);
+	auto component = lua_checkcomponent(L, store, 2);
+	auto column = lua_checkcolumn(L, component, 3);
+	auto size = component->Dense.size();
+	size_t old = 0;
+	if (lua_isnoneornil(L, 4))
+		lua_createtable(L, (int)size, 0);
+	else
+	{
+		luaL_checktype(L, 4, LUA_TTABLE);
+		old = lua_rawlen(L, 4);
+		lua_pushvalue(L, 4);
+	}
+	for (size_t i = 0; i < size; i++)
+	{
+		lua_pushcolumnvalue(L, store, column, i);
+		lua_rawseti(L, -2, i + 1);
+	}
+	for (auto i = size + 1; i <= old; i++)
+	{
+		lua_pushnil(L);
+		lua_rawseti(L, -2, i);
+	}
+	std::vector<lua_Integer> ids(size);
+	for (size_t i = 0; i < size; i++)
+		ids[i] = store->Id(component->Dense[i]);
+	lua_pushintegers(L, 5, ids);
+	return 2;
+}
+#pragma endregion
+
+#pragma region JSON
+// Bit masks for one 64-byte block of input, bit i for byte i.
+struct JSONBlock
+{
+	uint64_t Backslash = 0;
+	uint64_t Quote = 0;
+	uint64_t Whitespace = 0;
+	uint64_t Op = 0;
+};
+
+inline bool IsJSONWhitespace(uint8_t c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline bool IsJSONOp(uint8_t c)
+{
+	return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+}
+
+static void JSONClassifyScalar(const uint8_t* data, JSONBlock& block)
+{
+	for (int i = 0; i < 64; i++)
+	{
+		auto c = data[i];
+		auto bit = 1ULL << i;
+		if (c == '\\')
+			block.Backslash |= bit;
+		else if (c == '"')
+			block.Quote |= bit;
+		else if (IsJSONWhitespace(c))
+			block.Whitespace |= bit;
+		else if (IsJSONOp(c))
+			block.Op |= bit;
+	}
+}
+
+static void JSONClassifyAVX2(const uint8_t* data, JSONBlock& block)
+{
+	for (int half = 0; half < 2; half++)
+	{
+		auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + half * 32));
+		auto eq = [v](char c) {
+			return (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+		};
+		// '[' and ']' are '{' and '}' without bit 5, so one compare on v | 0x20 finds both.
+		auto brackets = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('{')))
+			| (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('}')));
+		auto shift = half * 32;
+		block.Backslash |= eq('\\') << shift;
+		block.Quote |= eq('"') << shift;
+		block.Whitespace |= (eq(' ') | eq('\t') | eq('\n') | eq('\r')) << shift;
+		block.Op |= (brackets | eq(':') | eq(',')) << shift;
+	}
+}
+
+// Stage one of decoding, after simdjson: finds every structural character and the first byte of every
+// scalar outside of strings, 64 bytes at a time. A sentinel index at len is appended. Returns false on an unterminated string.
+static bool JSONIndex(const char* json, size_t len, std::vector<uint32_t>& indexes)
+{
+	const uint64_t EvenBits = 0x5555555555555555ULL;
+	uint64_t prevEscaped = 0;
+	uint64_t prevInString = 0;
+	uint64_t prevScalar = 0;
+	size_t count = 0;
+	indexes.resize(len / 8 + 64);
+
+	for (size_t base = 0; base < len; base += 64)
+	{
+		// The last partial block is padded with spaces.
+		alignas(32) uint8_t padded[64];
+		auto data = reinterpret_cast<const uint8_t*>(json + base);
+		if (len - base < 64)
+		{
+			memset(padded, ' ', sizeof(padded));
+			memcpy(padded, data, len - base);
+			data = padded;
+		}
+		JSONBlock block;
+		if (CPU.AVX2)
+			JSONClassifyAVX2(data, block);
+		else
+			JSONClassifyScalar(data, block);
+
+		// A character is escaped if it follows an odd length run of backslashes.
+		auto backslash = block.Backslash & ~prevEscaped;
+		auto followsEscape = backslash << 1 | prevEscaped;
+		auto oddStarts = backslash & ~EvenBits & ~followsEscape;
+		auto evenStarts = oddStarts + backslash;
+		prevEscaped = evenStarts < oddStarts ? 1 : 0;
+		auto escaped = (EvenBits ^ (evenStarts << 1)) & followsEscape;
+
+		// Prefix XOR of the unescaped quotes marks everything from an opening quote up to its closing quote.
+		auto quote = block.Quote & ~escaped;
+		auto inString = quote;
+		inString ^= inString << 1;
+		inString ^= inString << 2;
+		inString ^= inString << 4;
+		inString ^= inString << 8;
+		inString ^= inString << 16;
+		inString ^= inString << 32;
+		inString ^= prevInString;
+		prevInString = (uint64_t)((int64_t)inString >> 63);
+
+		// Scalars start at any byte that isn't whitespace or an op and doesn't follow another such byte.
+		// Opening quotes count as scalar starts, everything else inside a string including the closing quote is dropped.
+		auto scalar = ~(block.Op | block.Whitespace);
+		auto nonQuoteScalar = scalar & ~quote;
+		auto followsScalar = nonQuoteScalar << 1 | prevScalar;
+		prevScalar = nonQuoteScalar >> 63;
+		auto structural = (block.Op | (scalar & ~followsScalar)) & ~(inString ^ quote);
+		if (len - base < 64)
+			structural &= (1ULL << (len - base)) - 1;
+
+		if (indexes.size() < count + 64)
+			indexes.resize(indexes.size() * 2 + 64);
+		while (structural != 0)
+		{
+			unsigned long bit;
+			_BitScanForward64(&bit, structural);
+			indexes[count++] = (uint32_t)(base + bit);
+			structural &= structural - 1;
+		}
+	}
+	if (CPU.AVX2)
+		_mm256_zeroupper();
+
+	indexes.resize(count);
+	indexes.push_back((uint32_t)len);
+	return prevInString == 0;
+}
+
+// Stage two: walks the structural indexes and builds Lua values directly.
+struct JSONDecoder
+{
+	lua_State* L;
+	const char* JSON;
+	size_t Length;
+	std::vector<uint32_t> Indexes;
+	// Element counts of every container in the order they open, so tables are created at their final size.
+	std::vector<uint32_t> Sizes;
+	size_t Pos = 0;
+	size_t Container = 0;
+	bool bIntegers = true;
+	int Null = 0;
+	int MaxDepth = 256;
+	std::string Scratch;
+	const char* Error = nullptr;
+	size_t ErrorPos = 0;
+
+	bool Fail(const char* error, size_t pos)
+	{
+		Error = error;
+		ErrorPos = pos;
+		return false;
+	}
+
+	void CountSizes()
+	{
+		struct Open
+		{
+			size_t Container;
+			size_t Pos;
+			uint32_t Commas;
+		};
+		std::vector<Open> stack;
+		for (size_t i = 0; i + 1 < Indexes.size(); i++)
+		{
+			auto c = JSON[Indexes[i]];
+			if (c == '{' || c == '[')
+			{
+				stack.push_back({ Sizes.size(), i, 0 });
+				Sizes.push_back(0);
+			}
+			else if ((c == '}' || c == ']') && !stack.empty())
+			{
+				auto& open = stack.back();
+				Sizes[open.Container] = open.Pos + 1 == i ? 0 : open.Commas + 1;
+				stack.pop_back();
+			}
+			else if (c == ',' && !stack.empty())
+				stack.back().Commas++;
+		}
+	}
+
+	bool IsDelimiter(size_t pos) const
+	{
+		if (pos >= Length)
+			return true;
+		auto c = (uint8_t)JSON[pos];
+		return IsJSONWhitespace(c) || IsJSONOp(c);
+	}
+
+	bool Literal(size_t pos, const char* text, size_t len)
+	{
+		if (Length - pos < len || memcmp(JSON + pos, text, len) != 0 || !IsDelimiter(pos + len))
+			return Fail("invalid literal", pos);
+		return true;
+	}
+
+	static void AppendUTF8(std::string& out, uint32_t cp)
+	{
+		if (cp < 0x80)
+			out += (char)cp;
+		else if (cp < 0x800)
+		{
+			out += (char)(0xC0 | (cp >> 6));
+			out += (char)(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000)
+		{
+			out += (char)(0xE0 | (cp >> 12));
+			out += (char)(0x80 | ((cp >> 6) & 0x3F));
+			out += (char)(0x80 | (cp & 0x3F));
+		}
+		else
+		{
+			out += (char)(0xF0 | (cp >> 18));
+			out += (char)(0x80 | ((cp >> 12) & 0x3F));
+			out += (char)(0x80 | ((cp >> 6) & 0x3F));
+			out += (char)(0x80 | (cp & 0x3F));
+		}
+	}
+
+	bool Hex4(size_t pos, uint32_t& value) const
+	{
+		if (Length - pos < 4)
+			return false;
+		value = 0;
+		for (size_t i = pos; i < pos + 4; i++)
+		{
+			auto c = JSON[i];
+			value <<= 4;
+			if (c >= '0' && c <= '9')
+				value |= c - '0';
+			else if (c >= 'a' && c <= 'f')
+				value |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				value |= c - 'A' + 10;
+			else
+				return false;
+		}
+		return true;
+	}
+
+	// pos is the opening quote. Strings without escapes are pushed straight from the input.
+	bool String(size_t pos)
+	{
+		auto start = pos + 1;
+		auto p = start;
+		auto quote = _mm_set1_epi8('"');
+		auto backslash = _mm_set1_epi8('\\');
+		while (p + 16 <= Length)
+		{
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(JSON + p));
+			auto mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+			if (mask != 0)
+			{
+				unsigned long bit;
+				_BitScanForward(&bit, mask);
+				p += bit;
+				break;
+			}
+			p += 16;
+		}
+		while (p < Length && JSON[p] != '"' && JSON[p] != '\\')
+			p++;
+		if (p >= Length)
+			return Fail("unterminated string", pos);
+		if (JSON[p] == '"')
+		{
+			lua_pushlstring(L, JSON + start, p - start);
+			return true;
+		}
+
+		Scratch.assign(JSON + start, p - start);
+		if (!Unescape(pos, p, Scratch))
+			return false;
+		lua_pushlstring(L, Scratch);
+		return true;
+	}
+
+	// Appends the string whose opening quote is at pos to out from p up to its closing quote, decoding escapes.
+	bool Unescape(size_t pos, size_t p, std::string& out)
+	{
+		while (true)
+		{
+			if (p >= Length)
+				return Fail("unterminated string", pos);
+			auto c = JSON[p];
+			if (c == '"')
+				break;
+			if (c != '\\')
+			{
+				out += c;
+				p++;
+				continue;
+			}
+			if (++p >= Length)
+				return Fail("unterminated string", pos);
+			switch (JSON[p++])
+			{
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u':
+			{
+				uint32_t cp;
+				if (!Hex4(p, cp))
+					return Fail("invalid unicode escape", p - 2);
+				p += 4;
+				// A high surrogate must be followed by an escaped low surrogate. Unpaired surrogates become U+FFFD.
+				if (cp >= 0xD800 && cp <= 0xDBFF)
+				{
+					uint32_t low;
+					if (Length - p >= 6 && JSON[p] == '\\' && JSON[p + 1] == 'u' && Hex4(p + 2, low) && low >= 0xDC00 && low <= 0xDFFF)
+					{
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+						p += 6;
+					}
+					else
+						cp = 0xFFFD;
+				}
+				else if (cp >= 0xDC00 && cp <= 0xDFFF)
+					cp = 0xFFFD;
+				AppendUTF8(out, cp);
+				break;
+			}
+			default:
+				return Fail("invalid escape", p - 2);
+			}
+		}
+		return true;
+	}
+
+	bool Number(size_t pos)
+	{
+		auto p = pos;
+		bool bNegative = JSON[p] == '-';
+		if (bNegative)
+			p++;
+		auto digits = p;
+		if (p < Length && JSON[p] == '0')
+			p++;
+		else if (p < Length && JSON[p] >= '1' && JSON[p] <= '9')
+		{
+			while (p < Length && JSON[p] >= '0' && JSON[p] <= '9')
+				p++;
+		}
+		else
+			return Fail("invalid number", pos);
+		auto intDigits = p - digits;
+		bool bFloat = false;
+		if (p < Length && JSON[p] == '.')
+		{
+			bFloat = true;
+			auto frac = ++p;
+			while (p < Length && JSON[p] >= '0' && JSON[p] <= '9')
+				p++;
+			if (p == frac)
+				return Fail("invalid number", pos);
+		}
+		if (p < Length && (JSON[p] == 'e' || JSON[p] == 'E'))
+		{
+			bFloat = true;
+			p++;
+			if (p < Length && (JSON[p] == '+' || JSON[p] == '-'))
+				p++;
+			auto exp = p;
+			while (p < Length && JSON[p] >= '0' && JSON[p] <= '9')
+				p++;
+			if (p == exp)
+				return Fail("invalid number", pos);
+		}
+		if (!IsDelimiter(p))
+			return Fail("invalid number", pos);
+
+		// Up to 18 digits always fit in an int64. Longer integers go through the double path.
+		if (!bFloat && intDigits <= 18)
+		{
+			int64_t value = 0;
+			for (auto i = digits; i < p; i++)
+				value = value * 10 + (JSON[i] - '0');
+			if (bNegative)
+				value = -value;
+			if (bIntegers)
+				lua_pushinteger(L, value);
+			else
+				lua_pushnumber(L, (lua_Number)value);
+			return true;
+		}
+		double value;
+		std::from_chars(JSON + pos, JSON + p, value);
+		if (!bFloat && bIntegers && intDigits == 19)
+		{
+			// Exact conversion for 19 digit integers that still fit.
+			uint64_t magnitude = 0;
+			bool bOverflow = false;
+			for (auto i = digits; i < p && !bOverflow; i++)
+			{
+				auto digit = (uint64_t)(JSON[i] - '0');
+				bOverflow = magnitude > (UINT64_MAX - digit) / 10;
+				magnitude = magnitude * 10 + digit;
+			}
+			if (!bOverflow && magnitude <= (bNegative ? 9223372036854775808ULL : 9223372036854775807ULL))
+			{
+				lua_pushinteger(L, bNegative ? (lua_Integer)(0 - magnitude) : (lua_Integer)magnitude);
+				return true;
+			}
+		}
+		lua_pushnumber(L, value);
+		return true;
+	}
+
+	char Next(size_t& pos)
+	{
+		pos = Indexes[Pos];
+		if (Pos + 1 < Indexes.size())
+			Pos++;
+		return JSON[pos];
+	}
+
+	void PushNull()
+	{
+		if (Null != 0)
+			lua_pushvalue(L, Null);
+		else
+			lua_pushnil(L);
+	}
+
+	bool Value(int depth)
+	{
+		size_t pos;
+		auto c = Next(pos);
+		if (pos >= Length)
+			return Fail("unexpected end of input", pos);
+		switch (c)
+		{
+		case '{':
+		{
+			if (depth >= MaxDepth || !lua_checkstack(L, 4))
+				return Fail("nested too deeply", pos);
+			lua_createtable(L, 0, (int)Sizes[Container++]);
+			if (JSON[Indexes[Pos]] == '}')
+			{
+				Pos++;
+				return true;
+			}
+			while (true)
+			{
+				if (Next(pos) != '"')
+					return Fail("expected a string key", pos);
+				if (!String(pos))
+					return false;
+				if (Next(pos) != ':')
+					return Fail("expected ':'", pos);
+				if (!Value(depth + 1))
+					return false;
+				lua_rawset(L, -3);
+				c = Next(pos);
+				if (c == '}')
+					return true;
+				if (c != ',')
+					return Fail("expected ',' or '}'", pos);
+			}
+		}
+		case '[':
+		{
+			if (depth >= MaxDepth || !lua_checkstack(L, 4))
+				return Fail("nested too deeply", pos);
+			lua_createtable(L, (int)Sizes[Container++], 0);
+			if (JSON[Indexes[Pos]] == ']')
+			{
+				Pos++;
+				return true;
+			}
+			for (lua_Integer i = 1;; i++)
+			{
+				if (!Value(depth + 1))
+					return false;
+				lua_rawseti(L, -2, i);
+				c = Next(pos);
+				if (c == ']')
+					return true;
+				if (c != ',')
+					return Fail("expected ',' or ']'", pos);
+			}
+		}
+		case '"':
+			return String(pos);
+		case 't':
+			if (!Literal(pos, "true", 4))
+				return false;
+			lua_pushboolean(L, true);
+			return true;
+		case 'f':
+			if (!Literal(pos, "false", 5))
+				return false;
+			lua_pushboolean(L, false);
+			return true;
+		case 'n':
+			if (!Literal(pos, "null", 4))
+				return false;
+			PushNull();
+			return true;
+		default:
+			if (c == '-' || (c >= '0' && c <= '9'))
+				return Number(pos);
+			return Fail("unexpected character", pos);
+		}
+	}
+
+	// Decodes a whole document and pushes its value. The decoder can be reused for the next one.
+	bool Decode(const char* json, size_t len)
+	{
+		JSON = json;
+		Length = len;
+		Pos = 0;
+		Container = 0;
+		Sizes.clear();
+		if (!JSONIndex(json, len, Indexes))
+			return Fail("unterminated string", len);
+		CountSizes();
+		if (!Value(0))
+			return false;
+		size_t pos;
+		if (Next(pos), pos < len)
+			return Fail("unexpected data after value", pos);
+		return true;
+	}
+};
+
+static void lua_jsondecodeoptions(lua_State* L, int idx, JSONDecoder& decoder)
+{
+	lua_getfield(L, idx, "Integers");
+	decoder.bIntegers = lua_isnil(L, -1) || lua_toboolean(L, -1);
+	lua_getfield(L, idx, "MaxDepth");
+	decoder.MaxDepth = (int)luaL_optinteger(L, -1, decoder.MaxDepth);
+	lua_pop(L, 2);
+}
+
+static int lua_jsondecode(lua_State* L)
+{
+	size_t len;
+	auto json = luaL_checklstring(L, 1, &len);
+	luaL_argcheck(L, len < UINT32_MAX, 1, "input too large");
+	lua_settop(L, 2);
+	JSONDecoder decoder;
+	decoder.L = L;
+	if (!lua_isnil(L, 2))
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+		lua_jsondecodeoptions(L, 2, decoder);
+		lua_getfield(L, 2, "Null");
+		if (!lua_isnil(L, -1))
+			decoder.Null = lua_gettop(L);
+	}
+
+	auto base = lua_gettop(L);
+	if (!decoder.Decode(json, len))
+	{
+		lua_settop(L, base);
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s at byte %d", decoder.Error, (int)decoder.ErrorPos + 1);
+		return 2;
+	}
+	return 1;
+}
+
+struct JSONEncoder
+{
+	lua_State* L;
+	std::string& Out;
+	std::string Indent;
+	bool bPretty = false;
+	bool bSortKeys = false;
+	int Null = 0;
+	int MaxDepth = 256;
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	std::unordered_set<const void*> Path;
+	std::string Error;
+
+	JSONEncoder(lua_State* L, std::string& out) : L(L), Out(out)
+	{
+	}
+
+	bool Fail(const char* error)
+	{
+		if (Error.empty())
+			Error = error;
+		return false;
+	}
+
+	// When writing to a file, the buffer is written out whenever it passes 1 MB.
+	bool Flush(bool bFinal)
+	{
+		if (hFile == INVALID_HANDLE_VALUE || (!bFinal && Out.size() < 1024 * 1024))
+			return true;
+		DWORD written;
+		if (!Out.empty() && (!WriteFile(hFile, Out.data(), (DWORD)Out.size(), &written, nullptr) || written != Out.size()))
+			return Fail("couldn't write to file");
+		Out.clear();
+		return true;
+	}
+
+	void NewLine(int depth)
+	{
+		if (!bPretty)
+			return;
+		Out += '\n';
+		for (int i = 0; i < depth; i++)
+			Out += Indent;
+	}
+
+	void String(const char* str, size_t len)
+	{
+		static const char Hex[] = "0123456789abcdef";
+		Out += '"';
+		size_t i = 0;
+		while (i < len)
+		{
+			// Copy runs that need no escaping 16 bytes at a time.
+			auto start = i;
+			while (i + 16 <= len)
+			{
+				auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i));
+				auto special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+					_mm_cmplt_epi8(_mm_xor_si128(v, _mm_set1_epi8(-128)), _mm_set1_epi8(-128 + 0x20)));
+				auto mask = (uint32_t)_mm_movemask_epi8(special);
+				if (mask != 0)
+				{
+					unsigned long bit;
+					_BitScanForward(&bit, mask);
+					i += bit;
+					break;
+				}
+				i += 16;
+			}
+			while (i < len && str[i] != '"' && str[i] != '\\' && (uint8_t)str[i] >= 0x20)
+				i++;
+			Out.append(str + start, i - start);
+			if (i == len)
+				break;
+			auto c = (uint8_t)str[i++];
+			switch (c)
+			{
+			case '"': Out += "\\\""; break;
+			case '\\': Out += "\\\\"; break;
+			case '\b': Out += "\\b"; break;
+			case '\f': Out += "\\f"; break;
+			case '\n': Out += "\\n"; break;
+			case '\r': Out += "\\r"; break;
+			case '\t': Out += "\\t"; break;
+			default:
+				Out += "\\u00";
+				Out += Hex[c >> 4];
+				Out += Hex[c & 15];
+				break;
+			}
+		}
+		Out += '"';
+	}
+
+	bool Number(int idx)
+	{
+		char buf[32];
+		if (lua_isinteger(L, idx))
+		{
+			auto result = std::to_chars(buf, buf + sizeof(buf), (int64_t)lua_tointeger(L, idx));
+			Out.append(buf, result.ptr);
+			return true;
+		}
+		auto value = lua_tonumber(L, idx);
+		if (!std::isfinite(value))
+			return Fail("can't encode NaN or infinity");
+		// Shortest representation that reads back to the same double. Whole floats keep a ".0" so they decode as floats again.
+		auto result = std::to_chars(buf, buf + sizeof(buf), value);
+		Out.append(buf, result.ptr);
+		if (std::find_if(buf, result.ptr, [](char c) { return c == '.' || c == 'e'; }) == result.ptr)
+			Out += ".0";
+		return true;
+	}
+
+	// Object keys must be strings or numbers. Numbers are written as strings.
+	bool Key(int idx)
+	{
+		size_t len;
+		if (lua_type(L, idx) == LUA_TSTRING)
+		{
+			auto str = lua_tolstring(L, idx, &len);
+			String(str, len);
+		}
+		else if (lua_type(L, idx) == LUA_TNUMBER)
+		{
+			Out += '"';
+			if (!Number(idx))
+				return false;
+			Out += '"';
+		}
+		else
+			return Fail("object keys must be strings or numbers");
+		Out += bPretty ? ": " : ":";
+		return true;
+	}
+
+	bool Table(int idx, int depth)
+	{
+		auto ptr = lua_topointer(L, idx);
+		if (depth >= MaxDepth || !lua_checkstack(L, 4))
+			return Fail("nested too deeply");
+		if (!Path.insert(ptr).second)
+			return Fail("circular reference");
+
+		size_t count;
+		auto bArray = lua_isarraytable(L, idx, count);
+		if (bArray)
+		{
+			Out += '[';
+			for (size_t i = 1; i <= count; i++)
+			{
+				if (i > 1)
+					Out += ',';
+				NewLine(depth + 1);
+				lua_rawgeti(L, idx, i);
+				auto bOK = Value(-1, depth + 1);
+				lua_pop(L, 1);
+				if (!bOK)
+					return false;
+			}
+		}
+		else
+		{
+			Out += '{';
+			bool bFirst = true;
+			auto entry = [&]() {
+				if (!bFirst)
+					Out += ',';
+				bFirst = false;
+				NewLine(depth + 1);
+				return Key(-2) && Value(-1, depth + 1);
+			};
+			if (bSortKeys)
+			{
+				// Sort by the key as written. Keys are converted on copies so lua_next isn't disturbed.
+				std::vector<std::pair<std::string, int>> keys;
+				auto keyTable = lua_gettop(L) + 1;
+				lua_newtable(L);
+				lua_pushnil(L);
+				while (lua_next(L, idx) != 0)
+				{
+					lua_pop(L, 1);
+					lua_pushvalue(L, -1);
+					size_t len;
+					auto str = lua_type(L, -1) == LUA_TNUMBER || lua_type(L, -1) == LUA_TSTRING ? lua_tolstring(L, -1, &len) : nullptr;
+					if (!str)
+						return Fail("object keys must be strings or numbers");
+					keys.emplace_back(std::string(str, len), (int)keys.size() + 1);
+					lua_pop(L, 1);
+					lua_pushvalue(L, -1);
+					lua_rawseti(L, keyTable, keys.size());
+				}
+				std::sort(keys.begin(), keys.end());
+				for (auto& key : keys)
+				{
+					lua_rawgeti(L, keyTable, key.second);
+					lua_pushvalue(L, -1);
+					lua_rawget(L, idx);
+					auto bOK = entry();
+					lua_pop(L, 2);
+					if (!bOK)
+						return false;
+				}
+				lua_pop(L, 1);
+			}
+			else
+			{
+				lua_pushnil(L);
+				while (lua_next(L, idx) != 0)
+				{
+					if (!entry())
+						return false;
+					lua_pop(L, 1);
+				}
+			}
+		}
+		if (count > 0)
+			NewLine(depth);
+		Out += bArray ? ']' : '}';
+		Path.erase(ptr);
+		return Flush(false);
+	}
+
+	bool Value(int idx, int depth)
+	{
+		idx = lua_absindex(L, idx);
+		if (Null != 0 && lua_rawequal(L, idx, Null))
+		{
+			Out += "null";
+			return true;
+		}
+		switch (lua_type(L, idx))
+		{
+		case LUA_TNIL:
+			Out += "null";
+			return true;
+		case LUA_TBOOLEAN:
+			Out += lua_toboolean(L, idx) ? "true" : "false";
+			return true;
+		case LUA_TNUMBER:
+			return Number(idx);
+		case LUA_TSTRING:
+		{
+			size_t len;
+			auto str = lua_tolstring(L, idx, &len);
+			String(str, len);
+			return true;
+		}
+		case LUA_TTABLE:
+			return Table(idx, depth);
+		case LUA_TLIGHTUSERDATA:
+			if (lua_touserdata(L, idx) == nullptr)
+			{
+				Out += "null";
+				return true;
+			}
+			break;
+		}
+		Error = std::string("can't encode a ") + luaL_typename(L, idx);
+		return false;
+	}
+};
+
+static int lua_jsonencode(lua_State* L)
+{
+	luaL_checkany(L, 1);
+	lua_settop(L, 2);
+	auto& buffer = lua_newscratchbuffer(L);
+	JSONEncoder encoder(L, buffer);
+	std::wstring path;
+	if (!lua_isnil(L, 2))
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+		lua_getfield(L, 2, "Pretty");
+		encoder.bPretty = lua_toboolean(L, -1) != 0;
+		lua_getfield(L, 2, "Indent");
+		encoder.Indent = luaL_optstring(L, -1, "\t");
+		lua_getfield(L, 2, "SortKeys");
+		encoder.bSortKeys = lua_toboolean(L, -1) != 0;
+		lua_getfield(L, 2, "MaxDepth");
+		encoder.MaxDepth = (int)luaL_optinteger(L, -1, encoder.MaxDepth);
+		lua_getfield(L, 2, "File");
+		if (!lua_isnil(L, -1))
+		{
+			size_t len;
+			auto text = luaL_checklstring(L, -1, &len);
+			path = UTF8ToUTF16(text, len);
+		}
+		lua_getfield(L, 2, "Null");
+		if (!lua_isnil(L, -1))
+			encoder.Null = lua_gettop(L);
+	}
+
+	if (!path.empty())
+	{
+		encoder.hFile = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (encoder.hFile == INVALID_HANDLE_VALUE)
+		{
+			lua_pushnil(L);
+			lua_pushstring(L, "couldn't open file");
+			return 2;
+		}
+	}
+	auto bOK = encoder.Value(1, 0) && encoder.Flush(true);
+	if (encoder.hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(encoder.hFile);
+	if (!bOK)
+	{
+		lua_pushnil(L);
+		lua_pushlstring(L, encoder.Error);
+		return 2;
+	}
+	if (!path.empty())
+		lua_pushboolean(L, true);
+	else
+		lua_pushscratchbuffer(L, buffer);
+	return 1;
+}
+
+// Splits a stream of JSON into complete values as bytes arrive, keeping only the unfinished value buffered.
+// Without a path every top level value is emitted, which covers NDJSON. With a path, the elements of the array found by following those keys are emitted one by one and everything else is skipped.
+struct JSONStream
+{
+	static constexpr const char* MetaName = "ProddyUtils.JSONStream";
+
+	struct Level
+	{
+		bool bObject;
+		bool bOnPath;
+		bool bKeyNext;
+		bool bKeyMatch;
+	};
+
+	std::string Buffer;
+	size_t Pos = 0;
+	size_t Start = std::string::npos;
+	size_t KeyStart = std::string::npos;
+	// Bytes already dropped from the front of Buffer, for error positions.
+	size_t Consumed = 0;
+	int Depth = 0;
+	int CaptureDepth = 0;
+	bool bString = false;
+	bool bEscape = false;
+	bool bScalar = false;
+	bool bFiltered = false;
+	bool bKeyEscaped = false;
+	std::vector<std::string> Path;
+	// The current key with its escapes decoded, when it has any.
+	std::string Key;
+	// Only containers down to the target array are tracked.
+	std::vector<Level> Levels;
+	JSONDecoder Decoder;
+	int Callback = LUA_NOREF;
+	int Null = LUA_NOREF;
+	std::string Error;
+
+	bool Fail(const char* error)
+	{
+		Error = std::string(error) + " at byte " + std::to_string(Consumed + Pos + 1);
+		return false;
+	}
+
+	bool AtCapture() const
+	{
+		if (!bFiltered)
+			return Depth == 0;
+		auto target = Path.size();
+		return (size_t)Depth == target + 1 && Levels.size() == target + 1 && Levels[target].bOnPath && !Levels[target].bObject;
+	}
+
+	bool AtKey() const
+	{
+		return Depth > 0 && Levels.size() == (size_t)Depth && (size_t)Depth <= Path.size() && Levels.back().bObject && Levels.back().bKeyNext;
+	}
+
+	// Advances to the next quote or backslash inside a string.
+	void SkipString()
+	{
+		auto data = Buffer.data();
+		auto len = Buffer.size();
+		auto quote = _mm_set1_epi8('"');
+		auto backslash = _mm_set1_epi8('\\');
+		while (Pos + 16 <= len)
+		{
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + Pos));
+			auto mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+			if (mask != 0)
+			{
+				unsigned long bit;
+				_BitScanForward(&bit, mask);
+				Pos += bit;
+				return;
+			}
+			Pos += 16;
+		}
+		while (Pos < len && data[Pos] != '"' && data[Pos] != '\\')
+			Pos++;
+	}
+
+	// Advances to the next quote or bracket inside a captured container, where nothing else matters.
+	void SkipContainer()
+	{
+		auto data = Buffer.data();
+		auto len = Buffer.size();
+		auto quote = _mm_set1_epi8('"');
+		// '[' and ']' differ from '{' and '}' only in bit 5, so clearing it lets one compare catch both.
+		auto fold = _mm_set1_epi8(~0x20);
+		auto open = _mm_set1_epi8('[');
+		auto close = _mm_set1_epi8(']');
+		while (Pos + 16 <= len)
+		{
+			auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + Pos));
+			auto folded = _mm_and_si128(v, fold);
+			auto hits = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)));
+			auto mask = (uint32_t)_mm_movemask_epi8(hits);
+			if (mask != 0)
+			{
+				unsigned long bit;
+				_BitScanForward(&bit, mask);
+				Pos += bit;
+				return;
+			}
+			Pos += 16;
+		}
+		while (Pos < len)
+		{
+			auto c = data[Pos];
+			if (c == '"' || c == '{' || c == '}' || c == '[' || c == ']')
+				return;
+			Pos++;
+		}
+	}
+
+	void Open(char c)
+	{
+		if (bFiltered && (size_t)Depth <= Path.size())
+		{
+			auto bOnPath = Depth == 0 || (Levels.back().bOnPath && Levels.back().bObject && Levels.back().bKeyMatch);
+			Levels.push_back({ c == '{', bOnPath, true, false });
+		}
+		Depth++;
+	}
+
+	// Scans until a complete value is buffered and returns its range. Returns false when more bytes are needed or on an error.
+	bool Next(size_t& start, size_t& end)
+	{
+		auto len = Buffer.size();
+		while (Pos < len)
+		{
+			if (bEscape)
+			{
+				bEscape = false;
+				Pos++;
+				continue;
+			}
+			if (bString)
+			{
+				SkipString();
+				if (Pos >= len)
+					break;
+				if (Buffer[Pos] == '\\')
+				{
+					bEscape = true;
+					bKeyEscaped |= KeyStart != std::string::npos;
+					Pos++;
+					continue;
+				}
+				bString = false;
+				Pos++;
+				if (KeyStart != std::string::npos)
+				{
+					auto& level = Levels.back();
+					auto& key = Path[Depth - 1];
+					level.bKeyNext = false;
+					if (!bKeyEscaped)
+						level.bKeyMatch = level.bOnPath && Pos - 1 - KeyStart == key.size() && memcmp(Buffer.data() + KeyStart, key.data(), key.size()) == 0;
+					else
+					{
+						// Path entries are plain strings, so a key written with escapes is decoded before comparing.
+						Decoder.JSON = Buffer.data();
+						Decoder.Length = Buffer.size();
+						Key.clear();
+						if (!Decoder.Unescape(KeyStart - 1, KeyStart, Key))
+							return Fail(Decoder.Error);
+						level.bKeyMatch = level.bOnPath && Key == key;
+						bKeyEscaped = false;
+					}
+					KeyStart = std::string::npos;
+				}
+				else if (Start != std::string::npos && Depth == CaptureDepth)
+				{
+					start = Start;
+					end = Pos;
+					Start = std::string::npos;
+					return true;
+				}
+				continue;
+			}
+
+			auto c = Buffer[Pos];
+			if (Start != std::string::npos)
+			{
+				if (bScalar)
+				{
+					if (IsJSONWhitespace(c) || IsJSONOp(c) || c == '"')
+					{
+						bScalar = false;
+						start = Start;
+						end = Pos;
+						Start = std::string::npos;
+						return true;
+					}
+					Pos++;
+					continue;
+				}
+				SkipContainer();
+				if (Pos >= len)
+					break;
+				c = Buffer[Pos++];
+				if (c == '"')
+					bString = true;
+				else if (c == '{' || c == '[')
+					Depth++;
+				else if (--Depth == CaptureDepth)
+				{
+					start = Start;
+					end = Pos;
+					Start = std::string::npos;
+					return true;
+				}
+				continue;
+			}
+
+			if (IsJSONWhitespace(c))
+			{
+				Pos++;
+				continue;
+			}
+			if (AtCapture() && c != ',' && c != ']')
+			{
+				if (IsJSONOp(c) && c != '{' && c != '[')
+					return Fail("unexpected character");
+				Start = Pos++;
+				CaptureDepth = Depth;
+				if (c == '"')
+					bString = true;
+				else if (c == '{' || c == '[')
+					Depth++;
+				else
+					bScalar = true;
+				continue;
+			}
+			switch (c)
+			{
+			case '"':
+				if (AtKey())
+					KeyStart = Pos + 1;
+				bString = true;
+				break;
+			case '{':
+			case '[':
+				Open(c);
+				break;
+			case '}':
+			case ']':
+				if (Depth == 0)
+					return Fail("unexpected character");
+				Depth--;
+				if (Levels.size() > (size_t)Depth)
+					Levels.pop_back();
+				break;
+			case ',':
+				if (Depth > 0 && Levels.size() == (size_t)Depth)
+					Levels.back().bKeyNext = true;
+				break;
+			}
+			Pos++;
+		}
+		return false;
+	}
+
+	// Drops everything before the oldest byte that's still needed.
+	void Compact()
+	{
+		auto keep = std::min({ Pos, Start, KeyStart });
+		if (keep == 0)
+			return;
+		Buffer.erase(0, keep);
+		Consumed += keep;
+		Pos -= keep;
+		if (Start != std::string::npos)
+			Start -= keep;
+		if (KeyStart != std::string::npos)
+			KeyStart -= keep;
+	}
+
+	void Reset()
+	{
+		Buffer.clear();
+		Pos = 0;
+		Start = KeyStart = std::string::npos;
+		Consumed = 0;
+		Depth = 0;
+		bString = bEscape = bScalar = bKeyEscaped = false;
+		Levels.clear();
+		Error.clear();
+	}
+};
+
+// Decodes a buffered value and passes it to the callback.
+static bool lua_jsonstreamemit(lua_State* L, JSONStream* stream, size_t start, size_t end)
+{
+	lua_rawgeti(L, LUA_REGISTRYINDEX, stream->Callback);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, stream->Null);
+	auto null = lua_gettop(L);
+	auto& decoder = stream->Decoder;
+	decoder.L = L;
+	decoder.Null = lua_isnil(L, null) ? 0 : null;
+	if (!decoder.Decode(stream->Buffer.data() + start, end - start))
+	{
+		stream->Error = std::string(decoder.Error) + " at byte " + std::to_string(stream->Consumed + start + decoder.ErrorPos + 1);
+		lua_settop(L, null - 2);
+		return false;
+	}
+	lua_remove(L, null);
+	lua_call(L, 1, 0);
+	return true;
+}
+
+static int lua_jsonstream(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	lua_settop(L, 2);
+	auto stream = lua_newobject<JSONStream>(L);
+	if (!lua_isnil(L, 2))
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+		lua_jsondecodeoptions(L, 2, stream->Decoder);
+		if (lua_getfield(L, 2, "Path") != LUA_TNIL)
+		{
+			luaL_checktype(L, -1, LUA_TTABLE);
+			stream->bFiltered = true;
+			auto count = luaL_len(L, -1);
+			for (lua_Integer i = 1; i <= count; i++)
+			{
+				lua_rawgeti(L, -1, i);
+				size_t len;
+				auto key = lua_tolstring(L, -1, &len);
+				if (key == nullptr || lua_type(L, -1) != LUA_TSTRING)
+					luaL_error(L, "Path must only contain strings");
+				stream->Path.emplace_back(key, len);
+				lua_pop(L, 1);
+			}
+		}
+		lua_pop(L, 1);
+		lua_getfield(L, 2, "Null");
+		stream->Null = luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+	lua_pushvalue(L, 1);
+	stream->Callback = luaL_ref(L, LUA_REGISTRYINDEX);
+	return 1;
+}
+
+static int lua_jsonstreamfeed(lua_State* L)
+{
+	auto stream = lua_checkobject<JSONStream>(L, 1);
+	size_t len;
+	auto bytes = luaL_checklstring(L, 2, &len);
+	if (stream->Error.empty())
+	{
+		stream->Buffer.append(bytes, len);
+		lua_Integer count = 0;
+		size_t start, end;
+		while (stream->Next(start, end) && lua_jsonstreamemit(L, stream, start, end))
+			count++;
+		if (stream->Error.empty())
+		{
+			stream->Compact();
+			lua_pushinteger(L, count);
+			return 1;
+		}
+	}
+	lua_pushnil(L);
+	lua_pushlstring(L, stream->Error);
+	return 2;
+}
+
+static int lua_jsonstreamclose(lua_State* L)
+{
+	auto stream = lua_checkobject<JSONStream>(L, 1);
+	lua_Integer count = 0;
+	if (stream->Error.empty())
+	{
+		// A number or literal at the very end has nothing after it to mark where it stops.
+		if (stream->bScalar)
+		{
+			auto start = stream->Start;
+			stream->bScalar = false;
+			stream->Start = std::string::npos;
+			if (lua_jsonstreamemit(L, stream, start, stream->Buffer.size()))
+				count++;
+		}
+		else if (stream->Start != std::string::npos || stream->bString || stream->Depth > 0)
+			stream->Fail("unexpected end of data");
+	}
+	if (!stream->Error.empty())
+	{
+		lua_pushnil(L);
+		lua_pushlstring(L, stream->Error);
+		stream->Reset();
+		return 2;
+	}
+	stream->Reset();
+	lua_pushinteger(L, count);
+	return 1;
+}
+
+static int lua_jsonstreamgc(lua_State* L)
+{
+	auto stream = lua_checkobject<JSONStream>(L, 1);
+	luaL_unref(L, LUA_REGISTRYINDEX, stream->Callback);
+	luaL_unref(L, LUA_REGISTRYINDEX, stream->Null);
+	return lua_gcobject<JSONStream>(L);
+}
+#pragma endregion
+
+#pragma region MsgPack
+struct MsgPackWriter
+{
+	lua_State* L;
+	std::string& Out;
+	int MaxDepth = 256;
+	std::unordered_set<const void*> Path;
+	std::string Error;
+
+	MsgPackWriter(lua_State* L, std::string& out) : L(L), Out(out)
+	{
+	}
+
+	void Byte(uint8_t b)
+	{
+		Out += (char)b;
+	}
+
+	// MessagePack is big endian.
+	template <typename T>
+	void Big(uint8_t tag, T value)
+	{
+		Out += (char)tag;
+		if constexpr (sizeof(T) == 2)
+			value = (T)_byteswap_ushort((uint16_t)value);
+		else if constexpr (sizeof(T) == 4)
+			value = (T)_byteswap_ulong((uint32_t)value);
+		else if constexpr (sizeof(T) == 8)
+			value = (T)_byteswap_uint64((uint64_t)value);
+		Out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	void Integer(int64_t value)
+	{
+		if (value >= 0)
+		{
+			if (value < 128)
+				Byte((uint8_t)value);
+			else if (value <= UINT8_MAX)
+				Big<uint8_t>(0xCC, (uint8_t)value);
+			else if (value <= UINT16_MAX)
+				Big<uint16_t>(0xCD, (uint16_t)value);
+			else if (value <= UINT32_MAX)
+				Big<uint32_t>(0xCE, (uint32_t)value);
+			else
+				Big<uint64_t>(0xCF, (uint64_t)value);
+		}
+		else if (value >= -32)
+			Byte((uint8_t)(int8_t)value);
+		else if (value >= INT8_MIN)
+			Big<uint8_t>(0xD0, (uint8_t)(int8_t)value);
+		else if (value >= INT16_MIN)
+			Big<uint16_t>(0xD1, (uint16_t)(int16_t)value);
+		else if (value >= INT32_MIN)
+			Big<uint32_t>(0xD2, (uint32_t)(int32_t)value);
+		else
+			Big<uint64_t>(0xD3, (uint64_t)value);
+	}
+
+	// Floats use float32 when that loses nothing. Either way they stay floats, separate from the integer formats.
+	void Float(double value)
+	{
+		auto single = (float)value;
+		if ((double)single == value)
+		{
+			uint32_t bits;
+			memcpy(&bits, &single, sizeof(bits));
+			Big<uint32_t>(0xCA, bits);
+		}
+		else
+		{
+			uint64_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			Big<uint64_t>(0xCB, bits);
+		}
+	}
+
+	void String(const char* str, size_t len)
+	{
+		if (len < 32)
+			Byte((uint8_t)(0xA0 | len));
+		else if (len <= UINT8_MAX)
+			Big<uint8_t>(0xD9, (uint8_t)len);
+		else if (len <= UINT16_MAX)
+			Big<uint16_t>(0xDA, (uint16_t)len);
+		else
+			Big<uint32_t>(0xDB, (uint32_t)len);
+		Out.append(str, len);
+	}
+
+	void Header(size_t count, uint8_t fix, uint8_t tag16)
+	{
+		if (count < 16)
+			Byte((uint8_t)(fix | count));
+		else if (count <= UINT16_MAX)
+			Big<uint16_t>(tag16, (uint16_t)count);
+		else
+			Big<uint32_t>(tag16 + 1, (uint32_t)count);
+	}
+
+	bool Table(int idx, int depth)
+	{
+		auto ptr = lua_topointer(L, idx);
+		if (depth >= MaxDepth || !lua_checkstack(L, 4))
+			return Fail("nested too deeply");
+		if (!Path.insert(ptr).second)
+			return Fail("circular reference");
+		size_t count;
+		if (lua_isarraytable(L, idx, count))
+		{
+			Header(count, 0x90, 0xDC);
+			for (size_t i = 1; i <= count; i++)
+			{
+				lua_rawgeti(L, idx, i);
+				auto bOK = Value(-1, depth + 1);
+				lua_pop(L, 1);
+				if (!bOK)
+					return false;
+			}
+		}
+		else
+		{
+			count = 0;
+			lua_pushnil(L);
+			while (lua_next(L, idx) != 0)
+			{
+				count++;
+				lua_pop(L, 1);
+			}
+			Header(count, 0x80, 0xDE);
+			lua_pushnil(L);
+			while (lua_next(L, idx) != 0)
+			{
+				if (!Value(-2, depth + 1) || !Value(-1, depth + 1))
+					return false;
+				lua_pop(L, 1);
+			}
+		}
+		Path.erase(ptr);
+		return true;
+	}
+
+	bool Fail(const char* error)
+	{
+		Error = error;
+		return false;
+	}
+
+	bool Value(int idx, int depth)
+	{
+		idx = lua_absindex(L, idx);
+		switch (lua_type(L, idx))
+		{
+		case LUA_TNIL:
+			Byte(0xC0);
+			return true;
+		case LUA_TBOOLEAN:
+			Byte(lua_toboolean(L, idx) ? 0xC3 : 0xC2);
+			return true;
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, idx))
+				Integer(lua_tointeger(L, idx));
+			else
+				Float(lua_tonumber(L, idx));
+			return true;
+		case LUA_TSTRING:
+		{
+			size_t len;
+			auto str = lua_tolstring(L, idx, &len);
+			if (len > UINT32_MAX)
+				return Fail("string too long");
+			String(str, len);
+			return true;
+		}
+		case LUA_TTABLE:
+			return Table(idx, depth);
+		case LUA_TLIGHTUSERDATA:
+			// JSON.Null
+			if (lua_touserdata(L, idx) == nullptr)
+			{
+				Byte(0xC0);
+				return true;
+			}
+			break;
+		}
+		Error = std::string("can't pack a ") + luaL_typename(L, idx);
+		return false;
+	}
+};
+
+struct MsgPackReader
+{
+	lua_State* L;
+	const uint8_t* Data;
+	size_t Length;
+	size_t Pos;
+	int MaxDepth = 256;
+	const char* Error = nullptr;
+
+	bool Fail(const char* error)
+	{
+		Error = error;
+		return false;
+	}
+
+	template <typename T>
+	bool Big(T& value)
+	{
+		if (Length - Pos < sizeof(T))
+			return Fail("unexpected end of data");
+		memcpy(&value, Data + Pos, sizeof(T));
+		Pos += sizeof(T);
+		if constexpr (sizeof(T) == 2)
+			value = (T)_byteswap_ushort((uint16_t)value);
+		else if constexpr (sizeof(T) == 4)
+			value = (T)_byteswap_ulong((uint32_t)value);
+		else if constexpr (sizeof(T) == 8)
+			value = (T)_byteswap_uint64((uint64_t)value);
+		return true;
+	}
+
+	bool Bytes(size_t len)
+	{
+		if (Length - Pos < len)
+			return Fail("unexpected end of data");
+		lua_pushlstring(L, reinterpret_cast<const char*>(Data + Pos), len);
+		Pos += len;
+		return true;
+	}
+
+	// Every element takes at least a byte, which caps how much a corrupt count can preallocate.
+	int Presize(size_t count) const
+	{
+		return (int)std::min<size_t>(count, Length - Pos);
+	}
+
+	bool Array(size_t count, int depth)
+	{
+		if (depth >= MaxDepth || !lua_checkstack(L, 3))
+			return Fail("nested too deeply");
+		lua_createtable(L, Presize(count), 0);
+		for (size_t i = 1; i <= count; i++)
+		{
+			if (!Value(depth + 1))
+				return false;
+			lua_rawseti(L, -2, i);
+		}
+		return true;
+	}
+
+	bool Map(size_t count, int depth)
+	{
+		if (depth >= MaxDepth || !lua_checkstack(L, 4))
+			return Fail("nested too deeply");
+		lua_createtable(L, 0, Presize(count));
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!Value(depth + 1) || !Value(depth + 1))
+				return false;
+			if (lua_isnil(L, -2))
+				return Fail("nil map key");
+			if (lua_type(L, -2) == LUA_TNUMBER && std::isnan(lua_tonumber(L, -2)))
+				return Fail("NaN map key");
+			lua_rawset(L, -3);
+		}
+		return true;
+	}
+
+	bool Value(int depth)
+	{
+		if (Pos >= Length)
+			return Fail("unexpected end of data");
+		auto tag = Data[Pos++];
+		if (tag < 0x80)
+		{
+			lua_pushinteger(L, tag);
+			return true;
+		}
+		if (tag >= 0xE0)
+		{
+			lua_pushinteger(L, (int8_t)tag);
+			return true;
+		}
+		if ((tag & 0xF0) == 0x80)
+			return Map(tag & 0x0F, depth);
+		if ((tag & 0xF0) == 0x90)
+			return Array(tag & 0x0F, depth);
+		if ((tag & 0xE0) == 0xA0)
+			return Bytes(tag & 0x1F);
+
+		uint8_t u8;
+		uint16_t u16;
+		uint32_t u32;
+		uint64_t u64;
+		switch (tag)
+		{
+		case 0xC0: lua_pushnil(L); return true;
+		case 0xC2: lua_pushboolean(L, false); return true;
+		case 0xC3: lua_pushboolean(L, true); return true;
+		case 0xC4: case 0xD9: return Big(u8) && Bytes(u8);
+		case 0xC5: case 0xDA: return Big(u16) && Bytes(u16);
+		case 0xC6: case 0xDB: return Big(u32) && Bytes(u32);
+		case 0xCA:
+		{
+			if (!Big(u32))
+				return false;
+			float value;
+			memcpy(&value, &u32, sizeof(value));
+			lua_pushnumber(L, value);
+			return true;
+		}
+		case 0xCB:
+		{
+			if (!Big(u64))
+				return false;
+			double value;
+			memcpy(&value, &u64, sizeof(value));
+			lua_pushnumber(L, value);
+			return true;
+		}
+		case 0xCC: if (!Big(u8)) return false; lua_pushinteger(L, u8); return true;
+		case 0xCD: if (!Big(u16)) return false; lua_pushinteger(L, u16); return true;
+		case 0xCE: if (!Big(u32)) return false; lua_pushinteger(L, u32); return true;
+		case 0xCF:
+			if (!Big(u64))
+				return false;
+			// Too big for a Lua integer.
+			if (u64 > (uint64_t)INT64_MAX)
+				lua_pushnumber(L, (lua_Number)u64);
+			else
+				lua_pushinteger(L, (lua_Integer)u64);
+			return true;
+		case 0xD0: if (!Big(u8)) return false; lua_pushinteger(L, (int8_t)u8); return true;
+		case 0xD1: if (!Big(u16)) return false; lua_pushinteger(L, (int16_t)u16); return true;
+		case 0xD2: if (!Big(u32)) return false; lua_pushinteger(L, (int32_t)u32); return true;
+		case 0xD3: if (!Big(u64)) return false; lua_pushinteger(L, (int64_t)u64); return true;
+		case 0xDC: return Big(u16) && Array(u16, depth);
+		case 0xDD: return Big(u32) && Array(u32, depth);
+		case 0xDE: return Big(u16) && Map(u16, depth);
+		case 0xDF: return Big(u32) && Map(u32, depth);
+		}
+		return Fail("unsupported type");
+	}
+};
+
+static int lua_msgpackpack(lua_State* L)
+{
+	luaL_checkany(L, 1);
+	lua_settop(L, 1);
+	auto& buffer = lua_newscratchbuffer(L);
+	bool bOK;
+	std::string error;
+	{
+		MsgPackWriter writer(L, buffer);
+		bOK = writer.Value(1, 0);
+		error = std::move(writer.Error);
+	}
+	if (!bOK)
+	{
+		lua_pushnil(L);
+		lua_pushlstring(L, error);
+		return 2;
+	}
+	lua_pushscratchbuffer(L, buffer);
+	return 1;
+}
+
+static int lua_msgpackunpack(lua_State* L)
+{
+	size_t len;
+	auto data = luaL_checklstring(L, 1, &len);
+	auto offset = luaL_optinteger(L, 2, 1);
+	luaL_argcheck(L, offset >= 1 && (size_t)offset <= len + 1, 2, "offset out of range");
+	lua_settop(L, 2);
+
+	MsgPackReader reader;
+	reader.L = L;
+	reader.Data = reinterpret_cast<const uint8_t*>(data);
+	reader.Length = len;
+	reader.Pos = (size_t)offset - 1;
+	if (!reader.Value(0))
+	{
+		auto pos = reader.Pos;
+		lua_settop(L, 2);
+		lua_pushnil(L);
+		lua_pushfstring(L, "%s at byte %d", reader.Error, (int)pos);
+		return 2;
+	}
+	lua_pushinteger(L, reader.Pos + 1);
+	return 2;
+}
+#pragma endregion
+
+#pragma region CSV
+// Returns the offset of the first byte in [p, p + len) equal to a, b, c or d, or len.
+static size_t CSVFind(const char* p, size_t len, char a, char b, char c, char d)
+{
+	size_t i = 0;
+	auto va = _mm_set1_epi8(a);
+	auto vb = _mm_set1_epi8(b);
+	auto vc = _mm_set1_epi8(c);
+	auto vd = _mm_set1_epi8(d);
+	for (; i + 16 <= len; i += 16)
+	{
+		auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		auto hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)), _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vd)));
+		auto mask = (uint32_t)_mm_movemask_epi8(hits);
+		if (mask != 0)
+		{
+			unsigned long bit;
+			_BitScanForward(&bit, mask);
+			return i + bit;
+		}
+	}
+	for (; i < len; i++)
+	{
+		if (p[i] == a || p[i] == b || p[i] == c || p[i] == d)
+			return i;
+	}
+	return len;
+}
+
+struct CSVReader
+{
+	static constexpr const char* MetaName = "ProddyUtils.CSVReader";
+
+	// A quoted field's text is between the quotes, and Extra counts any stray bytes after the closing quote.
+	struct Field
+	{
+		size_t Start;
+		size_t Length;
+		size_t Extra;
+		bool bQuoted;
+		bool bEscaped;
+	};
+
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	std::vector<char> Buffer = std::vector<char>(1024 * 1024);
+	size_t Pos = 0;
+	size_t End = 0;
+	bool bEOF = false;
+	// Set when ReadFile fails, so a read error isn't mistaken for the end of the file.
+	bool bFailed = false;
+	char Delimiter = ',';
+	lua_Integer Line = 0;
+	// Fields of the last row, as offsets into Buffer.
+	std::vector<Field> Fields;
+	std::string Scratch;
+	int RowSize = 0;
+
+	~CSVReader()
+	{
+		Close();
+	}
+
+	// Closes the file but keeps the buffered rows, at the end of the file.
+	void CloseFile()
+	{
+		if (hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+		bEOF = true;
+	}
+
+	// Closes the file and drops whatever is still buffered, so nothing more is read.
+	void Close()
+	{
+		CloseFile();
+		Pos = End = 0;
+	}
+
+	// Keeps the unread bytes and fills the rest of the buffer, growing it if a single row doesn't fit.
+	void Refill()
+	{
+		if (Pos > 0)
+		{
+			memmove(Buffer.data(), Buffer.data() + Pos, End - Pos);
+			End -= Pos;
+			Pos = 0;
+		}
+		if (End == Buffer.size())
+			Buffer.resize(Buffer.size() * 2);
+		DWORD read = 0;
+		if (hFile == INVALID_HANDLE_VALUE)
+			CloseFile();
+		else if (!ReadFile(hFile, Buffer.data() + End, (DWORD)std::min<size_t>(Buffer.size() - End, MAXDWORD), &read, nullptr))
+		{
+			// A partial last row must not be returned as if it were complete.
+			bFailed = true;
+			Close();
+		}
+		else if (read == 0)
+			CloseFile();
+		End += read;
+	}
+
+	// Parses one row starting at Pos. Returns false without consuming anything if the row runs past the buffered data.
+	bool TryRow()
+	{
+		Fields.clear();
+		auto data = Buffer.data();
+		auto p = Pos;
+		while (true)
+		{
+			Field field = { p, 0, 0, false, false };
+			if (p < End && data[p] == '"')
+			{
+				field.bQuoted = true;
+				// Quoted, up to a quote that isn't doubled.
+				field.Start = ++p;
+				while (true)
+				{
+					p += CSVFind(data + p, End - p, '"', '"', '"', '"');
+					if (p + 1 >= End && !bEOF)
+						return false;
+					if (p + 1 < End && data[p + 1] == '"')
+					{
+						field.bEscaped = true;
+						p += 2;
+						continue;
+					}
+					break;
+				}
+				field.Length = std::min(p, End) - field.Start;
+				p = std::min(p + 1, End);
+				// Anything between the closing quote and the delimiter is kept, as most readers do.
+				field.Extra = CSVFind(data + p, End - p, Delimiter, '\n', '\r', '\r');
+				p += field.Extra;
+			}
+			else
+			{
+				p += CSVFind(data + p, End - p, Delimiter, '\n', '\r', '\r');
+				field.Length = p - field.Start;
+			}
+			if (p >= End && !bEOF)
+				return false;
+			Fields.push_back(field);
+			if (p < End && data[p] == Delimiter)
+			{
+				p++;
+				continue;
+			}
+			// \r\n, \n or a lone \r end the row.
+			if (p < End && data[p] == '\r')
+			{
+				if (p + 1 >= End && !bEOF)
+					return false;
+				p++;
+			}
+			if (p < End && data[p] == '\n')
+				p++;
+			Pos = p;
+			return true;
+		}
+	}
+
+	// Finds the next row that isn't empty. Returns false at the end of the file or after a read error.
+	bool NextRow()
+	{
+		while (true)
+		{
+			if (Pos >= End && !bEOF)
+				Refill();
+			if (Pos >= End)
+				return false;
+			if (!TryRow())
+			{
+				Refill();
+				continue;
+			}
+			Line++;
+			if (Fields.size() > 1 || Fields[0].Length > 0 || Fields[0].bQuoted)
+				return true;
+		}
+	}
+
+	void PushField(lua_State* L, const Field& field)
+	{
+		auto data = Buffer.data() + field.Start;
+		if (!field.bEscaped && field.Extra == 0)
+		{
+			lua_pushlstring(L, data, field.Length);
+			return;
+		}
+		Scratch.clear();
+		for (size_t i = 0; i < field.Length; i++)
+		{
+			Scratch += data[i];
+			if (data[i] == '"')
+				i++;
+		}
+		Scratch.append(data + field.Length + 1, field.Extra);
+		lua_pushlstring(L, Scratch);
+	}
+};
+
+struct CSVWriter
+{
+	static constexpr const char* MetaName = "ProddyUtils.CSVWriter";
+
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	std::string Out;
+	char Delimiter = ',';
+	bool bFailed = false;
+
+	~CSVWriter()
+	{
+		Close();
+	}
+
+	bool Flush()
+	{
+		DWORD written;
+		if (hFile == INVALID_HANDLE_VALUE || (!Out.empty() && (!WriteFile(hFile, Out.data(), (DWORD)Out.size(), &written, nullptr) || written != Out.size())))
+			bFailed = true;
+		Out.clear();
+		return !bFailed;
+	}
+
+	bool Close()
+	{
+		if (hFile == INVALID_HANDLE_VALUE)
+			return !bFailed;
+		auto bOK = Flush();
+		CloseHandle(hFile);
+		hFile = INVALID_HANDLE_VALUE;
+		return bOK;
+	}
+
+	// Fields containing the delimiter, a quote or a line break are quoted, with quotes doubled.
+	void Field(const char* str, size_t len)
+	{
+		if (CSVFind(str, len, Delimiter, '"', '\n', '\r') == len)
+		{
+			Out.append(str, len);
+			return;
+		}
+		Out += '"';
+		while (true)
+		{
+			auto n = CSVFind(str, len, '"', '"', '"', '"');
+			Out.append(str, n);
+			if (n == len)
+				break;
+			Out += "\"\"";
+			str += n + 1;
+			len -= n + 1;
+		}
+		Out += '"';
+	}
+};
+
+static char lua_checkdelimiter(lua_State* L, int idx)
+{
+	lua_getfield(L, idx, "Delimiter");
+	size_t len;
+	auto delimiter = luaL_optlstring(L, -1, ",", &len);
+	if (len != 1 || *delimiter == '"' || *delimiter == '\r' || *delimiter == '\n')
+		luaL_error(L, "Delimiter must be a single character other than a quote or line break");
+	lua_pop(L, 1);
+	return *delimiter;
+}
+
+// Fills the reused row table from the reader's current fields. With a header, fields are keyed by column name and any extra fields by index.
+static void lua_csvfillrow(lua_State* L, CSVReader* reader, int row, int header)
+{
+	auto count = (int)reader->Fields.size();
+	auto named = header != 0 ? (int)lua_rawlen(L, header) : 0;
+	for (int i = 0; i < std::max(count, named); i++)
+	{
+		if (i < named)
+			lua_rawgeti(L, header, i + 1);
+		else
+			lua_pushinteger(L, i + 1);
+		if (i < count)
+			reader->PushField(L, reader->Fields[i]);
+		else
+			lua_pushnil(L);
+		lua_rawset(L, row);
+	}
+	for (int i = std::max(count, named); i < reader->RowSize; i++)
+	{
+		lua_pushnil(L);
+		lua_rawseti(L, row, i + 1);
+	}
+	reader->RowSize = count;
+}
+
+static int lua_csvopen(lua_State* L)
+{
+	size_t len;
+	auto text = luaL_checklstring(L, 1, &len);
+	lua_settop(L, 2);
+	char delimiter = ',';
+	bool bHeader = false;
+	if (!lua_isnil(L, 2))
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+		delimiter = lua_checkdelimiter(L, 2);
+		lua_getfield(L, 2, "Header");
+		bHeader = lua_toboolean(L, -1) != 0;
+		lua_pop(L, 1);
+	}
+	auto hFile = CreateFileW(UTF8ToUTF16(text, len).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "couldn't open file");
+		return 2;
+	}
+	auto reader = lua_newobject<CSVReader>(L);
+	reader->hFile = hFile;
+	reader->Delimiter = delimiter;
+	auto obj = lua_gettop(L);
+	// The uservalue holds the reused row table and the column names.
+	lua_createtable(L, 2, 0);
+	lua_newtable(L);
+	lua_rawseti(L, -2, 1);
+	if (bHeader && reader->NextRow())
+	{
+		lua_createtable(L, (int)reader->Fields.size(), 0);
+		for (size_t i = 0; i < reader->Fields.size(); i++)
+		{
+			reader->PushField(L, reader->Fields[i]);
+			lua_rawseti(L, -2, i + 1);
+		}
+		lua_rawseti(L, -2, 2);
+	}
+	if (reader->bFailed)
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "couldn't read file");
+		return 2;
+	}
+	lua_setuservalue(L, obj);
+	return 1;
+}
+
+static int lua_csvreaderread(lua_State* L)
+{
+	auto reader = lua_checkobject<CSVReader>(L, 1);
+	lua_settop(L, 1);
+	if (!reader->NextRow())
+	{
+		reader->Close();
+		if (!reader->bFailed)
+			return 0;
+		lua_pushnil(L);
+		lua_pushfstring(L, "couldn't read file after line %d", (int)reader->Line);
+		return 2;
+	}
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, 2, 1);
+	lua_rawgeti(L, 2, 2);
+	lua_csvfillrow(L, reader, 3, lua_isnil(L, 4) ? 0 : 4);
+	lua_pushvalue(L, 3);
+	lua_pushinteger(L, reader->Line);
+	return 2;
+}
+
+static int lua_csvreaderheader(lua_State* L)
+{
+	lua_checkobject<CSVReader>(L, 1);
+	lua_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 2);
+	return 1;
+}
+
+static int lua_csvreaderclose(lua_State* L)
+{
+	lua_checkobject<CSVReader>(L, 1)->Close();
+	return 0;
+}
+
+static int lua_csvwriter(lua_State* L)
+{
+	size_t len;
+	auto text = luaL_checklstring(L, 1, &len);
+	lua_settop(L, 2);
+	char delimiter = ',';
+	bool bAppend = false;
+	if (!lua_isnil(L, 2))
+	{
+		luaL_checktype(L, 2, LUA_TTABLE);
+		delimiter = lua_checkdelimiter(L, 2);
+		lua_getfield(L, 2, "Append");
+		bAppend = lua_toboolean(L, -1) != 0;
+		lua_pop(L, 1);
+	}
+	auto hFile = CreateFileW(UTF8ToUTF16(text, len).c_str(), bAppend ? FILE_APPEND_DATA : GENERIC_WRITE, FILE_SHARE_READ, nullptr, bAppend ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "couldn't open file");
+		return 2;
+	}
+	auto writer = lua_newobject<CSVWriter>(L);
+	writer->hFile = hFile;
+	writer->Delimiter = delimiter;
+	return 1;
+}
+
+static int lua_csvwriterwrite(lua_State* L)
+{
+	auto writer = lua_checkobject<CSVWriter>(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	luaL_argcheck(L, writer->hFile != INVALID_HANDLE_VALUE, 1, "writer is closed");
+	auto count = (lua_Integer)lua_rawlen(L, 2);
+	auto rowStart = writer->Out.size();
+	char buf[32];
+	for (lua_Integer i = 1; i <= count; i++)
+	{
+		if (i > 1)
+			writer->Out += writer->Delimiter;
+		size_t len;
+		switch (lua_rawgeti(L, 2, i))
+		{
+		case LUA_TNIL:
+			break;
+		case LUA_TBOOLEAN:
+			writer->Out += lua_toboolean(L, -1) ? "true" : "false";
+			break;
+		case LUA_TNUMBER:
+		{
+			auto result = lua_isinteger(L, -1) ? std::to_chars(buf, buf + sizeof(buf), (int64_t)lua_tointeger(L, -1)) : std::to_chars(buf, buf + sizeof(buf), lua_tonumber(L, -1));
+			writer->Out.append(buf, result.ptr);
+			break;
+		}
+		case LUA_TSTRING:
+		{
+			auto str = lua_tolstring(L, -1, &len);
+			writer->Field(str, len);
+			break;
+		}
+		default:
+			// Drop the partial row before raising the error.
+			writer->Out.resize(rowStart);
+			return luaL_error(L, "can't write a %s to CSV", luaL_typename(L, -1));
+		}
+		lua_pop(L, 1);
+	}
+	writer->Out += "\r\n";
+	if (writer->Out.size() >= 1024 * 1024)
+		writer->Flush();
+	return 0;
+}
+
+static int lua_csvwriterflush(lua_State* L)
+{
+	auto writer = lua_checkobject<CSVWriter>(L, 1);
+	if (!writer->Flush())
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "couldn't write to file");
+		return 2;
+	}
+	lua_pushboolean(L, true);
+	return 1;
+}
+
+static int lua_csvwriterclose(lua_State* L)
+{
+	auto writer = lua_checkobject<CSVWriter>(L, 1);
+	if (!writer->Close())
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "couldn't write to file");
+		return 2;
+	}
+	lua_pushboolean(L, true);
+	return 1;
+}
+#pragma endregion
+
+#pragma region Encoding
+struct EncodingTables
+{
+	// Sextet values, or -1 for invalid bytes, -2 for whitespace and -3 for padding.
+	int8_t Base64[256];
+	int8_t Base64URL[256];
+	int8_t Hex[256];
+
+	EncodingTables()
+	{
+		static const char Letters[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+		memset(Base64, -1, sizeof(Base64));
+		for (int i = 0; i < 62; i++)
+			Base64[(uint8_t)Letters[i]] = (int8_t)i;
+		for (auto c : { ' ', '\t', '\r', '\n' })
+			Base64[(uint8_t)c] = -2;
+		Base64['='] = -3;
+		memcpy(Base64URL, Base64, sizeof(Base64URL));
+		Base64['+'] = 62;
+		Base64['/'] = 63;
+		Base64URL['-'] = 62;
+		Base64URL['_'] = 63;
+
+		memset(Hex, -1, sizeof(Hex));
+		for (int i = 0; i < 10; i++)
+			Hex['0' + i] = (int8_t)i;
+		for (int i = 0; i < 6; i++)
+			Hex['a' + i] = Hex['A' + i] = (int8_t)(10 + i);
+	}
+};
+static const EncodingTables Encoding;
+
+// The SIMD codecs follow Muła and Lemire: a multiply pair splits 3 bytes into four sextets, and 16 entry shuffle tables map between sextets and characters.
+static size_t Base64Encode(const uint8_t* src, size_t len, char* dst, bool bURL)
+{
+	static const char Standard[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	static const char URL[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	auto alphabet = bURL ? URL : Standard;
+	size_t i = 0;
+	size_t o = 0;
+	// Offsets from a sextet to its character, indexed by the sextet's range.
+	auto plus = bURL ? '-' - 62 : '+' - 62;
+	auto slash = bURL ? '_' - 63 : '/' - 63;
+	if (CPU.AVX2 && len >= 28)
+	{
+		auto shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+		auto lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, plus, slash, 'A', 0, 0,
+			'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, plus, slash, 'A', 0, 0);
+		for (; i + 28 <= len; i += 24, o += 32)
+		{
+			auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 12));
+			auto in = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), shuffle);
+			auto t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+			auto t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+			auto sextets = _mm256_or_si256(t0, t1);
+			auto range = _mm256_subs_epu8(sextets, _mm256_set1_epi8(51));
+			auto upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), sextets);
+			range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+			auto out = _mm256_add_epi8(_mm256_shuffle_epi8(lut, range), sextets);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + o), out);
+		}
+		_mm256_zeroupper();
+	}
+	if (CPU.SSSE3)
+	{
+		auto shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+		auto lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, plus, slash, 'A', 0, 0);
+		for (; i + 16 <= len; i += 12, o += 16)
+		{
+			auto in = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), shuffle);
+			auto t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+			auto t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+			auto sextets = _mm_or_si128(t0, t1);
+			auto range = _mm_subs_epu8(sextets, _mm_set1_epi8(51));
+			auto upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), sextets);
+			range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+			auto out = _mm_add_epi8(_mm_shuffle_epi8(lut, range), sextets);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + o), out);
+		}
+	}
+	for (; i + 3 <= len; i += 3, o += 4)
+	{
+		uint32_t v = src[i] << 16 | src[i + 1] << 8 | src[i + 2];
+		dst[o] = alphabet[v >> 18];
+		dst[o + 1] = alphabet[(v >> 12) & 63];
+		dst[o + 2] = alphabet[(v >> 6) & 63];
+		dst[o + 3] = alphabet[v & 63];
+	}
+	// URL-safe output leaves out the padding.
+	if (i < len)
+	{
+		uint32_t v = src[i] << 16 | (i + 1 < len ? src[i + 1] << 8 : 0);
+		dst[o++] = alphabet[v >> 18];
+		dst[o++] = alphabet[(v >> 12) & 63];
+		if (i + 1 < len)
+			dst[o++] = alphabet[(v >> 6) & 63];
+		else if (!bURL)
+			dst[o++] = '=';
+		if (!bURL)
+			dst[o++] = '=';
+	}
+	return o;
+}
+
+// Checks and translates 16 characters to sextets. URL-safe input has '-' and '_' swapped for '+' and '/' first, and a real '+' or '/' is rejected.
+static inline bool Base64DecodeBlock(__m128i& in, bool bURL)
+{
+	if (bURL)
+	{
+		auto standard = _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('+')), _mm_cmpeq_epi8(in, _mm_set1_epi8('/')));
+		if (_mm_movemask_epi8(standard) != 0)
+			return false;
+		in = _mm_add_epi8(in, _mm_and_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('-')), _mm_set1_epi8('+' - '-')));
+		in = _mm_add_epi8(in, _mm_and_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('_')), _mm_set1_epi8('/' - '_')));
+	}
+	auto lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	auto lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	auto lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	auto nibbleMask = _mm_set1_epi8(0x0F);
+	auto hiNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), nibbleMask);
+	auto loNibbles = _mm_and_si128(in, nibbleMask);
+	auto invalid = _mm_and_si128(_mm_shuffle_epi8(lutLo, loNibbles), _mm_shuffle_epi8(lutHi, hiNibbles));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128())) != 0xFFFF)
+		return false;
+	auto roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')), hiNibbles));
+	in = _mm_add_epi8(in, roll);
+	return true;
+}
+
+static inline bool Base64DecodeBlock(__m256i& in, bool bURL)
+{
+	if (bURL)
+	{
+		auto standard = _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('+')), _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')));
+		if (_mm256_movemask_epi8(standard) != 0)
+			return false;
+		in = _mm256_add_epi8(in, _mm256_and_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('-')), _mm256_set1_epi8('+' - '-')));
+		in = _mm256_add_epi8(in, _mm256_and_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('_')), _mm256_set1_epi8('/' - '_')));
+	}
+	auto lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	auto lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	auto lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	auto nibbleMask = _mm256_set1_epi8(0x0F);
+	auto hiNibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibbleMask);
+	auto loNibbles = _mm256_and_si256(in, nibbleMask);
+	auto invalid = _mm256_and_si256(_mm256_shuffle_epi8(lutLo, loNibbles), _mm256_shuffle_epi8(lutHi, hiNibbles));
+	if (!_mm256_testz_si256(invalid, invalid))
+		return false;
+	auto roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')), hiNibbles));
+	in = _mm256_add_epi8(in, roll);
+	return true;
+}
+
+// Runs the SIMD decoder over whole blocks of valid characters, stopping at the first block with anything else in it.
+// Writes up to 8 bytes past the decoded output.
+static void Base64DecodeFast(const char* src, size_t len, size_t& i, uint8_t* dst, size_t& o, bool bURL)
+{
+	if (CPU.AVX2)
+	{
+		auto pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		for (; i + 32 <= len; i += 32, o += 24)
+		{
+			auto in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			if (!Base64DecodeBlock(in, bURL))
+				break;
+			auto merged = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+			auto out = _mm256_shuffle_epi8(_mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000)), pack);
+			out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + o), out);
+		}
+		_mm256_zeroupper();
+	}
+	if (CPU.SSSE3)
+	{
+		auto pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		for (; i + 16 <= len; i += 16, o += 12)
+		{
+			auto in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			if (!Base64DecodeBlock(in, bURL))
+				break;
+			auto merged = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+			auto out = _mm_shuffle_epi8(_mm_madd_epi16(merged, _mm_set1_epi32(0x00011000)), pack);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + o), out);
+		}
+	}
+}
+
+// Whitespace is skipped and padding is optional. Returns false with the position of the first bad character.
+static bool Base64Decode(const char* src, size_t len, uint8_t* dst, size_t& o, size_t& errorPos, bool bURL)
+{
+	auto table = bURL ? Encoding.Base64URL : Encoding.Base64;
+	size_t i = 0;
+	uint32_t bits = 0;
+	int count = 0;
+	o = 0;
+	while (i < len)
+	{
+		if (count == 0)
+		{
+			Base64DecodeFast(src, len, i, dst, o, bURL);
+			if (i >= len)
+				break;
+		}
+		auto value = table[(uint8_t)src[i]];
+		if (value == -2)
+		{
+			i++;
+			continue;
+		}
+		if (value < 0)
+			break;
+		bits = bits << 6 | value;
+		i++;
+		if (++count == 4)
+		{
+			dst[o++] = (uint8_t)(bits >> 16);
+			dst[o++] = (uint8_t)(bits >> 8);
+			dst[o++] = (uint8_t)bits;
+			bits = 0;
+			count = 0;
+		}
+	}
+	// A final group of 2 or 3 characters holds 1 or 2 bytes, and is followed only by padding and whitespace.
+	if (count == 1)
+	{
+		errorPos = i;
+		return false;
+	}
+	if (count == 2)
+		dst[o++] = (uint8_t)(bits >> 4);
+	else if (count == 3)
+	{
+		dst[o++] = (uint8_t)(bits >> 10);
+		dst[o++] = (uint8_t)(bits >> 2);
+	}
+	for (auto padding = 0; i < len; i++)
+	{
+		auto value = table[(uint8_t)src[i]];
+		if (value == -2)
+			continue;
+		if (value != -3 || count == 0 || ++padding > 4 - count)
+		{
+			errorPos = i;
+			return false;
+		}
+	}
+	return true;
+}
+
+static size_t HexEncode(const uint8_t* src, size_t len, char* dst, bool bUpper)
+{
+	auto digits = bUpper ? "0123456789ABCDEF" : "0123456789abcdef";
+	size_t i = 0;
+	if (CPU.AVX2)
+	{
+		auto lut = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(digits)));
+		auto mask = _mm256_set1_epi8(0x0F);
+		for (; i + 32 <= len; i += 32)
+		{
+			auto in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			auto hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(in, 4), mask));
+			auto lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(in, mask));
+			// Unpacking works within each 128 bit lane, so the halves are put back in order afterwards.
+			auto a = _mm256_unpacklo_epi8(hi, lo);
+			auto b = _mm256_unpackhi_epi8(hi, lo);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2), _mm256_permute2x128_si256(a, b, 0x20));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2 + 32), _mm256_permute2x128_si256(a, b, 0x31));
+		}
+		_mm256_zeroupper();
+	}
+	if (CPU.SSSE3)
+	{
+		auto lut = _mm_loadu_si128(reinterpret_cast<const __m128i*>(digits));
+		auto mask = _mm_set1_epi8(0x0F);
+		for (; i + 16 <= len; i += 16)
+		{
+			auto in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			auto hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+			auto lo = _mm_shuffle_epi8(lut, _mm_and_si128(in, mask));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), _mm_unpacklo_epi8(hi, lo));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+		}
+	}
+	for (; i < len; i++)
+	{
+		dst[i * 2] = digits[src[i] >> 4];
+		dst[i * 2 + 1] = digits[src[i] & 15];
+	}
+	return len * 2;
+}
+
+// Turns 16 hex digits of either case into nibbles. Returns false if any byte isn't a hex digit.
+static inline bool HexDecodeBlock(__m128i& in)
+{
+	auto digit = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+	auto bDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	auto letter = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	auto bLetter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+	if (_mm_movemask_epi8(_mm_or_si128(bDigit, bLetter)) != 0xFFFF)
+		return false;
+	in = _mm_or_si128(_mm_and_si128(bDigit, digit), _mm_and_si128(bLetter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+	return true;
+}
+
+static inline bool HexDecodeBlock(__m256i& in)
+{
+	auto digit = _mm256_sub_epi8(in, _mm256_set1_epi8('0'));
+	auto bDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+	auto letter = _mm256_sub_epi8(_mm256_or_si256(in, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+	auto bLetter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+	if ((uint32_t)_mm256_movemask_epi8(_mm256_or_si256(bDigit, bLetter)) != 0xFFFFFFFF)
+		return false;
+	in = _mm256_or_si256(_mm256_and_si256(bDigit, digit), _mm256_and_si256(bLetter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+	return true;
+}
+
+// len must be even. Returns false with the position of the first bad character.
+static bool HexDecode(const char* src, size_t len, uint8_t* dst, size_t& errorPos)
+{
+	size_t i = 0;
+	if (CPU.AVX2)
+	{
+		// Each pair of nibbles is combined as hi * 16 + lo.
+		auto weights = _mm256_set1_epi16(0x0110);
+		for (; i + 64 <= len; i += 64)
+		{
+			auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+			if (!HexDecodeBlock(a) || !HexDecodeBlock(b))
+				break;
+			auto packed = _mm256_packus_epi16(_mm256_maddubs_epi16(a, weights), _mm256_maddubs_epi16(b, weights));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i / 2), _mm256_permute4x64_epi64(packed, 0xD8));
+		}
+		_mm256_zeroupper();
+	}
+	if (CPU.SSSE3)
+	{
+		auto weights = _mm_set1_epi16(0x0110);
+		for (; i + 32 <= len; i += 32)
+		{
+			auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+			if (!HexDecodeBlock(a) || !HexDecodeBlock(b))
+				break;
+			auto packed = _mm_packus_epi16(_mm_maddubs_epi16(a, weights), _mm_maddubs_epi16(b, weights));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i / 2), packed);
+		}
+	}
+	for (; i < len; i += 2)
+	{
+		auto hi = Encoding.Hex[(uint8_t)src[i]];
+		auto lo = Encoding.Hex[(uint8_t)src[i + 1]];
+		if (hi < 0 || lo < 0)
+		{
+			errorPos = hi < 0 ? i : i + 1;
+			return false;
+		}
+		dst[i / 2] = (uint8_t)(hi << 4 | lo);
+	}
+	return true;
+}
+
+static int lua_base64encode(lua_State* L)
+{
+	size_t len;
+	auto data = luaL_checklstring(L, 1, &len);
+	auto bURL = lua_toboolean(L, 2) != 0;
+	luaL_argcheck(L, len < SIZE_MAX / 4 * 3 - 4, 1, "input too large");
+	luaL_Buffer b;
+	auto out = luaL_buffinitsize(L, &b, (len + 2) / 3 * 4);
+	luaL_pushresultsize(&b, Base64Encode(reinterpret_cast<const uint8_t*>(data), len, out, bURL));
+	return 1;
+}
+
+static int lua_base64decode(lua_State* L)
+{
+	size_t len;
+	auto data = luaL_checklstring(L, 1, &len);
+	auto bURL = lua_toboolean(L, 2) != 0;
+	luaL_Buffer b;
+	// Room for the vector stores that run past the end.
+	auto out = reinterpret_cast<uint8_t*>(luaL_buffinitsize(L, &b, len / 4 * 3 + 3 + 32));
+	size_t size, errorPos;
+	if (!Base64Decode(data, len, out, size, errorPos, bURL))
+	{
+		lua_pushnil(L);
+		lua_pushfstring(L, "invalid base64 at byte %d", (int)errorPos + 1);
+		return 2;
+	}
+	luaL_pushresultsize(&b, size);
+	return 1;
+}
+
+static int lua_hexencode(lua_State* L)
+{
+	size_t len;
+	auto data = luaL_checklstring(L, 1, &len);
+	auto bUpper = lua_toboolean(L, 2) != 0;
+	luaL_argcheck(L, len < SIZE_MAX / 2, 1, "input too large");
+	luaL_Buffer b;
+	auto out = luaL_buffinitsize(L, &b, len * 2);
+	luaL_pushresultsize(&b, HexEncode(reinterpret_cast<const uint8_t*>(data), len, out, bUpper));
+	return 1;
+}
+
+static int lua_hexdecode(lua_State* L)
+{
+	size_t len;
+	auto data = luaL_checklstring(L, 1, &len);
+	if (len % 2 != 0)
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "odd number of hex digits");
+		return 2;
+	}
+	luaL_Buffer b;
+	auto out = reinterpret_cast<uint8_t*>(luaL_buffinitsize(L, &b, len / 2));
+	size_t errorPos;
+	if (!HexDecode(data, len, out, errorPos))
+	{
+		lua_pushnil(L);
+		lua_pushfstring(L, "invalid hex digit at byte %d", (int)errorPos + 1);
+		return 2;
+	}
+	luaL_pushresultsize(&b, len / 2);
+	return 1;
+}
+#pragma endregion
+
+#pragma region Hash
+// XXH3 (64 bit) follows the reference implementation, so digests match other xxHash libraries.
+constexpr uint64_t XXHPrime32_1 = 0x9E3779B1U;
+constexpr uint64_t XXHPrime32_2 = 0x85EBCA77U;
+constexpr uint64_t XXHPrime32_3 = 0xC2B2AE3DU;
+constexpr uint64_t XXHPrime64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t XXHPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t XXHPrime64_3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t XXHPrime64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t XXHPrime64_5 = 0x27D4EB2F165667C5ULL;
+constexpr uint64_t XXHPrimeMX1 = 0x165667919E3779F9ULL;
+constexpr uint64_t XXHPrimeMX2 = 0x9FB21C651E98DF25ULL;
+constexpr size_t XXH3StripeLength = 64;
+constexpr size_t XXH3SecretSize = 192;
+constexpr size_t XXH3StripesPerBlock = (XXH3SecretSize - XXH3StripeLength) / 8;
+constexpr size_t XXH3MidSizeMax = 240;
+
+static const uint8_t XXH3Secret[XXH3SecretSize] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+inline uint64_t XXHRead64(const uint8_t* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint32_t XXHRead32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint64_t XXHMul128Fold(uint64_t a, uint64_t b)
+{
+	uint64_t hi;
+	auto lo = _umul128(a, b, &hi);
+	return lo ^ hi;
+}
+
+inline uint64_t XXH64Avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= XXHPrime64_2;
+	h ^= h >> 29;
+	h *= XXHPrime64_3;
+	return h ^ (h >> 32);
+}
+
+inline uint64_t XXH3Avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= XXHPrimeMX1;
+	return h ^ (h >> 32);
+}
+
+inline uint64_t XXH3Mix16(const uint8_t* input, const uint8_t* secret, uint64_t seed)
+{
+	return XXHMul128Fold(XXHRead64(input) ^ (XXHRead64(secret) + seed), XXHRead64(input + 8) ^ (XXHRead64(secret + 8) - seed));
+}
+
+// Inputs of up to 240 bytes, which always use the default secret.
+static uint64_t XXH3Short(const uint8_t* input, size_t len, uint64_t seed)
+{
+	auto secret = XXH3Secret;
+	if (len == 0)
+		return XXH64Avalanche(seed ^ XXHRead64(secret + 56) ^ XXHRead64(secret + 64));
+	if (len <= 3)
+	{
+		auto combined = (uint32_t)input[0] << 16 | (uint32_t)input[len >> 1] << 24 | input[len - 1] | (uint32_t)len << 8;
+		return XXH64Avalanche(combined ^ ((XXHRead32(secret) ^ XXHRead32(secret + 4)) + seed));
+	}
+	if (len <= 8)
+	{
+		seed ^= (uint64_t)_byteswap_ulong((uint32_t)seed) << 32;
+		auto keyed = (XXHRead32(input + len - 4) + ((uint64_t)XXHRead32(input) << 32)) ^ ((XXHRead64(secret + 8) ^ XXHRead64(secret + 16)) - seed);
+		keyed ^= _rotl64(keyed, 49) ^ _rotl64(keyed, 24);
+		keyed *= XXHPrimeMX2;
+		keyed ^= (keyed >> 35) + len;
+		keyed *= XXHPrimeMX2;
+		return keyed ^ (keyed >> 28);
+	}
+	if (len <= 16)
+	{
+		auto lo = XXHRead64(input) ^ ((XXHRead64(secret + 24) ^ XXHRead64(secret + 32)) + seed);
+		auto hi = XXHRead64(input + len - 8) ^ ((XXHRead64(secret + 40) ^ XXHRead64(secret + 48)) - seed);
+		return XXH3Avalanche(len + _byteswap_uint64(lo) + hi + XXHMul128Fold(lo, hi));
+	}
+	auto acc = len * XXHPrime64_1;
+	if (len <= 128)
+	{
+		if (len > 32)
+		{
+			if (len > 64)
+			{
+				if (len > 96)
+				{
+					acc += XXH3Mix16(input + 48, secret + 96, seed);
+					acc += XXH3Mix16(input + len - 64, secret + 112, seed);
+				}
+				acc += XXH3Mix16(input + 32, secret + 64, seed);
+				acc += XXH3Mix16(input + len - 48, secret + 80, seed);
+			}
+			acc += XXH3Mix16(input + 16, secret + 32, seed);
+			acc += XXH3Mix16(input + len - 32, secret + 48, seed);
+		}
+		acc += XXH3Mix16(input, secret, seed);
+		acc += XXH3Mix16(input + len - 16, secret + 16, seed);
+		return XXH3Avalanche(acc);
+	}
+	for (size_t i = 0; i < 8; i++)
+		acc += XXH3Mix16(input + 16 * i, secret + 16 * i, seed);
+	acc = XXH3Avalanche(acc);
+	auto accEnd = XXH3Mix16(input + len - 16, secret + 136 - 17, seed);
+	for (size_t i = 8; i < len / 16; i++)
+		accEnd += XXH3Mix16(input + 16 * i, secret + 16 * (i - 8) + 3, seed);
+	return XXH3Avalanche(acc + accEnd);
+}
+
+// Adds count consecutive 64 byte stripes into the 8 accumulators, the secret advancing 8 bytes per stripe.
+static void XXH3Accumulate(uint64_t* acc, const uint8_t* input, const uint8_t* secret, size_t count)
+{
+	if (CPU.AVX2)
+	{
+		auto a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc));
+		auto a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc + 4));
+		for (size_t n = 0; n < count; n++, input += XXH3StripeLength, secret += 8)
+		{
+			auto d0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input));
+			auto d1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + 32));
+			auto k0 = _mm256_xor_si256(d0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret)));
+			auto k1 = _mm256_xor_si256(d1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret + 32)));
+			// Each lane gains the product of its keyed halves plus its neighbour's input.
+			a0 = _mm256_add_epi64(a0, _mm256_add_epi64(_mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32)), _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+			a1 = _mm256_add_epi64(a1, _mm256_add_epi64(_mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32)), _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(acc), a0);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + 4), a1);
+		_mm256_zeroupper();
+		return;
+	}
+	__m128i a[4];
+	for (size_t i = 0; i < 4; i++)
+		a[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc + 2 * i));
+	for (size_t n = 0; n < count; n++, input += XXH3StripeLength, secret += 8)
+	{
+		for (size_t i = 0; i < 4; i++)
+		{
+			auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 16 * i));
+			auto k = _mm_xor_si128(d, _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret + 16 * i)));
+			a[i] = _mm_add_epi64(a[i], _mm_add_epi64(_mm_mul_epu32(k, _mm_srli_epi64(k, 32)), _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+		}
+	}
+	for (size_t i = 0; i < 4; i++)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(acc + 2 * i), a[i]);
+}
+
+static void XXH3Scramble(uint64_t* acc, const uint8_t* secret)
+{
+	for (size_t i = 0; i < 8; i++)
+	{
+		auto a = acc[i];
+		a ^= a >> 47;
+		a ^= XXHRead64(secret + 8 * i);
+		acc[i] = a * XXHPrime32_1;
+	}
+}
+
+static uint64_t XXH3MergeAccs(const uint64_t* acc, const uint8_t* secret, uint64_t start)
+{
+	for (size_t i = 0; i < 4; i++)
+		start += XXHMul128Fold(acc[2 * i] ^ XXHRead64(secret + 16 * i), acc[2 * i + 1] ^ XXHRead64(secret + 16 * i + 8));
+	return XXH3Avalanche(start);
+}
+
+// Long inputs are hashed in blocks of 16 stripes, the streaming state buffers input until it has more than a block's worth.
+struct XXH3State
+{
+	static constexpr size_t BufferSize = 256;
+
+	uint64_t Acc[8];
+	uint8_t Buffer[BufferSize];
+	// Seeds other than 0 derive their own secret for long inputs.
+	uint8_t Secret[XXH3SecretSize];
+	size_t Buffered;
+	size_t Stripes;
+	uint64_t Total;
+	uint64_t Seed;
+
+	void Reset(uint64_t seed)
+	{
+		static const uint64_t Init[8] = { XXHPrime32_3, XXHPrime64_1, XXHPrime64_2, XXHPrime64_3, XXHPrime64_4, XXHPrime32_2, XXHPrime64_5, XXHPrime32_1 };
+		memcpy(Acc, Init, sizeof(Acc));
+		for (size_t i = 0; i < XXH3SecretSize; i += 16)
+		{
+			auto lo = XXHRead64(XXH3Secret + i) + seed;
+			auto hi = XXHRead64(XXH3Secret + i + 8) - seed;
+			memcpy(Secret + i, &lo, 8);
+			memcpy(Secret + i + 8, &hi, 8);
+		}
+		Buffered = 0;
+		Stripes = 0;
+		Total = 0;
+		Seed = seed;
+	}
+
+	// Continues from stripes already accumulated in the current block, scrambling at each block end.
+	const uint8_t* Consume(uint64_t* acc, size_t& stripes, const uint8_t* input, size_t count) const
+	{
+		while (count >= XXH3StripesPerBlock - stripes)
+		{
+			auto n = XXH3StripesPerBlock - stripes;
+			XXH3Accumulate(acc, input, Secret + stripes * 8, n);
+			XXH3Scramble(acc, Secret + XXH3SecretSize - XXH3StripeLength);
+			input += n * XXH3StripeLength;
+			count -= n;
+			stripes = 0;
+		}
+		XXH3Accumulate(acc, input, Secret + stripes * 8, count);
+		stripes += count;
+		return input + count * XXH3StripeLength;
+	}
+
+	void Update(const uint8_t* input, size_t len)
+	{
+		auto end = input + len;
+		Total += len;
+		if (len <= BufferSize - Buffered)
+		{
+			memcpy(Buffer + Buffered, input, len);
+			Buffered += len;
+			return;
+		}
+		if (Buffered > 0)
+		{
+			auto fill = BufferSize - Buffered;
+			memcpy(Buffer + Buffered, input, fill);
+			input += fill;
+			Consume(Acc, Stripes, Buffer, BufferSize / XXH3StripeLength);
+			Buffered = 0;
+		}
+		// At least one byte is always held back, with the stripe before it kept at the end of the buffer, for Digest's last stripe.
+		if ((size_t)(end - input) > BufferSize)
+		{
+			input = Consume(Acc, Stripes, input, (end - input - 1) / XXH3StripeLength);
+			memcpy(Buffer + BufferSize - XXH3StripeLength, input - XXH3StripeLength, XXH3StripeLength);
+		}
+		memcpy(Buffer, input, end - input);
+		Buffered = end - input;
+	}
+
+	uint64_t Digest() const
+	{
+		if (Total <= XXH3MidSizeMax)
+			return XXH3Short(Buffer, (size_t)Total, Seed);
+		uint64_t acc[8];
+		memcpy(acc, Acc, sizeof(acc));
+		uint8_t stripe[XXH3StripeLength];
+		const uint8_t* last = stripe;
+		if (Buffered >= XXH3StripeLength)
+		{
+			auto stripes = Stripes;
+			Consume(acc, stripes, Buffer, (Buffered - 1) / XXH3StripeLength);
+			last = Buffer + Buffered - XXH3StripeLength;
+		}
+		else
+		{
+			auto catchUp = XXH3StripeLength - Buffered;
+			memcpy(stripe, Buffer + BufferSize - catchUp, catchUp);
+			memcpy(stripe + catchUp, Buffer, Buffered);
+		}
+		XXH3Accumulate(acc, last, Secret + XXH3SecretSize - XXH3StripeLength - 7, 1);
+		return XXH3MergeAccs(acc, Secret + 11, Total * XXHPrime64_1);
+	}
+};
+
+static uint64_t XXH3Hash(const uint8_t* input, size_t len, uint64_t seed)
+{
+	if (len <= XXH3MidSizeMax)
+		return XXH3Short(input, len, seed);
+	XXH3State state;
+	state.Reset(seed);
+	size_t stripes = 0;
+	state.Consume(state.Acc, stripes, input, (len - 1) / XXH3StripeLength);
+	XXH3Accumulate(state.Acc, input + len - XXH3StripeLength, state.Secret + XXH3SecretSize - XXH3StripeLength - 7, 1);
+	return XXH3MergeAccs(state.Acc, state.Secret + 11, len * XXHPrime64_1);
+}
+
+// Slicing by 8 tables for a reflected CRC-32 polynomial.
+struct CRC32Tables
+{
+	uint32_t Table[8][256];
+
+	CRC32Tables(uint32_t poly)
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			auto crc = i;
+			for (int j = 0; j < 8; j++)
+				crc = (crc >> 1) ^ (poly & (0U - (crc & 1)));
+			Table[0][i] = crc;
+		}
+		for (uint32_t i = 0; i < 256; i++)
+			for (int j = 1; j < 8; j++)
+				Table[j][i] = (Table[j - 1][i] >> 8) ^ Table[0][Table[j - 1][i] & 0xFF];
+	}
+
+	// Works on the raw register, callers start from and finish with ~0.
+	uint32_t Update(uint32_t crc, const uint8_t* p, size_t len) const
+	{
+		auto& t = Table;
+		for (; len >= 8; p += 8, len -= 8)
+		{
+			auto lo = XXHRead32(p) ^ crc;
+			auto hi = XXHRead32(p + 4);
+			crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+				t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+		}
+		for (; len > 0; p++, len--)
+			crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xFF];
+		return crc;
+	}
+};
+// The Castagnoli polynomial, used when SSE4.2 isn't available.
+static const CRC32Tables CRC32C(0x82F63B78U);
+
+// Works on the raw register, callers start from and finish with ~0.
+static uint32_t CRC32CUpdate(uint32_t crc, const uint8_t* p, size_t len)
+{
+	if (CPU.SSE42)
+	{
+		uint64_t c = crc;
+		for (; len >= 8; p += 8, len -= 8)
+			c = _mm_crc32_u64(c, XXHRead64(p));
+		crc = (uint32_t)c;
+		for (; len > 0; p++, len--)
+			crc = _mm_crc32_u8(crc, *p);
+		return crc;
+	}
+	return CRC32C.Update(crc, p, len);
+}
+
+static const uint32_t SHA256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// The SHA extensions keep the state as ABEF and CDGH and do two rounds per instruction, four message words are scheduled at a time.
+static void SHA256CompressNI(uint32_t* state, const uint8_t* data, size_t blocks)
+{
+	auto bswap = _mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+	auto dcba = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+	auto efgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);
+	auto abef = _mm_alignr_epi8(dcba, efgh, 8);
+	auto cdgh = _mm_blend_epi16(efgh, dcba, 0xF0);
+	for (; blocks > 0; blocks--, data += 64)
+	{
+		auto abefSave = abef;
+		auto cdghSave = cdgh;
+		auto m0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), bswap);
+		auto m1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)), bswap);
+		auto m2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)), bswap);
+		auto m3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)), bswap);
+		for (int i = 0; i < 16; i++)
+		{
+			auto k = _mm_add_epi32(m0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(SHA256K + 4 * i)));
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, k);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(k, 0x0E));
+			auto next = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3);
+			m0 = m1;
+			m1 = m2;
+			m2 = m3;
+			m3 = next;
+		}
+		abef = _mm_add_epi32(abef, abefSave);
+		cdgh = _mm_add_epi32(cdgh, cdghSave);
+	}
+	auto feba = _mm_shuffle_epi32(abef, 0x1B);
+	auto dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(feba, dchg, 0xF0));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+static void SHA256Compress(uint32_t* state, const uint8_t* data, size_t blocks)
+{
+	if (CPU.SHA)
+		return SHA256CompressNI(state, data, blocks);
+	for (; blocks > 0; blocks--, data += 64)
+	{
+		uint32_t w[64];
+		for (int i = 0; i < 16; i++)
+			w[i] = _byteswap_ulong(XXHRead32(data + 4 * i));
+		for (int i = 16; i < 64; i++)
+		{
+			auto s0 = _rotr(w[i - 15], 7) ^ _rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			auto s1 = _rotr(w[i - 2], 17) ^ _rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+		for (int i = 0; i < 64; i++)
+		{
+			auto t1 = h + (_rotr(e, 6) ^ _rotr(e, 11) ^ _rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256K[i] + w[i];
+			auto t2 = (_rotr(a, 2) ^ _rotr(a, 13) ^ _rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+struct SHA256State
+{
+	uint32_t State[8];
+	uint8_t Buffer[64];
+	size_t Buffered;
+	uint64_t Total;
+
+	void Reset()
+	{
+		static const uint32_t Init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+		memcpy(State, Init, sizeof(State));
+		Buffered = 0;
+		Total = 0;
+	}
+
+	void Update(const uint8_t* input, size_t len)
+	{
+		Total += len;
+		if (Buffered > 0)
+		{
+			auto fill = std::min(len, sizeof(Buffer) - Buffered);
+			memcpy(Buffer + Buffered, input, fill);
+			Buffered += fill;
+			input += fill;
+			len -= fill;
+			if (Buffered < sizeof(Buffer))
+				return;
+			SHA256Compress(State, Buffer, 1);
+			Buffered = 0;
+		}
+		SHA256Compress(State, input, len / 64);
+		memcpy(Buffer, input + len / 64 * 64, len % 64);
+		Buffered = len % 64;
+	}
+
+	// Pads a copy, so more data can still be added afterwards.
+	void Digest(uint8_t* out) const
+	{
+		uint32_t state[8];
+		memcpy(state, State, sizeof(state));
+		uint8_t tail[128] = {};
+		memcpy(tail, Buffer, Buffered);
+		tail[Buffered] = 0x80;
+		auto size = Buffered < 56 ? 64 : 128;
+		auto bits = _byteswap_uint64(Total * 8);
+		memcpy(tail + size - 8, &bits, 8);
+		SHA256Compress(state, tail, size / 64);
+		for (int i = 0; i < 8; i++)
+		{
+			auto word = _byteswap_ulong(state[i]);
+			memcpy(out + 4 * i, &word, 4);
+		}
+	}
+};
+
+static void lua_pushsha256(lua_State* L, const uint8_t* digest, bool bRaw)
+{
+	if (bRaw)
+	{
+		lua_pushlstring(L, reinterpret_cast<const char*>(digest), 32);
+		return;
+	}
+	char hex[64];
+	HexEncode(digest, 32, hex, false);
+	lua_pushlstring(L, hex, sizeof(hex));
+}
+
+// One streaming state for any of the algorithms, also used by Hash.File.
+struct Hasher
+{
+	static constexpr const char* MetaName = "ProddyUtils.Hasher";
+	static constexpr const char* const Names[] = { "XXH3", "CRC32C", "SHA256", nullptr };
+	enum class Algorithm { XXH3, CRC32C, SHA256 };
+
+	Algorithm Type;
+	uint64_t Seed;
+	union
+	{
+		XXH3State XXH;
+		uint32_t CRC;
+		SHA256State SHA;
+	};
+
+	Hasher(Algorithm type, uint64_t seed) : Type(type), Seed(seed)
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		switch (Type)
+		{
+		case Algorithm::XXH3: XXH.Reset(Seed); break;
+		case Algorithm::CRC32C: CRC = 0xFFFFFFFF; break;
+		case Algorithm::SHA256: SHA.Reset(); break;
+		}
+	}
+
+	void Update(const uint8_t* data, size_t len)
+	{
+		switch (Type)
+		{
+		case Algorithm::XXH3: XXH.Update(data, len); break;
+		case Algorithm::CRC32C: CRC = CRC32CUpdate(CRC, data, len); break;
+		case Algorithm::SHA256: SHA.Update(data, len); break;
+		}
+	}
+
+	void Push(lua_State* L, bool bRaw) const
+	{
+		switch (Type)
+		{
+		case Algorithm::XXH3: lua_pushinteger(L, (lua_Integer)XXH.Digest()); break;
+		case Algorithm::CRC32C: lua_pushinteger(L, ~CRC); break;
+		case Algorithm::SHA256:
+		{
+			uint8_t digest[32];
+			SHA.Digest(digest);
+			lua_pushsha256(L, digest, bRaw);
+			break;
+		}
+		}
+	}
+};
+
+static int lua_hashxxh3(lua_State* L)
+{
+	size_t len;
+	auto data = luaL_checklstring(L, 1, &len);
+	auto seed = (uint64_t)luaL_optinteger(L, 2, 0);
+	lua_pushinteger(L, (lua_Integer)XXH3Hash(reinterpret_cast<const uint8_t*>(data), len, seed));
+	return 1;
+}
+
+static int lua_hashcrc32c(lua_State* L)
+{
+	size_t len;
+	auto data = luaL_checklstring(L, 1, &len);
+	lua_pushinteger(L, ~CRC32CUpdate(0xFFFFFFFF, reinterpret_cast<const uint8_t*>(data), len));
+	return 1;
+}
+
+static int lua_hashsha256(lua_State* L)
+{
+	size_t len;
+	auto data = luaL_checklstring(L, 1, &len);
+	auto bRaw = lua_toboolean(L, 2) != 0;
+	SHA256State sha;
+	sha.Reset();
+	sha.Update(reinterpret_cast<const uint8_t*>(data), len);
+	uint8_t digest[32];
+	sha.Digest(digest);
+	lua_pushsha256(L, digest, bRaw);
+	return 1;
+}
+
+static int lua_hashhasher(lua_State* L)
+{
+	auto type = (Hasher::Algorithm)luaL_checkoption(L, 1, "SHA256", Hasher::Names);
+	auto seed = (uint64_t)luaL_optinteger(L, 2, 0);
+	lua_newobject<Hasher>(L, type, seed);
+	return 1;
+}
+
+static int lua_hasherupdate(lua_State* L)
+{
+	auto hasher = lua_checkobject<Hasher>(L, 1);
+	size_t len;
+	auto data = luaL_checklstring(L, 2, &len);
+	hasher->Update(reinterpret_cast<const uint8_t*>(data), len);
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int lua_hasherdigest(lua_State* L)
+{
+	auto hasher = lua_checkobject<Hasher>(L, 1);
+	hasher->Push(L, lua_toboolean(L, 2) != 0);
+	return 1;
+}
+
+static int lua_hasherreset(lua_State* L)
+{
+	lua_checkobject<Hasher>(L, 1)->Reset();
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int lua_hashfile(lua_State* L)
+{
+	size_t len;
+	auto text = luaL_checklstring(L, 1, &len);
+	auto type = (Hasher::Algorithm)luaL_checkoption(L, 2, "SHA256", Hasher::Names);
+	auto seed = (uint64_t)luaL_optinteger(L, 3, 0);
+	auto bRaw = lua_toboolean(L, 4) != 0;
+	auto hFile = CreateFileW(UTF8ToUTF16(text, len).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "couldn't open file");
+		return 2;
+	}
+	// Page aligned, and large enough that the kernels run on whole blocks between reads.
+	constexpr DWORD BufferSize = 4 * 1024 * 1024;
+	auto buffer = static_cast<uint8_t*>(VirtualAlloc(nullptr, BufferSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+	if (!buffer)
+	{
+		CloseHandle(hFile);
+		return luaL_error(L, "couldn't allocate read buffer");
+	}
+	Hasher hasher(type, seed);
+	DWORD read = 0;
+	bool bOK;
+	while ((bOK = ReadFile(hFile, buffer, BufferSize, &read, nullptr) != 0) && read > 0)
+		hasher.Update(buffer, read);
+	VirtualFree(buffer, 0, MEM_RELEASE);
+	CloseHandle(hFile);
+	if (!bOK)
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "couldn't read file");
+		return 2;
+	}
+	hasher.Push(L, bRaw);
+	return 1;
+}
+#pragma endregion
+
+#pragma region Compress
+enum class CompressFormat { LZ4, Deflate, Gzip };
+static const char* const CompressFormats[] = { "LZ4", "Deflate", "Gzip", nullptr };
+
+// XXH32, which LZ4 frames use for their checksums.
+struct XXH32State
+{
+	static constexpr uint32_t Prime1 = 0x9E3779B1U;
+	static constexpr uint32_t Prime2 = 0x85EBCA77U;
+	static constexpr uint32_t Prime3 = 0xC2B2AE3DU;
+	static constexpr uint32_t Prime4 = 0x27D4EB2FU;
+	static constexpr uint32_t Prime5 = 0x165667B1U;
+
+	uint32_t V[4];
+	uint8_t Buffer[16];
+	size_t Buffered;
+	uint64_t Total;
+
+	static uint32_t Round(uint32_t acc, uint32_t input)
+	{
+		return _rotl(acc + input * Prime2, 13) * Prime1;
+	}
+
+	void Reset()
+	{
+		V[0] = Prime1 + Prime2;
+		V[1] = Prime2;
+		V[2] = 0;
+		V[3] = 0 - Prime1;
+		Buffered = 0;
+		Total = 0;
+	}
+
+	void Update(const uint8_t* p, size_t len)
+	{
+		Total += len;
+		if (Buffered + len < sizeof(Buffer))
+		{
+			memcpy(Buffer + Buffered, p, len);
+			Buffered += len;
+			return;
+		}
+		if (Buffered > 0)
+		{
+			auto fill = sizeof(Buffer) - Buffered;
+			memcpy(Buffer + Buffered, p, fill);
+			for (int i = 0; i < 4; i++)
+				V[i] = Round(V[i], XXHRead32(Buffer + 4 * i));
+			p += fill;
+			len -= fill;
+		}
+		uint32_t v0 = V[0], v1 = V[1], v2 = V[2], v3 = V[3];
+		for (; len >= 16; p += 16, len -= 16)
+		{
+			v0 = Round(v0, XXHRead32(p));
+			v1 = Round(v1, XXHRead32(p + 4));
+			v2 = Round(v2, XXHRead32(p + 8));
+			v3 = Round(v3, XXHRead32(p + 12));
+		}
+		V[0] = v0;
+		V[1] = v1;
+		V[2] = v2;
+		V[3] = v3;
+		memcpy(Buffer, p, len);
+		Buffered = len;
+	}
+
+	uint32_t Digest() const
+	{
+		auto h = Total >= 16 ? _rotl(V[0], 1) + _rotl(V[1], 7) + _rotl(V[2], 12) + _rotl(V[3], 18) : Prime5;
+		h += (uint32_t)Total;
+		auto p = Buffer;
+		auto len = Buffered;
+		for (; len >= 4; p += 4, len -= 4)
+			h = _rotl(h + XXHRead32(p) * Prime3, 17) * Prime4;
+		for (; len > 0; p++, len--)
+			h = _rotl(h + *p * Prime5, 11) * Prime1;
+		h ^= h >> 15;
+		h *= Prime2;
+		h ^= h >> 13;
+		h *= Prime3;
+		return h ^ (h >> 16);
+	}
+};
+
+static uint32_t XXH32Hash(const uint8_t* p, size_t len)
+{
+	XXH32State state;
+	state.Reset();
+	state.Update(p, len);
+	return state.Digest();
+}
+
+constexpr size_t LZ4MinMatch = 4;
+// The last 5 bytes of a block are always literals, and the last match starts at least 12 bytes before the end.
+constexpr size_t LZ4LastLiterals = 5;
+constexpr size_t LZ4MatchFindLimit = 12;
+constexpr size_t LZ4MaxDistance = 65535;
+constexpr size_t LZ4MaxInput = 0x7E000000;
+constexpr uint32_t LZ4Magic = 0x184D2204;
+constexpr int LZ4MaxLevel = 12;
+
+inline size_t LZ4CompressBound(size_t len)
+{
+	return len + len / 255 + 16;
+}
+
+// Length of the common prefix of a and b, reading no further than limit on a.
+static size_t LZ4Count(const uint8_t* a, const uint8_t* b, const uint8_t* limit)
+{
+	auto start = a;
+	for (; a + 8 <= limit; a += 8, b += 8)
+	{
+		auto diff = XXHRead64(a) ^ XXHRead64(b);
+		if (diff)
+		{
+			unsigned long bit;
+			_BitScanForward64(&bit, diff);
+			return a - start + bit / 8;
+		}
+	}
+	while (a < limit && *a == *b)
+		a++, b++;
+	return a - start;
+}
+
+// A matchLen of 0 writes the final, literals only, sequence.
+static uint8_t* LZ4WriteSequence(uint8_t* op, const uint8_t* literals, size_t litLen, size_t offset, size_t matchLen)
+{
+	auto token = op++;
+	*token = (uint8_t)(std::min<size_t>(litLen, 15) << 4);
+	if (litLen >= 15)
+	{
+		auto n = litLen - 15;
+		for (; n >= 255; n -= 255)
+			*op++ = 255;
+		*op++ = (uint8_t)n;
+	}
+	memcpy(op, literals, litLen);
+	op += litLen;
+	if (matchLen == 0)
+		return op;
+	*op++ = (uint8_t)offset;
+	*op++ = (uint8_t)(offset >> 8);
+	auto n = matchLen - LZ4MinMatch;
+	*token |= (uint8_t)std::min<size_t>(n, 15);
+	if (n >= 15)
+	{
+		n -= 15;
+		for (; n >= 255; n -= 255)
+			*op++ = 255;
+		*op++ = (uint8_t)n;
+	}
+	return op;
+}
+
+// Levels 1 and 2 take the first match a hash table finds, higher levels search hash chains, twice as deep for each level.
+struct LZ4Encoder
+{
+	static constexpr int MaxHashLog = 16;
+
+	int Level;
+	int HashLog = MaxHashLog;
+	std::vector<uint32_t> Table;
+	std::vector<int32_t> Head;
+	// Distance back to the previous position with the same hash, indexed by position modulo the window.
+	std::vector<uint16_t> Prev;
+
+	LZ4Encoder(int level) : Level(level) {}
+
+	uint32_t Hash(const uint8_t* p) const
+	{
+		return (XXHRead32(p) * 2654435761U) >> (32 - HashLog);
+	}
+
+	// dst needs room for LZ4CompressBound(len) bytes.
+	size_t Compress(const uint8_t* src, size_t len, uint8_t* dst)
+	{
+		auto op = dst;
+		size_t anchor = 0;
+		if (len > LZ4MatchFindLimit)
+		{
+			// Small inputs don't pay for clearing a full size table.
+			HashLog = 10;
+			while (HashLog < MaxHashLog && ((size_t)1 << HashLog) < len)
+				HashLog++;
+			if (Level < 3)
+				op = CompressFast(src, len, op, anchor);
+			else
+				op = CompressChain(src, len, op, anchor);
+		}
+		return LZ4WriteSequence(op, src + anchor, len - anchor, 0, 0) - dst;
+	}
+
+	uint8_t* CompressFast(const uint8_t* src, size_t len, uint8_t* op, size_t& anchor)
+	{
+		Table.assign((size_t)1 << HashLog, 0);
+		auto mfLimit = len - LZ4MatchFindLimit;
+		auto matchLimit = src + len - LZ4LastLiterals;
+		size_t ip = 1;
+		Table[Hash(src)] = 0;
+		while (true)
+		{
+			size_t ref;
+			// The step grows while nothing matches, so incompressible data is skipped over quickly.
+			for (size_t misses = 0;; ip += 1 + (misses++ >> 6))
+			{
+				if (ip > mfLimit)
+					return op;
+				auto h = Hash(src + ip);
+				ref = Table[h];
+				Table[h] = (uint32_t)ip;
+				if (ip - ref <= LZ4MaxDistance && XXHRead32(src + ref) == XXHRead32(src + ip))
+					break;
+			}
+			while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1])
+				ip--, ref--;
+			auto matchLen = LZ4MinMatch + LZ4Count(src + ip + LZ4MinMatch, src + ref + LZ4MinMatch, matchLimit);
+			op = LZ4WriteSequence(op, src + anchor, ip - anchor, ip - ref, matchLen);
+			ip += matchLen;
+			anchor = ip;
+			if (ip > mfLimit)
+				return op;
+			Table[Hash(src + ip - 2)] = (uint32_t)(ip - 2);
+		}
+	}
+
+	uint8_t* CompressChain(const uint8_t* src, size_t len, uint8_t* op, size_t& anchor)
+	{
+		Head.assign((size_t)1 << HashLog, -1);
+		Prev.assign(LZ4MaxDistance + 1, 0xFFFF);
+		auto attempts = 1 << (std::min(Level, LZ4MaxLevel) - 2);
+		auto mfLimit = len - LZ4MatchFindLimit;
+		auto matchLimit = src + len - LZ4LastLiterals;
+		size_t inserted = 0;
+		// Longest match for pos among earlier positions, or 0.
+		auto Find = [&](size_t pos, size_t& ref) -> size_t
+		{
+			for (; inserted < pos; inserted++)
+			{
+				auto& head = Head[Hash(src + inserted)];
+				Prev[inserted & LZ4MaxDistance] = head < 0 || inserted - head >= 0xFFFF ? 0xFFFF : (uint16_t)(inserted - head);
+				head = (int32_t)inserted;
+			}
+			size_t best = LZ4MinMatch - 1;
+			auto cand = Head[Hash(src + pos)];
+			for (auto n = attempts; n > 0 && cand >= 0 && pos - cand <= LZ4MaxDistance; n--)
+			{
+				// Only a match that reaches past the best so far is worth counting.
+				if (src[cand + best] == src[pos + best])
+				{
+					auto length = LZ4Count(src + pos, src + cand, matchLimit);
+					if (length > best)
+					{
+						best = length;
+						ref = cand;
+						if (src + pos + length == matchLimit)
+							break;
+					}
+				}
+				auto distance = Prev[cand & LZ4MaxDistance];
+				if (distance == 0xFFFF)
+					break;
+				cand -= distance;
+			}
+			return best >= LZ4MinMatch ? best : 0;
+		};
+		size_t ip = 0;
+		while (ip <= mfLimit)
+		{
+			size_t ref;
+			auto matchLen = Find(ip, ref);
+			if (!matchLen)
+			{
+				ip++;
+				continue;
+			}
+			// A longer match starting one byte later is worth a literal.
+			size_t nextRef;
+			size_t next;
+			while (ip < mfLimit && (next = Find(ip + 1, nextRef)) > matchLen)
+			{
+				ip++;
+				matchLen = next;
+				ref = nextRef;
+			}
+			op = LZ4WriteSequence(op, src + anchor, ip - anchor, ip - ref, matchLen);
+			ip += matchLen;
+			anchor = ip;
+		}
+		return op;
+	}
+};
+
+// Decodes a block into out[prefix, cap), matches may reach back into out[0, prefix). Returns the end of the output, or SIZE_MAX if the block is corrupt.
+static size_t LZ4DecompressBlock(const uint8_t* src, size_t len, uint8_t* out, size_t prefix, size_t cap)
+{
+	auto ip = src;
+	auto end = src + len;
+	auto op = out + prefix;
+	auto oend = out + cap;
+	while (true)
+	{
+		if (ip >= end)
+			return SIZE_MAX;
+		auto token = *ip++;
+		size_t litLen = token >> 4;
+		if (litLen == 15)
+		{
+			uint8_t b;
+			do
+			{
+				if (ip >= end)
+					return SIZE_MAX;
+				b = *ip++;
+				litLen += b;
+			} while (b == 255);
+		}
+		if ((size_t)(end - ip) < litLen || (size_t)(oend - op) < litLen)
+			return SIZE_MAX;
+		if (litLen <= 16 && end - ip >= 16 && oend - op >= 16)
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(op), _mm_loadu_si128(reinterpret_cast<const __m128i*>(ip)));
+		else
+			memcpy(op, ip, litLen);
+		ip += litLen;
+		op += litLen;
+		if (ip == end)
+			return op - out;
+		if (end - ip < 2)
+			return SIZE_MAX;
+		size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - out))
+			return SIZE_MAX;
+		size_t matchLen = token & 15;
+		if (matchLen == 15)
+		{
+			uint8_t b;
+			do
+			{
+				if (ip >= end)
+					return SIZE_MAX;
+				b = *ip++;
+				matchLen += b;
+			} while (b == 255);
+		}
+		matchLen += LZ4MinMatch;
+		if ((size_t)(oend - op) < matchLen)
+			return SIZE_MAX;
+		auto match = op - offset;
+		// Overlapping copies repeat the pattern, so only far enough matches are copied in whole vectors.
+		if (offset >= 16 && (size_t)(oend - op) >= matchLen + 16)
+		{
+			for (size_t i = 0; i < matchLen; i += 16)
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(op + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(match + i)));
+		}
+		else
+		{
+			for (size_t i = 0; i < matchLen; i++)
+				op[i] = match[i];
+		}
+		op += matchLen;
+	}
+}
+
+// Writes the LZ4 frame format with independent 4 MB blocks and a content checksum, readable by the lz4 tool.
+struct LZ4FrameWriter
+{
+	static constexpr size_t BlockSize = 4 * 1024 * 1024;
+
+	LZ4Encoder Encoder;
+	std::vector<uint8_t> Input;
+	XXH32State Checksum;
+	bool bStarted = false;
+
+	LZ4FrameWriter(int level) : Encoder(level) {}
+
+	void Start(std::string& out, const uint64_t* contentSize = nullptr)
+	{
+		uint8_t header[15];
+		memcpy(header, &LZ4Magic, 4);
+		size_t n = 4;
+		header[n++] = 0x64 | (contentSize ? 0x08 : 0);
+		header[n++] = 0x70;
+		if (contentSize)
+		{
+			memcpy(header + n, contentSize, 8);
+			n += 8;
+		}
+		header[n] = (uint8_t)(XXH32Hash(header + 4, n - 4) >> 8);
+		out.append(reinterpret_cast<const char*>(header), n + 1);
+		Checksum.Reset();
+		bStarted = true;
+	}
+
+	// Blocks that don't shrink are stored as they are.
+	void Block(const uint8_t* p, size_t len, std::string& out)
+	{
+		auto start = out.size();
+		out.resize(start + 4 + LZ4CompressBound(len));
+		auto dst = reinterpret_cast<uint8_t*>(&out[start + 4]);
+		auto size = (uint32_t)Encoder.Compress(p, len, dst);
+		auto header = size;
+		if (size >= len)
+		{
+			memcpy(dst, p, len);
+			size = (uint32_t)len;
+			header = size | 0x80000000;
+		}
+		memcpy(&out[start], &header, 4);
+		out.resize(start + 4 + size);
+	}
+
+	void Update(const uint8_t* p, size_t len, std::string& out)
+	{
+		if (!bStarted)
+			Start(out);
+		Checksum.Update(p, len);
+		if (!Input.empty())
+		{
+			auto fill = std::min(len, BlockSize - Input.size());
+			Input.insert(Input.end(), p, p + fill);
+			p += fill;
+			len -= fill;
+			if (Input.size() < BlockSize)
+				return;
+			Block(Input.data(), Input.size(), out);
+			Input.clear();
+		}
+		for (; len >= BlockSize; p += BlockSize, len -= BlockSize)
+			Block(p, BlockSize, out);
+		Input.assign(p, p + len);
+	}
+
+	// Ends the frame, the next Update starts a new one.
+	void Finish(std::string& out)
+	{
+		if (!bStarted)
+			Start(out);
+		if (!Input.empty())
+			Block(Input.data(), Input.size(), out);
+		Input.clear();
+		uint32_t end[2] = { 0, Checksum.Digest() };
+		out.append(reinterpret_cast<const char*>(end), sizeof(end));
+		bStarted = false;
+	}
+};
+
+// Reads LZ4 frames from chunks of any size, including concatenated and skippable frames.
+struct LZ4FrameReader
+{
+	enum class Stage { Magic, Header, BlockSize, Block, Checksum, Skip };
+
+	std::string In;
+	size_t Pos = 0;
+	// Input bytes before the current chunk, for error positions.
+	uint64_t Consumed = 0;
+	Stage State = Stage::Magic;
+	uint8_t Flags = 0;
+	size_t BlockMax = 0;
+	uint32_t BlockLength = 0;
+	uint64_t ContentSize = 0;
+	uint64_t Produced = 0;
+	// Linked blocks keep the last 64 KB of output at the start of the window for matches to reach into.
+	std::vector<uint8_t> Window;
+	size_t History = 0;
+	XXH32State Checksum;
+	std::string Error;
+
+	int Fail(const char* msg)
+	{
+		Error = std::string(msg) + " at byte " + std::to_string(Consumed + Pos + 1);
+		return -1;
+	}
+
+	int EndFrame()
+	{
+		if (Flags & 0x08 && Produced != ContentSize)
+			return Fail("LZ4 content size mismatch");
+		State = Stage::Magic;
+		return 1;
+	}
+
+	// 1 after progress, 0 when more input is needed and -1 on errors.
+	int Step(const uint8_t* data, size_t size, std::string& out)
+	{
+		auto ip = data + Pos;
+		auto have = size - Pos;
+		switch (State)
+		{
+		case Stage::Magic:
+		{
+			if (have < 4)
+				return 0;
+			auto magic = XXHRead32(ip);
+			if ((magic & 0xFFFFFFF0) == 0x184D2A50)
+			{
+				if (have < 8)
+					return 0;
+				BlockLength = XXHRead32(ip + 4);
+				Pos += 8;
+				State = Stage::Skip;
+				return 1;
+			}
+			if (magic != LZ4Magic)
+				return Fail("not LZ4 frame data");
+			Pos += 4;
+			State = Stage::Header;
+			return 1;
+		}
+		case Stage::Header:
+		{
+			if (have < 3)
+				return 0;
+			auto flags = ip[0];
+			auto bd = ip[1];
+			auto blockId = (bd >> 4) & 7;
+			if ((flags >> 6) != 1 || (flags & 0x02) || (bd & 0x8F) || blockId < 4)
+				return Fail("unsupported LZ4 frame");
+			if (flags & 0x01)
+				return Fail("LZ4 dictionaries aren't supported");
+			size_t length = 3 + (flags & 0x08 ? 8 : 0);
+			if (have < length)
+				return 0;
+			if (ip[length - 1] != (uint8_t)(XXH32Hash(ip, length - 1) >> 8))
+				return Fail("LZ4 header checksum mismatch");
+			Flags = flags;
+			BlockMax = (size_t)1 << (8 + 2 * blockId);
+			ContentSize = flags & 0x08 ? XXHRead64(ip + 2) : 0;
+			Produced = 0;
+			History = 0;
+			Checksum.Reset();
+			Window.resize(LZ4MaxDistance + BlockMax);
+			Pos += length;
+			State = Stage::BlockSize;
+			return 1;
+		}
+		case Stage::BlockSize:
+		{
+			if (have < 4)
+				return 0;
+			auto length = XXHRead32(ip);
+			if (length == 0)
+			{
+				Pos += 4;
+				if (Flags & 0x04)
+				{
+					State = Stage::Checksum;
+					return 1;
+				}
+				return EndFrame();
+			}
+			if ((length & 0x7FFFFFFF) > BlockMax)
+				return Fail("corrupt LZ4 block size");
+			BlockLength = length;
+			Pos += 4;
+			State = Stage::Block;
+			return 1;
+		}
+		case Stage::Block:
+		{
+			size_t length = BlockLength & 0x7FFFFFFF;
+			auto need = length + (Flags & 0x10 ? 4 : 0);
+			if (have < need)
+				return 0;
+			if (Flags & 0x10 && XXH32Hash(ip, length) != XXHRead32(ip + length))
+				return Fail("LZ4 block checksum mismatch");
+			auto prefix = Flags & 0x20 ? 0 : History;
+			size_t end;
+			if (BlockLength & 0x80000000)
+			{
+				memcpy(Window.data() + prefix, ip, length);
+				end = prefix + length;
+			}
+			else if ((end = LZ4DecompressBlock(ip, length, Window.data(), prefix, prefix + BlockMax)) == SIZE_MAX)
+				return Fail("corrupt LZ4 block");
+			auto block = Window.data() + prefix;
+			out.append(reinterpret_cast<const char*>(block), end - prefix);
+			if (Flags & 0x04)
+				Checksum.Update(block, end - prefix);
+			Produced += end - prefix;
+			if (!(Flags & 0x20))
+			{
+				History = std::min(end, LZ4MaxDistance);
+				memmove(Window.data(), Window.data() + end - History, History);
+			}
+			Pos += need;
+			State = Stage::BlockSize;
+			return 1;
+		}
+		case Stage::Checksum:
+			if (have < 4)
+				return 0;
+			if (XXHRead32(ip) != Checksum.Digest())
+				return Fail("LZ4 content checksum mismatch");
+			Pos += 4;
+			return EndFrame();
+		case Stage::Skip:
+		{
+			auto n = std::min<size_t>(have, BlockLength);
+			Pos += n;
+			BlockLength -= (uint32_t)n;
+			if (BlockLength > 0)
+				return 0;
+			State = Stage::Magic;
+			return 1;
+		}
+		}
+		return -1;
+	}
+
+	// Appends whatever can be decoded to out. Errors are kept, and returned by every later call.
+	bool Update(const uint8_t* p, size_t len, std::string& out)
+	{
+		if (!Error.empty())
+			return false;
+		// Input is only copied when a previous chunk left a partial block behind.
+		auto data = p;
+		auto size = len;
+		if (!In.empty())
+		{
+			In.append(reinterpret_cast<const char*>(p), len);
+			data = reinterpret_cast<const uint8_t*>(In.data());
+			size = In.size();
+		}
+		Pos = 0;
+		int result;
+		while ((result = Step(data, size, out)) > 0) {}
+		Consumed += Pos;
+		if (In.empty())
+			In.assign(reinterpret_cast<const char*>(data + Pos), size - Pos);
+		else
+			In.erase(0, Pos);
+		Pos = 0;
+		return result == 0;
+	}
+
+	// Input that stops part way through a frame, or holds no frame at all, is an error.
+	bool Finish()
+	{
+		if (Error.empty() && (State != Stage::Magic || !In.empty() || Consumed == 0))
+			Error = "truncated LZ4 data";
+		return Error.empty();
+	}
+};
+
+// Deflate (RFC 1951), and the gzip wrapper around it (RFC 1952).
+constexpr size_t DeflateWindow = 32768;
+constexpr size_t DeflateMinMatch = 3;
+constexpr size_t DeflateMaxMatch = 258;
+constexpr size_t DeflateMaxInput = 0x7FFFFFFF;
+constexpr int DeflateMaxLevel = 9;
+
+static const uint16_t DeflateLengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t DeflateLengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DeflateDistBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DeflateDistExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t DeflateCodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// The CRC-32 gzip uses.
+static const CRC32Tables CRC32Gzip(0xEDB88320U);
+
+inline int DeflateLengthCode(size_t length)
+{
+	if (length == DeflateMaxMatch)
+		return 28;
+	auto l = (uint32_t)(length - DeflateMinMatch);
+	if (l < 8)
+		return (int)l;
+	unsigned long bit;
+	_BitScanReverse(&bit, l);
+	return (int)(4 * (bit - 1) + ((l >> (bit - 2)) & 3));
+}
+
+inline int DeflateDistCode(size_t dist)
+{
+	auto d = (uint32_t)(dist - 1);
+	if (d < 4)
+		return (int)d;
+	unsigned long bit;
+	_BitScanReverse(&bit, d);
+	return (int)(2 * bit + ((d >> (bit - 1)) & 1));
+}
+
+inline uint32_t DeflateReverse(uint32_t code, int bits)
+{
+	uint32_t result = 0;
+	for (int i = 0; i < bits; i++, code >>= 1)
+		result = (result << 1) | (code & 1);
+	return result;
+}
+
+// Huffman code lengths for freq, none longer than maxBits. Unused symbols get 0.
+static void DeflateBuildLengths(const uint32_t* freq, int n, int maxBits, uint8_t* lengths)
+{
+	int symbols[288];
+	int count = 0;
+	memset(lengths, 0, n);
+	for (int i = 0; i < n; i++)
+		if (freq[i])
+			symbols[count++] = i;
+	// Decoders want a complete code, so a lone symbol gets a partner.
+	if (count < 2)
+	{
+		auto other = count && symbols[0] != 0 ? symbols[0] : 1;
+		lengths[0] = lengths[other] = 1;
+		return;
+	}
+	std::sort(symbols, symbols + count, [&](int a, int b) { return freq[a] < freq[b] || (freq[a] == freq[b] && a < b); });
+
+	// Leaves are sorted and the internal nodes come out in order, so two queues build the tree.
+	uint64_t weight[2 * 288];
+	int parent[2 * 288];
+	int depth[2 * 288];
+	for (int i = 0; i < count; i++)
+		weight[i] = freq[symbols[i]];
+	int leaf = 0, next = count;
+	for (int k = count; k < 2 * count - 1; k++)
+	{
+		int pick[2];
+		for (auto& p : pick)
+			p = leaf < count && (next >= k || weight[leaf] <= weight[next]) ? leaf++ : next++;
+		weight[k] = weight[pick[0]] + weight[pick[1]];
+		parent[pick[0]] = parent[pick[1]] = k;
+	}
+	depth[2 * count - 2] = 0;
+	for (int k = 2 * count - 3; k >= 0; k--)
+		depth[k] = depth[parent[k]] + 1;
+
+	// Codes deeper than maxBits are cut short, then shorter codes are split until the lengths are valid again.
+	int lengthCount[16] = {};
+	for (int i = 0; i < count; i++)
+		lengthCount[std::min(depth[i], maxBits)]++;
+	uint32_t total = 0;
+	for (int i = 1; i <= maxBits; i++)
+		total += (uint32_t)lengthCount[i] << (maxBits - i);
+	for (; total > (1U << maxBits); total--)
+	{
+		lengthCount[maxBits]--;
+		for (int i = maxBits - 1; i > 0; i--)
+		{
+			if (lengthCount[i])
+			{
+				lengthCount[i]--;
+				lengthCount[i + 1] += 2;
+				break;
+			}
+		}
+	}
+	// The least frequent symbols get the longest codes.
+	int s = 0;
+	for (int len = maxBits; len > 0; len--)
+		for (int c = lengthCount[len]; c > 0; c--)
+			lengths[symbols[s++]] = (uint8_t)len;
+}
+
+// Canonical codes for lengths, bit reversed since deflate writes them from the low bit up.
+static void DeflateBuildCodes(const uint8_t* lengths, int n, uint16_t* codes)
+{
+	uint16_t count[16] = {};
+	uint16_t next[16];
+	for (int i = 0; i < n; i++)
+		count[lengths[i]]++;
+	count[0] = 0;
+	uint16_t code = 0;
+	for (int len = 1; len < 16; len++)
+	{
+		code = (code + count[len - 1]) << 1;
+		next[len] = code;
+	}
+	for (int i = 0; i < n; i++)
+		codes[i] = lengths[i] ? (uint16_t)DeflateReverse(next[lengths[i]]++, lengths[i]) : 0;
+}
+
+// Codes up to FastBits long are found with one lookup, longer ones are walked a bit at a time.
+struct HuffmanTable
+{
+	static constexpr int FastBits = 10;
+
+	// Symbol << 4 | length, 0 for codes longer than FastBits.
+	uint16_t Fast[1 << FastBits];
+	uint16_t Count[16];
+	uint16_t Symbols[288];
+
+	// False for lengths that describe more codes than fit. Incomplete codes are fine until a missing code is read.
+	bool Build(const uint8_t* lengths, int n)
+	{
+		memset(Count, 0, sizeof(Count));
+		for (int i = 0; i < n; i++)
+			Count[lengths[i]]++;
+		Count[0] = 0;
+		int left = 1;
+		for (int len = 1; len < 16; len++)
+		{
+			left = (left << 1) - Count[len];
+			if (left < 0)
+				return false;
+		}
+		uint16_t offsets[16];
+		offsets[1] = 0;
+		for (int len = 1; len < 15; len++)
+			offsets[len + 1] = offsets[len] + Count[len];
+		for (int i = 0; i < n; i++)
+			if (lengths[i])
+				Symbols[offsets[lengths[i]]++] = (uint16_t)i;
+
+		memset(Fast, 0, sizeof(Fast));
+		uint32_t code = 0;
+		int index = 0;
+		for (int len = 1; len <= FastBits; len++, code <<= 1)
+		{
+			for (int c = 0; c < Count[len]; c++, code++, index++)
+			{
+				auto entry = (uint16_t)(Symbols[index] << 4 | len);
+				for (auto k = DeflateReverse(code, len); k < (1U << FastBits); k += 1U << len)
+					Fast[k] = entry;
+			}
+		}
+		return true;
+	}
+
+	// The symbol at the low end of bits, or -1 for a code that isn't in the table.
+	int Decode(uint64_t bits, int& length) const
+	{
+		auto entry = Fast[bits & ((1 << FastBits) - 1)];
+		if (entry)
+		{
+			length = entry & 15;
+			return entry >> 4;
+		}
+		int code = 0, first = 0, index = 0;
+		for (int len = 1; len < 16; len++)
+		{
+			code |= (int)(bits >> (len - 1)) & 1;
+			int count = Count[len];
+			if (code - count < first)
+			{
+				length = len;
+				return Symbols[index + (code - first)];
+			}
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+};
+
+struct DeflateFixedTables
+{
+	uint8_t LitLengths[288];
+	uint16_t LitCodes[288];
+	uint8_t DistLengths[30];
+	uint16_t DistCodes[30];
+	HuffmanTable LitLen;
+	HuffmanTable Dist;
+
+	DeflateFixedTables()
+	{
+		for (int i = 0; i < 288; i++)
+			LitLengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+		memset(DistLengths, 5, sizeof(DistLengths));
+		DeflateBuildCodes(LitLengths, 288, LitCodes);
+		DeflateBuildCodes(DistLengths, 30, DistCodes);
+		LitLen.Build(LitLengths, 288);
+		Dist.Build(DistLengths, 30);
+	}
+};
+static const DeflateFixedTables DeflateFixed;
+
+// A literal when Dist is 0, otherwise a match of LitLen bytes.
+struct DeflateSymbol
+{
+	uint16_t LitLen;
+	uint16_t Dist;
+};
+
+// Hash chain LZ77 like LZ4Encoder, with zlib's search limits for levels 1 to 9 and 0 storing the input as it is.
+// Each block is written with whichever of dynamic codes, the fixed codes or stored bytes comes out smallest.
+struct DeflateEncoder
+{
+	static constexpr int HashBits = 15;
+	static constexpr size_t MaxSymbols = 16384;
+
+	// Searches are cut to a quarter past Good, and stop at Nice. From level 4 up a match shorter than Lazy is checked
+	// against the next position, below that longer matches than Lazy don't add their positions to the chains.
+	struct LevelParams { size_t Good, Lazy, Nice; int Chain; };
+	static constexpr LevelParams Levels[DeflateMaxLevel + 1] = {
+		{ 0, 0, 0, 0 }, { 4, 4, 8, 4 }, { 4, 5, 16, 8 }, { 4, 6, 32, 32 }, { 4, 4, 16, 16 },
+		{ 8, 16, 32, 32 }, { 8, 16, 128, 128 }, { 8, 32, 128, 256 }, { 32, 128, 258, 1024 }, { 32, 258, 258, 4096 }
+	};
+
+	int Level;
+	// Positions are into the caller's buffer, Prev is indexed by position modulo the window.
+	std::vector<int32_t> Head;
+	std::vector<int32_t> Prev;
+	size_t Inserted = 0;
+	std::vector<DeflateSymbol> Symbols;
+	uint64_t BitBuffer = 0;
+	int BitCount = 0;
+
+	DeflateEncoder(int level) : Level(level) {}
+
+	void Reset()
+	{
+		if (Level > 0)
+		{
+			Head.assign((size_t)1 << HashBits, -1);
+			Prev.assign(DeflateWindow, -1);
+		}
+		Inserted = 0;
+		Symbols.clear();
+		BitBuffer = 0;
+		BitCount = 0;
+	}
+
+	static uint32_t Hash(const uint8_t* p)
+	{
+		return ((uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]) * 2654435761U >> (32 - HashBits);
+	}
+
+	// Moves every position back by shift, a whole number of windows, after the caller drops that much from its buffer.
+	void Slide(size_t shift)
+	{
+		auto s = (int32_t)shift;
+		for (auto& h : Head)
+			h = h >= s ? h - s : -1;
+		for (auto& p : Prev)
+			p = p >= s ? p - s : -1;
+		Inserted -= std::min(Inserted, shift);
+	}
+
+	void Insert(const uint8_t* base, size_t to, size_t end)
+	{
+		for (; Inserted < to && Inserted + DeflateMinMatch <= end; Inserted++)
+		{
+			auto& head = Head[Hash(base + Inserted)];
+			Prev[Inserted & (DeflateWindow - 1)] = head;
+			head = (int32_t)Inserted;
+		}
+	}
+
+	// Longest match for pos that beats best, with its distance in dist.
+	size_t Find(const uint8_t* base, size_t pos, size_t end, size_t best, size_t& dist) const
+	{
+		auto& params = Levels[Level];
+		auto maxLength = std::min(end - pos, DeflateMaxMatch);
+		if (best >= maxLength)
+			return best;
+		auto cand = Head[Hash(base + pos)];
+		for (int attempts = best >= params.Good ? params.Chain >> 2 : params.Chain; cand >= 0 && pos - cand <= DeflateWindow && attempts > 0; attempts--)
+		{
+			if (base[cand + best] == base[pos + best])
+			{
+				auto length = LZ4Count(base + pos, base + cand, base + pos + maxLength);
+				if (length > best)
+				{
+					best = length;
+					dist = pos - cand;
+					if (length >= params.Nice || length == maxLength)
+						break;
+				}
+			}
+			auto prev = Prev[cand & (DeflateWindow - 1)];
+			if (prev >= cand)
+				break;
+			cand = prev;
+		}
+		return best;
+	}
+
+	void PutBits(std::string& out, uint32_t bits, int n)
+	{
+		BitBuffer |= (uint64_t)bits << BitCount;
+		BitCount += n;
+		if (BitCount >= 32)
+		{
+			auto word = (uint32_t)BitBuffer;
+			out.append(reinterpret_cast<const char*>(&word), 4);
+			BitBuffer >>= 32;
+			BitCount -= 32;
+		}
+	}
+
+	// Pads to a byte boundary and writes out everything pending.
+	void AlignBits(std::string& out)
+	{
+		for (; BitCount > 0; BitCount -= 8, BitBuffer >>= 8)
+			out.push_back((char)BitBuffer);
+		BitCount = 0;
+		BitBuffer = 0;
+	}
+
+	void WriteStored(const uint8_t* p, size_t len, bool bFinal, std::string& out)
+	{
+		do
+		{
+			auto n = (uint16_t)std::min<size_t>(len, 65535);
+			PutBits(out, bFinal && n == len, 3);
+			AlignBits(out);
+			uint16_t header[2] = { n, (uint16_t)~n };
+			out.append(reinterpret_cast<const char*>(header), 4);
+			out.append(reinterpret_cast<const char*>(p), n);
+			p += n;
+			len -= n;
+		} while (len > 0);
+	}
+
+	void WriteSymbols(const uint8_t* litLengths, const uint16_t* litCodes, const uint8_t* distLengths, const uint16_t* distCodes, std::string& out)
+	{
+		for (auto& s : Symbols)
+		{
+			if (!s.Dist)
+			{
+				PutBits(out, litCodes[s.LitLen], litLengths[s.LitLen]);
+				continue;
+			}
+			auto lc = DeflateLengthCode(s.LitLen);
+			PutBits(out, litCodes[257 + lc], litLengths[257 + lc]);
+			PutBits(out, s.LitLen - DeflateLengthBase[lc], DeflateLengthExtra[lc]);
+			auto dc = DeflateDistCode(s.Dist);
+			PutBits(out, distCodes[dc], distLengths[dc]);
+			PutBits(out, s.Dist - DeflateDistBase[dc], DeflateDistExtra[dc]);
+		}
+		PutBits(out, litCodes[256], litLengths[256]);
+	}
+
+	// Writes Symbols, which cover the len bytes at p, as one block.
+	void WriteBlock(const uint8_t* p, size_t len, bool bFinal, std::string& out)
+	{
+		uint32_t litFreq[286] = {};
+		uint32_t distFreq[30] = {};
+		uint64_t extraBits = 0;
+		for (auto& s : Symbols)
+		{
+			if (!s.Dist)
+			{
+				litFreq[s.LitLen]++;
+				continue;
+			}
+			auto lc = DeflateLengthCode(s.LitLen);
+			auto dc = DeflateDistCode(s.Dist);
+			litFreq[257 + lc]++;
+			distFreq[dc]++;
+			extraBits += DeflateLengthExtra[lc] + DeflateDistExtra[dc];
+		}
+		litFreq[256] = 1;
+
+		uint8_t litLengths[286], distLengths[30];
+		DeflateBuildLengths(litFreq, 286, 15, litLengths);
+		DeflateBuildLengths(distFreq, 30, 15, distLengths);
+		int hlit = 286, hdist = 30;
+		while (hlit > 257 && !litLengths[hlit - 1])
+			hlit--;
+		while (hdist > 1 && !distLengths[hdist - 1])
+			hdist--;
+
+		// The code lengths are themselves run length coded, then Huffman coded.
+		uint8_t all[286 + 30];
+		memcpy(all, litLengths, hlit);
+		memcpy(all + hlit, distLengths, hdist);
+		struct CodeLengthRun { uint8_t Symbol, Extra; } runs[286 + 30];
+		int runCount = 0;
+		uint32_t clFreq[19] = {};
+		for (int i = 0, total = hlit + hdist; i < total;)
+		{
+			auto value = all[i];
+			int run = 1;
+			while (i + run < total && all[i + run] == value)
+				run++;
+			if (value == 0 && run >= 3)
+			{
+				run = std::min(run, 138);
+				runs[runCount++] = run >= 11 ? CodeLengthRun{ 18, (uint8_t)(run - 11) } : CodeLengthRun{ 17, (uint8_t)(run - 3) };
+				i += run;
+			}
+			else if (value != 0 && run >= 4)
+			{
+				run = std::min(run - 1, 6);
+				runs[runCount++] = { value, 0 };
+				runs[runCount++] = { 16, (uint8_t)(run - 3) };
+				i += 1 + run;
+			}
+			else
+			{
+				runs[runCount++] = { value, 0 };
+				i++;
+			}
+		}
+		for (int i = 0; i < runCount; i++)
+			clFreq[runs[i].Symbol]++;
+		uint8_t clLengths[19];
+		DeflateBuildLengths(clFreq, 19, 7, clLengths);
+		int hclen = 19;
+		while (hclen > 4 && !clLengths[DeflateCodeLengthOrder[hclen - 1]])
+			hclen--;
+
+		static const uint8_t RunExtraBits[3] = { 2, 3, 7 };
+		uint64_t dynamicBits = 3 + 14 + 3 * hclen + extraBits;
+		uint64_t fixedBits = 3 + extraBits;
+		for (int i = 0; i < runCount; i++)
+			dynamicBits += clLengths[runs[i].Symbol] + (runs[i].Symbol >= 16 ? RunExtraBits[runs[i].Symbol - 16] : 0);
+		for (int i = 0; i < 286; i++)
+		{
+			dynamicBits += (uint64_t)litFreq[i] * litLengths[i];
+			fixedBits += (uint64_t)litFreq[i] * DeflateFixed.LitLengths[i];
+		}
+		for (int i = 0; i < 30; i++)
+		{
+			dynamicBits += (uint64_t)distFreq[i] * distLengths[i];
+			fixedBits += (uint64_t)distFreq[i] * 5;
+		}
+		auto storedBits = (len + 5 * (len / 65535 + 1)) * 8 + 7;
+
+		if ((Symbols.empty() && len > 0) || storedBits < std::min(dynamicBits, fixedBits))
+			WriteStored(p, len, bFinal, out);
+		else if (fixedBits <= dynamicBits)
+		{
+			PutBits(out, bFinal | 1 << 1, 3);
+			WriteSymbols(DeflateFixed.LitLengths, DeflateFixed.LitCodes, DeflateFixed.DistLengths, DeflateFixed.DistCodes, out);
+		}
+		else
+		{
+			uint16_t litCodes[286], distCodes[30], clCodes[19];
+			DeflateBuildCodes(litLengths, 286, litCodes);
+			DeflateBuildCodes(distLengths, 30, distCodes);
+			DeflateBuildCodes(clLengths, 19, clCodes);
+			PutBits(out, bFinal | 2 << 1, 3);
+			PutBits(out, hlit - 257, 5);
+			PutBits(out, hdist - 1, 5);
+			PutBits(out, hclen - 4, 4);
+			for (int i = 0; i < hclen; i++)
+				PutBits(out, clLengths[DeflateCodeLengthOrder[i]], 3);
+			for (int i = 0; i < runCount; i++)
+			{
+				auto symbol = runs[i].Symbol;
+				PutBits(out, clCodes[symbol], clLengths[symbol]);
+				if (symbol >= 16)
+					PutBits(out, runs[i].Extra, RunExtraBits[symbol - 16]);
+			}
+			WriteSymbols(litLengths, litCodes, distLengths, distCodes, out);
+		}
+		Symbols.clear();
+	}
+
+	// Compresses base[start, end), with anything before start usable as history. Unless bFinal, the last
+	// DeflateMaxMatch bytes are left for the next call so matches aren't cut short. Returns where it stopped.
+	size_t Compress(const uint8_t* base, size_t start, size_t end, bool bFinal, std::string& out)
+	{
+		auto limit = bFinal ? end : end - start > DeflateMaxMatch ? end - DeflateMaxMatch : start;
+		auto pos = start;
+		auto blockStart = start;
+		if (Level == 0)
+			pos = limit;
+		auto& params = Levels[Level];
+		auto bLazy = Level >= 4;
+		while (pos < limit)
+		{
+			size_t length = 0, dist = 0;
+			if (pos + DeflateMinMatch <= end)
+			{
+				Insert(base, pos, end);
+				length = Find(base, pos, end, DeflateMinMatch - 1, dist);
+				// A short match far back costs more than its literals.
+				if (length == DeflateMinMatch && dist > 4096)
+					length = 0;
+			}
+			// Lazy matching: a longer match one byte on wins over this one.
+			while (bLazy && length >= DeflateMinMatch && length < params.Lazy && pos + 1 + DeflateMinMatch <= end)
+			{
+				Insert(base, pos + 1, end);
+				size_t nextDist = 0;
+				auto next = Find(base, pos + 1, end, length, nextDist);
+				if (next <= length)
+					break;
+				Symbols.push_back({ base[pos], 0 });
+				pos++;
+				length = next;
+				dist = nextDist;
+			}
+			if (length >= DeflateMinMatch)
+			{
+				Symbols.push_back({ (uint16_t)length, (uint16_t)dist });
+				pos += length;
+				if (!bLazy && length > params.Lazy)
+					Inserted = std::max(Inserted, pos);
+			}
+			else
+				Symbols.push_back({ base[pos++], 0 });
+			if (Symbols.size() >= MaxSymbols)
+			{
+				WriteBlock(base + blockStart, pos - blockStart, false, out);
+				blockStart = pos;
+			}
+		}
+		if (bFinal || pos > blockStart)
+			WriteBlock(base + blockStart, pos - blockStart, bFinal, out);
+		if (bFinal)
+			AlignBits(out);
+		return pos;
+	}
+};
+
+// Writes raw deflate or a gzip member, compressing in 256 KB steps as input arrives.
+struct DeflateWriter
+{
+	static constexpr size_t StepSize = 256 * 1024;
+
+	bool bGzip;
+	DeflateEncoder Encoder;
+	// The last window of input already compressed, followed by what's still to do.
+	std::vector<uint8_t> Data;
+	size_t Processed = 0;
+	uint32_t CRC = 0;
+	uint32_t Size = 0;
+	bool bStarted = false;
+
+	DeflateWriter(bool gzip, int level) : bGzip(gzip), Encoder(level) {}
+
+	void Start(std::string& out)
+	{
+		if (bGzip)
+		{
+			static const uint8_t Header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+			out.append(reinterpret_cast<const char*>(Header), sizeof(Header));
+		}
+		Encoder.Reset();
+		Data.clear();
+		Processed = 0;
+		CRC = 0xFFFFFFFF;
+		Size = 0;
+		bStarted = true;
+	}
+
+	void Checksum(const uint8_t* p, size_t len)
+	{
+		if (bGzip)
+			CRC = CRC32Gzip.Update(CRC, p, len);
+		Size += (uint32_t)len;
+	}
+
+	void End(std::string& out)
+	{
+		if (bGzip)
+		{
+			uint32_t trailer[2] = { ~CRC, Size };
+			out.append(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+		}
+		bStarted = false;
+	}
+
+	void Update(const uint8_t* p, size_t len, std::string& out)
+	{
+		if (!bStarted)
+			Start(out);
+		Checksum(p, len);
+		Data.insert(Data.end(), p, p + len);
+		if (Data.size() - Processed < StepSize + DeflateMaxMatch)
+			return;
+		Processed = Encoder.Compress(Data.data(), Processed, Data.size(), false, out);
+		// Dropping whole windows keeps positions the same modulo the window.
+		if (Processed > 2 * DeflateWindow)
+		{
+			auto shift = (Processed - DeflateWindow) / DeflateWindow * DeflateWindow;
+			Data.erase(Data.begin(), Data.begin() + shift);
+			Processed -= shift;
+			Encoder.Slide(shift);
+		}
+	}
+
+	void Finish(std::string& out)
+	{
+		if (!bStarted)
+			Start(out);
+		Encoder.Compress(Data.data(), Processed, Data.size(), true, out);
+		End(out);
+		Data.clear();
+	}
+
+	// All of p at once, without copying it. len must be at most DeflateMaxInput.
+	void Compress(const uint8_t* p, size_t len, std::string& out)
+	{
+		Start(out);
+		Checksum(p, len);
+		Encoder.Compress(p, 0, len, true, out);
+		End(out);
+	}
+};
+
+// Streaming decoder for raw deflate, or gzip with any number of members. Output is appended to the caller's
+// string, which doubles as the window, so it has to keep at least the last 32 KB between calls.
+struct Inflater
+{
+	enum class Stage { GzipHeader, BlockHeader, Stored, Codes, GzipTrailer, Done };
+
+	bool bGzip;
+	Stage State;
+	std::string In;
+	// In bits, into In.
+	size_t BitPos = 0;
+	uint64_t Consumed = 0;
+	bool bLastBlock = false;
+	uint32_t StoredLeft = 0;
+	HuffmanTable LitLen;
+	HuffmanTable Dist;
+	const HuffmanTable* CurrentLitLen = nullptr;
+	const HuffmanTable* CurrentDist = nullptr;
+	uint32_t CRC = 0;
+	uint32_t Size = 0;
+	// Output before this has been added to CRC and Size.
+	size_t Checked = 0;
+	std::string Error;
+
+	Inflater(bool gzip) : bGzip(gzip), State(gzip ? Stage::GzipHeader : Stage::BlockHeader) {}
+
+	int Fail(const char* msg)
+	{
+		Error = std::string(msg) + " at byte " + std::to_string(Consumed + BitPos / 8 + 1);
+		return -1;
+	}
+
+	// At least 57 bits from pos on, zeros past the end of the input.
+	uint64_t Peek(size_t pos) const
+	{
+		auto byte = pos / 8;
+		uint64_t v = 0;
+		if (byte + 8 <= In.size())
+			memcpy(&v, In.data() + byte, 8);
+		else if (byte < In.size())
+			memcpy(&v, In.data() + byte, In.size() - byte);
+		return v >> (pos & 7);
+	}
+
+	void Check(const std::string& out, size_t outPos)
+	{
+		if (bGzip)
+		{
+			CRC = CRC32Gzip.Update(CRC, reinterpret_cast<const uint8_t*>(out.data()) + Checked, outPos - Checked);
+			Size += (uint32_t)(outPos - Checked);
+		}
+		Checked = outPos;
+	}
+
+	int EndBlock()
+	{
+		State = !bLastBlock ? Stage::BlockHeader : bGzip ? Stage::GzipTrailer : Stage::Done;
+		return 1;
+	}
+
+	// Reads the whole block header at once, or waits for more input.
+	int ReadBlockHeader()
+	{
+		auto pos = BitPos;
+		auto available = In.size() * 8;
+		auto bits = [&](int n)
+		{
+			auto v = (uint32_t)(Peek(pos) & ((1U << n) - 1));
+			pos += n;
+			return v;
+		};
+		if (pos + 3 > available)
+			return 0;
+		bLastBlock = bits(1);
+		auto type = bits(2);
+		if (type == 0)
+		{
+			pos = (pos + 7) & ~(size_t)7;
+			if (pos + 32 > available)
+				return 0;
+			auto length = bits(16);
+			if (length != (~bits(16) & 0xFFFF))
+				return Fail("corrupt deflate stored block");
+			StoredLeft = length;
+			BitPos = pos;
+			State = Stage::Stored;
+			return 1;
+		}
+		if (type == 1)
+		{
+			CurrentLitLen = &DeflateFixed.LitLen;
+			CurrentDist = &DeflateFixed.Dist;
+			BitPos = pos;
+			State = Stage::Codes;
+			return 1;
+		}
+		if (type == 3)
+			return Fail("invalid deflate block type");
+
+		if (pos + 14 > available)
+			return 0;
+		int hlit = bits(5) + 257;
+		int hdist = bits(5) + 1;
+		int hclen = bits(4) + 4;
+		if (hlit > 286 || hdist > 30)
+			return Fail("corrupt deflate block header");
+		if (pos + 3 * hclen > available)
+			return 0;
+		uint8_t clLengths[19] = {};
+		for (int i = 0; i < hclen; i++)
+			clLengths[DeflateCodeLengthOrder[i]] = (uint8_t)bits(3);
+		HuffmanTable cl;
+		if (!cl.Build(clLengths, 19))
+			return Fail("corrupt deflate block header");
+		uint8_t lengths[286 + 30];
+		for (int i = 0; i < hlit + hdist;)
+		{
+			int length;
+			auto symbol = cl.Decode(Peek(pos), length);
+			if (symbol < 0)
+				return pos + 7 > available ? 0 : Fail("corrupt deflate block header");
+			if (pos + length + (symbol < 16 ? 0 : 7) > available)
+				return 0;
+			pos += length;
+			if (symbol < 16)
+			{
+				lengths[i++] = (uint8_t)symbol;
+				continue;
+			}
+			uint8_t value = 0;
+			int repeat;
+			if (symbol == 16)
+			{
+				if (i == 0)
+					return Fail("corrupt deflate block header");
+				value = lengths[i - 1];
+				repeat = 3 + bits(2);
+			}
+			else if (symbol == 17)
+				repeat = 3 + bits(3);
+			else
+				repeat = 11 + bits(7);
+			if (i + repeat > hlit + hdist)
+				return Fail("corrupt deflate block header");
+			memset(lengths + i, value, repeat);
+			i += repeat;
+		}
+		if (!lengths[256] || !LitLen.Build(lengths, hlit) || !Dist.Build(lengths + hlit, hdist))
+			return Fail("corrupt deflate block header");
+		CurrentLitLen = &LitLen;
+		CurrentDist = &Dist;
+		BitPos = pos;
+		State = Stage::Codes;
+		return 1;
+	}
+
+	// Each symbol is only taken once all of its bits are there, so running out of input just means waiting.
+	int ReadCodes(std::string& out, size_t& outPos)
+	{
+		auto available = In.size() * 8;
+		auto litLen = CurrentLitLen;
+		auto dist = CurrentDist;
+		for (;;)
+		{
+			if (outPos + DeflateMaxMatch + 16 > out.size())
+				out.resize(std::max(out.size() * 2, outPos + 65536));
+			auto bits = Peek(BitPos);
+			int used;
+			auto symbol = litLen->Decode(bits, used);
+			if (symbol < 0)
+				return BitPos + 15 > available ? 0 : Fail("corrupt deflate data");
+			if (symbol < 256)
+			{
+				if (BitPos + used > available)
+					return 0;
+				BitPos += used;
+				out[outPos++] = (char)symbol;
+				continue;
+			}
+			if (symbol == 256)
+			{
+				if (BitPos + used > available)
+					return 0;
+				BitPos += used;
+				return EndBlock();
+			}
+			if (symbol > 285)
+				return Fail("corrupt deflate data");
+			auto lc = symbol - 257;
+			size_t length = DeflateLengthBase[lc] + (size_t)((bits >> used) & ((1U << DeflateLengthExtra[lc]) - 1));
+			used += DeflateLengthExtra[lc];
+			int distUsed;
+			auto dc = dist->Decode(bits >> used, distUsed);
+			if (dc < 0 || dc >= 30)
+				return BitPos + used + 15 > available ? 0 : Fail("corrupt deflate data");
+			used += distUsed;
+			size_t offset = DeflateDistBase[dc] + (size_t)((bits >> used) & ((1U << DeflateDistExtra[dc]) - 1));
+			used += DeflateDistExtra[dc];
+			if (BitPos + used > available)
+				return 0;
+			if (offset > outPos)
+				return Fail("deflate distance too far back");
+			BitPos += used;
+			auto op = reinterpret_cast<uint8_t*>(&out[outPos]);
+			auto match = op - offset;
+			if (offset >= 16)
+			{
+				for (size_t i = 0; i < length; i += 16)
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(op + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(match + i)));
+			}
+			else
+			{
+				for (size_t i = 0; i < length; i++)
+					op[i] = match[i];
+			}
+			outPos += length;
+		}
+	}
+
+	// 1 after making progress, 0 when more input is needed and -1 on errors.
+	int Step(std::string& out, size_t& outPos)
+	{
+		auto byte = BitPos / 8;
+		auto ip = reinterpret_cast<const uint8_t*>(In.data()) + byte;
+		auto have = In.size() - byte;
+		switch (State)
+		{
+		case Stage::GzipHeader:
+		{
+			if (have < 10)
+				return 0;
+			if (ip[0] != 0x1F || ip[1] != 0x8B)
+				return Fail("not gzip data");
+			if (ip[2] != 8 || (ip[3] & 0xE0))
+				return Fail("unsupported gzip header");
+			auto flags = ip[3];
+			size_t length = 10;
+			if (flags & 0x04)
+			{
+				if (have < length + 2)
+					return 0;
+				length += 2 + (ip[length] | ip[length + 1] << 8);
+			}
+			// File name and comment, both zero terminated.
+			for (auto flag : { 0x08, 0x10 })
+			{
+				if (!(flags & flag))
+					continue;
+				auto zero = length < have ? memchr(ip + length, 0, have - length) : nullptr;
+				if (!zero)
+					return 0;
+				length = static_cast<const uint8_t*>(zero) - ip + 1;
+			}
+			if (flags & 0x02)
+				length += 2;
+			if (have < length)
+				return 0;
+			BitPos += length * 8;
+			CRC = 0xFFFFFFFF;
+			Size = 0;
+			Checked = outPos;
+			State = Stage::BlockHeader;
+			return 1;
+		}
+		case Stage::BlockHeader:
+			return ReadBlockHeader();
+		case Stage::Stored:
+		{
+			if (StoredLeft > 0)
+			{
+				if (have == 0)
+					return 0;
+				auto n = std::min<size_t>(have, StoredLeft);
+				if (outPos + n > out.size())
+					out.resize(std::max(out.size() * 2, outPos + n));
+				memcpy(&out[outPos], ip, n);
+				outPos += n;
+				BitPos += n * 8;
+				StoredLeft -= (uint32_t)n;
+				if (StoredLeft > 0)
+					return 1;
+			}
+			return EndBlock();
+		}
+		case Stage::Codes:
+			return ReadCodes(out, outPos);
+		case Stage::GzipTrailer:
+		{
+			auto aligned = (BitPos + 7) / 8;
+			if (In.size() < aligned + 8)
+				return 0;
+			BitPos = aligned * 8;
+			Check(out, outPos);
+			ip = reinterpret_cast<const uint8_t*>(In.data()) + aligned;
+			if (XXHRead32(ip) != ~CRC)
+				return Fail("gzip checksum mismatch");
+			if (XXHRead32(ip + 4) != Size)
+				return Fail("gzip size mismatch");
+			BitPos += 64;
+			State = Stage::Done;
+			return 1;
+		}
+		case Stage::Done:
+		{
+			// Another gzip member may follow. Anything else after the end is ignored, as gzip does.
+			if (bGzip && have < 2)
+				return 0;
+			if (bGzip && ip[0] == 0x1F && ip[1] == 0x8B)
+			{
+				State = Stage::GzipHeader;
+				return 1;
+			}
+			BitPos = In.size() * 8;
+			return 0;
+		}
+		}
+		return -1;
+	}
+
+	// Appends whatever can be decoded to out. Errors are kept, and returned by every later call.
+	bool Update(const uint8_t* p, size_t len, std::string& out)
+	{
+		if (!Error.empty())
+			return false;
+		In.append(reinterpret_cast<const char*>(p), len);
+		auto outPos = out.size();
+		Checked = outPos;
+		int result;
+		while ((result = Step(out, outPos)) > 0) {}
+		Check(out, outPos);
+		out.resize(outPos);
+		auto drop = BitPos / 8;
+		In.erase(0, drop);
+		Consumed += drop;
+		BitPos -= drop * 8;
+		return result == 0;
+	}
+
+	// Input that stops before the end of the stream is an error.
+	bool Finish()
+	{
+		if (Error.empty() && State != Stage::Done)
+			Error = bGzip ? "truncated gzip data" : "truncated deflate data";
+		return Error.empty();
+	}
+};
+
+struct Compressor
+{
+	static constexpr const char* MetaName = "ProddyUtils.Compressor";
+
+	CompressFormat Format;
+	LZ4FrameWriter LZ4;
+	DeflateWriter Deflate;
+	std::string Out;
+
+	Compressor(CompressFormat format, int level) : Format(format), LZ4(level), Deflate(format == CompressFormat::Gzip, level) {}
+
+	void Update(const uint8_t* p, size_t len)
+	{
+		Out.clear();
+		if (Format == CompressFormat::LZ4)
+			LZ4.Update(p, len, Out);
+		else
+			Deflate.Update(p, len, Out);
+	}
+
+	void Finish()
+	{
+		Out.clear();
+		if (Format == CompressFormat::LZ4)
+			LZ4.Finish(Out);
+		else
+			Deflate.Finish(Out);
+	}
+};
+
+struct Decompressor
+{
+	static constexpr const char* MetaName = "ProddyUtils.Decompressor";
+
+	CompressFormat Format;
+	LZ4FrameReader LZ4;
+	Inflater Inflate;
+	// Deflate output keeps the last window in front of the new data, which starts at Start.
+	std::string Out;
+	size_t Start = 0;
+
+	Decompressor(CompressFormat format) : Format(format), Inflate(format == CompressFormat::Gzip) {}
+
+	bool Update(const uint8_t* p, size_t len)
+	{
+		if (Format == CompressFormat::LZ4)
+		{
+			Out.clear();
+			return LZ4.Update(p, len, Out);
+		}
+		if (Out.size() > DeflateWindow)
+			Out.erase(0, Out.size() - DeflateWindow);
+		Start = Out.size();
+		return Inflate.Update(p, len, Out);
+	}
+
+	bool Finish()
+	{
+		return Format == CompressFormat::LZ4 ? LZ4.Finish() : Inflate.Finish();
+	}
+
+	const std::string& Error() const
+	{
+		return Format == CompressFormat::LZ4 ? LZ4.Error : Inflate.Error;
+	}
+};
+
+static int lua_checklz4level(lua_State* L, int idx)
+{
+	auto level = luaL_optinteger(L, idx, 1);
+	luaL_argcheck(L, level >= 1 && level <= LZ4MaxLevel, idx, "level must be between 1 and 12");
+	return (int)level;
+}
+
+static int lua_checkdeflatelevel(lua_State* L, int idx)
+{
+	auto level = luaL_optinteger(L, idx, 6);
+	luaL_argcheck(L, level >= 0 && level <= DeflateMaxLevel, idx, "level must be between 0 and 9");
+	return (int)level;
+}
+
+static int lua_compresslz4(lua_State* L)
+{
+	size_t len;
+	auto data = reinterpret_cast<const uint8_t*>(luaL_checklstring(L, 1, &len));
+	LZ4FrameWriter writer(lua_checklz4level(L, 2));
+	uint64_t size = len;
+	auto& buffer = lua_newscratchbuffer(L);
+	writer.Start(buffer, &size);
+	writer.Update(data, len, buffer);
+	writer.Finish(buffer);
+	lua_pushscratchbuffer(L, buffer);
+	return 1;
+}
+
+static int lua_compresslz4block(lua_State* L)
+{
+	size_t len;
+	auto data = reinterpret_cast<const uint8_t*>(luaL_checklstring(L, 1, &len));
+	LZ4Encoder encoder(lua_checklz4level(L, 2));
+	luaL_argcheck(L, len <= LZ4MaxInput, 1, "input too large");
+	luaL_Buffer b;
+	auto out = reinterpret_cast<uint8_t*>(luaL_buffinitsize(L, &b, LZ4CompressBound(len)));
+	luaL_pushresultsize(&b, encoder.Compress(data, len, out));
+	return 1;
+}
+
+static int lua_decompresslz4(lua_State* L)
+{
+	size_t len;
+	auto data = reinterpret_cast<const uint8_t*>(luaL_checklstring(L, 1, &len));
+	LZ4FrameReader reader;
+	auto& buffer = lua_newscratchbuffer(L);
+	if (!reader.Update(data, len, buffer) || !reader.Finish())
+	{
+		lua_pushnil(L);
+		lua_pushlstring(L, reader.Error);
+		return 2;
+	}
+	lua_pushscratchbuffer(L, buffer);
+	return 1;
+}
+
+static int lua_decompresslz4block(lua_State* L)
+{
+	size_t len;
+	auto data = reinterpret_cast<const uint8_t*>(luaL_checklstring(L, 1, &len));
+	auto size = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, size >= 0, 2, "size can't be negative");
+	luaL_Buffer b;
+	auto out = reinterpret_cast<uint8_t*>(luaL_buffinitsize(L, &b, (size_t)size));
+	auto end = LZ4DecompressBlock(data, len, out, 0, (size_t)size);
+	if (end == SIZE_MAX)
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, "corrupt LZ4 block");
+		return 2;
+	}
+	luaL_pushresultsize(&b, end);
+	return 1;
+}
+
+static int lua_deflate(lua_State* L, bool bGzip)
+{
+	size_t len;
+	auto data = reinterpret_cast<const uint8_t*>(luaL_checklstring(L, 1, &len));
+	DeflateWriter writer(bGzip, lua_checkdeflatelevel(L, 2));
+	luaL_argcheck(L, len <= DeflateMaxInput, 1, "input too large");
+	auto& buffer = lua_newscratchbuffer(L);
+	writer.Compress(data, len, buffer);
+	lua_pushscratchbuffer(L, buffer);
+	return 1;
+}
+
+static int lua_compressdeflate(lua_State* L)
+{
+	return lua_deflate(L, false);
+}
+
+static int lua_compressgzip(lua_State* L)
+{
+	return lua_deflate(L, true);
+}
+
+static int lua_inflate(lua_State* L, bool bGzip)
+{
+	size_t len;
+	auto data = reinterpret_cast<const uint8_t*>(luaL_checklstring(L, 1, &len));
+	Inflater inflater(bGzip);
+	auto& buffer = lua_newscratchbuffer(L);
+	if (!inflater.Update(data, len, buffer) || !inflater.Finish())
+	{
+		lua_pushnil(L);
+		lua_pushlstring(L, inflater.Error);
+		return 2;
+	}
+	lua_pushscratchbuffer(L, buffer);
+	return 1;
+}
+
+static int lua_decompressdeflate(lua_State* L)
+{
+	return lua_inflate(L, false);
+}
+
+static int lua_decompressgzip(lua_State* L)
+{
+	return lua_inflate(L, true);
+}
+
+static int lua_compressor(lua_State* L)
+{
+	auto format = (CompressFormat)luaL_checkoption(L, 1, "LZ4", CompressFormats);
+	lua_newobject<Compressor>(L, format, format == CompressFormat::LZ4 ? lua_checklz4level(L, 2) : lua_checkdeflatelevel(L, 2));
+	return 1;
+}
+
+static int lua_compressorupdate(lua_State* L)
+{
+	auto compressor = lua_checkobject<Compressor>(L, 1);
+	size_t len;
+	auto data = reinterpret_cast<const uint8_t*>(luaL_checklstring(L, 2, &len));
+	compressor->Update(data, len);
+	lua_pushlstring(L, compressor->Out);
+	return 1;
+}
+
+static int lua_compressorfinish(lua_State* L)
+{
+	auto compressor = lua_checkobject<Compressor>(L, 1);
+	compressor->Finish();
+	lua_pushlstring(L, compressor->Out);
+	return 1;
+}
+
+static int lua_decompressor(lua_State* L)
+{
+	auto format = (CompressFormat)luaL_checkoption(L, 1, "LZ4", CompressFormats);
+	lua_newobject<Decompressor>(L, format);
+	return 1;
+}
+
+static int lua_decompressorupdate(lua_State* L)
+{
+	auto decompressor = lua_checkobject<Decompressor>(L, 1);
+	size_t len;
+	auto data = reinterpret_cast<const uint8_t*>(luaL_checklstring(L, 2, &len));
+	if (!decompressor->Update(data, len))
+	{
+		lua_pushnil(L);
+		lua_pushlstring(L, decompressor->Error());
+		return 2;
+	}
+	lua_pushlstring(L, decompressor->Out.data() + decompressor->Start, decompressor->Out.size() - decompressor->Start);
+	return 1;
+}
+
+static int lua_decompressorfinish(lua_State* L)
+{
+	auto decompressor = lua_checkobject<Decompressor>(L, 1);
+	if (!decompressor->Finish())
+	{
+		lua_pushnil(L);
+		lua_pushlstring(L, decompressor->Error());
+		return 2;
+	}
+	lua_pushliteral(L, "");
+	return 1;
+}
+#pragma endregion
+
+#pragma region LuaOpen
+static const struct luaL_Reg ProddyUtils[] = {
+	{"CheckVersion", lua_checkversion},
+	{"GetVersion", lua_getversion},
+	{"GetMetatable", lua_getmetatable},
+	{"GetTop", lua_top},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Clipboard[] = {
+	{"GetText", lua_getclipboard},
+	{"SetText", lua_setclipboard},
+	{NULL, NULL}
+};
+static const struct luaL_Reg IO[] = {
+	{"CreateDirectory", lua_createdirectory},
+	{"DirExists", lua_direxists},
+	{"Exists", lua_exists},
+	{"FileExists", lua_fileexists},
+	{"GetFiles", lua_getfiles},
+	{"IterateDirectory", lua_iteratedirectory},
+	{NULL, NULL}
+};
+static const struct luaL_Reg EncodingLib[] = {
+	{"Base64Encode", lua_base64encode},
+	{"Base64Decode", lua_base64decode},
+	{"HexEncode", lua_hexencode},
+	{"HexDecode", lua_hexdecode},
+	{NULL, NULL}
+};
+static const struct luaL_Reg EntityStore[] = {
+	{"New", lua_entitystorenew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg EntityStoreMethods[] = {
+	{"Define", lua_entitystoredefine},
+	{"Create", lua_entitystorecreate},
+	{"Destroy", lua_entitystoredestroy},
+	{"Alive", lua_entitystorealive},
+	{"Size", lua_entitystoresize},
+	{"Add", lua_entitystoreadd},
+	{"Remove", lua_entitystoreremove},
+	{"Has", lua_entitystorehas},
+	{"Get", lua_entitystoreget},
+	{"Set", lua_entitystoreset},
+	{"Count", lua_entitystorecount},
+	{"Query", lua_entitystorequery},
+	{"Column", lua_entitystorecolumn},
+	{NULL, NULL}
+};
+static const struct luaL_Reg EntityQueryMethods[] = {
+	{NULL, NULL}
+};
+static const struct luaL_Reg Float64Array[] = {
+	{"New", lua_typedarraynew<F64Array>},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Float64ArrayMethods[] = {
+	{"Size", lua_typedarraysize<F64Array>},
+	{"Resize", lua_typedarrayresize<F64Array>},
+	{"Get", lua_typedarrayget<F64Array>},
+	{"Set", lua_typedarrayset<F64Array>},
+	{"Fill", lua_typedarrayfill<F64Array>},
+	{"ToTable", lua_typedarraytotable<F64Array>},
+	{"Sum", lua_typedarraysum<F64Array>},
+	{"Min", lua_typedarraymin<F64Array>},
+	{"Max", lua_typedarraymax<F64Array>},
+	{"Mean", lua_typedarraymean<F64Array>},
+	{"Dot", lua_typedarraydot<F64Array>},
+	{"Scale", lua_typedarrayscale<F64Array>},
+	{"Add", lua_typedarrayadd<F64Array>},
+	{NULL, NULL}
+};
+static const struct luaL_Reg HashLib[] = {
+	{"XXH3", lua_hashxxh3},
+	{"CRC32C", lua_hashcrc32c},
+	{"SHA256", lua_hashsha256},
+	{"Hasher", lua_hashhasher},
+	{"File", lua_hashfile},
+	{NULL, NULL}
+};
+static const struct luaL_Reg HasherMethods[] = {
+	{"Update", lua_hasherupdate},
+	{"Digest", lua_hasherdigest},
+	{"Reset", lua_hasherreset},
+	{NULL, NULL}
+};
+static const struct luaL_Reg IdSetLib[] = {
+	{"New", lua_idtablenew<IdSet>},
+	{NULL, NULL}
+};
+static const struct luaL_Reg IdSetMethods[] = {
+	{"Add", lua_idsetadd},
+	{"Has", lua_idtablehas<IdSet>},
+	{"Remove", lua_idtableremove<IdSet>},
+	{"Size", lua_idtablesize<IdSet>},
+	{"Clear", lua_idtableclear<IdSet>},
+	{"Memory", lua_idtablememory<IdSet>},
+	{"Load", lua_idsetload},
+	{"ToTable", lua_idsettotable},
+	{NULL, NULL}
+};
+static const struct luaL_Reg IdMapLib[] = {
+	{"New", lua_idtablenew<IdMap>},
+	{NULL, NULL}
+};
+static const struct luaL_Reg IdMapMethods[] = {
+	{"Set", lua_idmapset},
+	{"Get", lua_idmapget},
+	{"Add", lua_idmapadd},
+	{"Has", lua_idtablehas<IdMap>},
+	{"Remove", lua_idtableremove<IdMap>},
+	{"Size", lua_idtablesize<IdMap>},
+	{"Clear", lua_idtableclear<IdMap>},
+	{"Memory", lua_idtablememory<IdMap>},
+	{"Load", lua_idmapload},
+	{"ToTable", lua_idmaptotable},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Int32Array[] = {
+	{"New", lua_typedarraynew<I32Array>},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Int32ArrayMethods[] = {
+	{"Size", lua_typedarraysize<I32Array>},
+	{"Resize", lua_typedarrayresize<I32Array>},
+	{"Get", lua_typedarrayget<I32Array>},
+	{"Set", lua_typedarrayset<I32Array>},
+	{"Fill", lua_typedarrayfill<I32Array>},
+	{"ToTable", lua_typedarraytotable<I32Array>},
+	{"Sum", lua_typedarraysum<I32Array>},
+	{"Min", lua_typedarraymin<I32Array>},
+	{"Max", lua_typedarraymax<I32Array>},
+	{"Mean", lua_typedarraymean<I32Array>},
+	{"Dot", lua_typedarraydot<I32Array>},
+	{"Scale", lua_typedarrayscale<I32Array>},
+	{"Add", lua_typedarrayadd<I32Array>},
+	{NULL, NULL}
+};
+static const struct luaL_Reg HLL[] = {
+	{"New", lua_hyperloglognew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg HyperLogLogMethods[] = {
+	{"Add", lua_hyperloglogadd},
+	{"Count", lua_hyperloglogcount},
+	{"Merge", lua_hyperloglogmerge},
+	{"Clear", lua_hyperloglogclear},
+	{NULL, NULL}
+};
+static const struct luaL_Reg JSON[] = {
+	{"Decode", lua_jsondecode},
+	{"Encode", lua_jsonencode},
+	{"Stream", lua_jsonstream},
+	{NULL, NULL}
+};
+static const struct luaL_Reg JSONStreamMethods[] = {
+	{"Feed", lua_jsonstreamfeed},
+	{"Close", lua_jsonstreamclose},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Keyboard[] = {
+	{"IsKeyPressed", lua_iskeypressed},
+	{"KeyDown", lua_keydown},
+	{"KeyUp", lua_keyup},
+	{NULL, NULL}
+};
+static const struct luaL_Reg MsgBox[] = {
+	{"Show", lua_msgbox},
+	{NULL, NULL}
+};
+static const struct luaL_Reg OS[] = {
+	{"GetTimeMillis", lua_gettimemillis},
+	{"GetTimeMicro", lua_gettimemicro},
+	{"GetTimeNano", lua_gettimenano},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Net[] = {
+	{"DownloadString", lua_downloadstring},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Loader[] = {
+	{"Watch", lua_watch},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Bits[] = {
+	{"New", lua_bitsetnew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg BitsetMethods[] = {
+	{"Set", lua_bitsetset},
+	{"Clear", lua_bitsetclear},
+	{"Test", lua_bitsettest},
+	{"Count", lua_bitsetcount},
+	{"Size", lua_bitsetsize},
+	{"Clone", lua_bitsetclone},
+	{"And", lua_bitsetapply<Bitset::Op::And>},
+	{"Or", lua_bitsetapply<Bitset::Op::Or>},
+	{"Xor", lua_bitsetapply<Bitset::Op::Xor>},
+	{"AndNot", lua_bitsetapply<Bitset::Op::AndNot>},
+	{"Iterate", lua_bitsetiterate},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Bloom[] = {
+	{"New", lua_bloomfilternew},
+	{"Deserialize", lua_bloomfilterdeserialize},
+	{NULL, NULL}
+};
+static const struct luaL_Reg BloomFilterMethods[] = {
+	{"Add", lua_bloomfilteradd},
+	{"AddAll", lua_bloomfilteraddall},
+	{"Test", lua_bloomfiltertest},
+	{"Count", lua_bloomfiltercount},
+	{"Serialize", lua_bloomfilterserialize},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Cache[] = {
+	{"New", lua_cachenew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg CacheMethods[] = {
+	{"Get", lua_cacheget},
+	{"Set", lua_cacheset},
+	{"Delete", lua_cachedelete},
+	{"Stats", lua_cachestats},
+	{NULL, NULL}
+};
+static const struct luaL_Reg CompressLib[] = {
+	{"LZ4", lua_compresslz4},
+	{"LZ4Block", lua_compresslz4block},
+	{"Deflate", lua_compressdeflate},
+	{"Gzip", lua_compressgzip},
+	{"Compressor", lua_compressor},
+	{NULL, NULL}
+};
+static const struct luaL_Reg CompressorMethods[] = {
+	{"Update", lua_compressorupdate},
+	{"Finish", lua_compressorfinish},
+	{NULL, NULL}
+};
+static const struct luaL_Reg DecompressLib[] = {
+	{"LZ4", lua_decompresslz4},
+	{"LZ4Block", lua_decompresslz4block},
+	{"Deflate", lua_decompressdeflate},
+	{"Gzip", lua_decompressgzip},
+	{"Decompressor", lua_decompressor},
+	{NULL, NULL}
+};
+static const struct luaL_Reg DecompressorMethods[] = {
+	{"Update", lua_decompressorupdate},
+	{"Finish", lua_decompressorfinish},
+	{NULL, NULL}
+};
+static const struct luaL_Reg CSV[] = {
+	{"Open", lua_csvopen},
+	{"Writer", lua_csvwriter},
+	{NULL, NULL}
+};
+static const struct luaL_Reg CSVReaderMethods[] = {
+	{"Read", lua_csvreaderread},
+	{"Header", lua_csvreaderheader},
+	{"Close", lua_csvreaderclose},
+	{NULL, NULL}
+};
+static const struct luaL_Reg CSVWriterMethods[] = {
+	{"Write", lua_csvwriterwrite},
+	{"Flush", lua_csvwriterflush},
+	{"Close", lua_csvwriterclose},
+	{NULL, NULL}
+};
+static const struct luaL_Reg MsgPack[] = {
+	{"Pack", lua_msgpackpack},
+	{"Unpack", lua_msgpackunpack},
+	{NULL, NULL}
+};
+static const struct luaL_Reg OrderedMap[] = {
+	{"New", lua_orderedmapnew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg OrderedMapMethods[] = {
+	{"Insert", lua_orderedmapinsert},
+	{"Find", lua_orderedmapfind},
+	{"Erase", lua_orderedmaperase},
+	{"Floor", lua_orderedmapfloor},
+	{"Ceil", lua_orderedmapceil},
+	{"Range", lua_orderedmaprange},
+	{"Size", lua_orderedmapsize},
+	{NULL, NULL}
+};
+static const struct luaL_Reg OrderedMapCursorMethods[] = {
+	{NULL, NULL}
+};
+static const struct luaL_Reg Pool[] = {
+	{"New", lua_poolnew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg PoolMethods[] = {
+	{"Acquire", lua_poolacquire},
+	{"Release", lua_poolrelease},
+	{"ReleaseAll", lua_poolreleaseall},
+	{"Stats", lua_poolstats},
+	{"Clear", lua_poolclear},
+	{NULL, NULL}
+};
+static const struct luaL_Reg PriorityQueue[] = {
+	{"New", lua_pqnew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg PriorityQueueMethods[] = {
+	{"Push", lua_pqpush},
+	{"PushAll", lua_pqpushall},
+	{"Peek", lua_pqpeek},
+	{"Pop", lua_pqpop},
+	{"Update", lua_pqupdate},
+	{"Size", lua_pqsize},
+	{NULL, NULL}
+};
+static const struct luaL_Reg SpatialIndex[] = {
+	{"New", lua_spatialindexnew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg SpatialIndexMethods[] = {
+	{"Update", lua_spatialindexupdate},
+	{"Remove", lua_spatialindexremove},
+	{"Get", lua_spatialindexget},
+	{"Size", lua_spatialindexsize},
+	{"Clear", lua_spatialindexclear},
+	{"QueryRadius", lua_spatialindexqueryradius},
+	{"KNearest", lua_spatialindexknearest},
+	{"QueryBox", lua_spatialindexquerybox},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Series[] = {
+	{"New", lua_timeseriesnew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg TimeSeriesMethods[] = {
+	{"Push", lua_timeseriespush},
+	{"Size", lua_timeseriessize},
+	{"Capacity", lua_timeseriescapacity},
+	{"Clear", lua_timeseriesclear},
+	{"Latest", lua_timeserieslatest},
+	{"Stats", lua_timeseriesstats},
+	{"Min", lua_timeseriesmin},
+	{"Max", lua_timeseriesmax},
+	{"Mean", lua_timeseriesmean},
+	{"Percentile", lua_timeseriespercentile},
+	{"Downsample", lua_timeseriesdownsample},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Table[] = {
+	{"SortBy", lua_tablesortby},
+	{"DeepCopy", lua_tabledeepcopy},
+	{"DeepEqual", lua_tabledeepequal},
+	{"Hash", lua_tablehash},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Trie[] = {
+	{"New", lua_trienew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg TrieMethods[] = {
+	{"Insert", lua_trieinsert},
+	{"InsertMany", lua_trieinsertmany},
+	{"Remove", lua_trieremove},
+	{"Get", lua_trieget},
+	{"Size", lua_triesize},
+	{"PrefixSearch", lua_trieprefixsearch},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Vec3Array[] = {
+	{"New", lua_vec3arraynew},
+	{NULL, NULL}
+};
+static const struct luaL_Reg Vec3ArrayMethods[] = {
+	{"Size", lua_vec3arraysize},
+	{"Resize", lua_vec3arrayresize},
+	{"Fill", lua_vec3arrayfill},
+	{"Get", lua_vec3arrayget},
+	{"Set", lua_vec3arrayset},
+	{"Push", lua_vec3arraypush},
+	{"Distances", lua_vec3arraydistances},
+	{"WithinRadius", lua_vec3arraywithinradius},
+	{"SortByDistance", lua_vec3arraysortbydistance},
+	{"Dot", lua_vec3arraydot},
+	{"Cross", lua_vec3arraycross},
+	{"Normalize", lua_vec3arraynormalize},
+	{NULL, NULL}
+};
+static const struct luaL_Reg WatcherMethods[] = {
+	{"Poll", lua_watcherpoll},
+	{"Close", lua_watcherclose},
+	{NULL, NULL}
+};
+
+extern "C" __declspec(dllexport) int luaopen_ProddyUtils(lua_State * L)
+{
+	luaL_newlib(L, ProddyUtils);
+	lua_registerobject<ScratchBuffer>(L, ScratchBufferMethods);
+
+	luaL_newlib(L, Clipboard);
+	lua_setfield(L, -2, "Clipboard");
+
+	luaL_newlib(L, IO);
+	lua_setfield(L, -2, "IO");
+
+	luaL_newlib(L, OS);
+	lua_setfield(L, -2, "OS");
+
+	luaL_newlib(L, Net);
+	lua_setfield(L, -2, "Net");
+
+	luaL_newlib(L, EncodingLib);
+	lua_setfield(L, -2, "Encoding");
+
+	luaL_newlib(L, EntityStore);
+	lua_setfield(L, -2, "EntityStore");
+	lua_registerobject<ComponentStore>(L, EntityStoreMethods);
+	lua_registerobject<EntityQuery>(L, EntityQueryMethods);
+
+	luaL_newlib(L, Float64Array);
+	lua_setfield(L, -2, "Float64Array");
+	lua_registerobject<F64Array>(L, Float64ArrayMethods);
+
+	luaL_newlib(L, HashLib);
+	lua_setfield(L, -2, "Hash");
+	lua_registerobject<Hasher>(L, HasherMethods);
+
+	luaL_newlib(L, IdSetLib);
+	lua_setfield(L, -2, "IdSet");
+	lua_registerobject<IdSet>(L, IdSetMethods);
+
+	luaL_newlib(L, IdMapLib);
+	lua_setfield(L, -2, "IdMap");
+	lua_registerobject<IdMap>(L, IdMapMethods);
+
+	luaL_newlib(L, Int32Array);
+	lua_setfield(L, -2, "Int32Array");
+	lua_registerobject<I32Array>(L, Int32ArrayMethods);
+
+	luaL_newlib(L, HLL);
+	lua_setfield(L, -2, "HyperLogLog");
+	lua_registerobject<HyperLogLog>(L, HyperLogLogMethods);
+
+	luaL_newlib(L, JSON);
+	lua_pushlightuserdata(L, nullptr);
+	lua_setfield(L, -2, "Null");
+	lua_setfield(L, -2, "JSON");
+	lua_registerobject<JSONStream>(L, JSONStreamMethods, lua_jsonstreamgc);
+
+	luaL_newlib(L, Loader);
+	lua_setfield(L, -2, "Loader");
+	lua_registerobject<Watcher>(L, WatcherMethods, lua_watchergc);
+
+	luaL_newlib(L, Bits);
+	lua_setfield(L, -2, "Bitset");
+	lua_registerobject<Bitset>(L, BitsetMethods);
+
+	luaL_newlib(L, Bloom);
+	lua_setfield(L, -2, "BloomFilter");
+	lua_registerobject<BloomFilter>(L, BloomFilterMethods);
+
+	luaL_newlib(L, Cache);
+	lua_setfield(L, -2, "Cache");
+	lua_registerobject<LRUCache>(L, CacheMethods, lua_cachegc);
+
+	luaL_newlib(L, CompressLib);
+	lua_setfield(L, -2, "Compress");
+	lua_registerobject<Compressor>(L, CompressorMethods);
+
+	luaL_newlib(L, DecompressLib);
+	lua_setfield(L, -2, "Decompress");
+	lua_registerobject<Decompressor>(L, DecompressorMethods);
+
+	luaL_newlib(L, CSV);
+	lua_setfield(L, -2, "CSV");
+	lua_registerobject<CSVReader>(L, CSVReaderMethods);
+	lua_registerobject<CSVWriter>(L, CSVWriterMethods);
+	// Readers can be called directly as the iterator of a for loop.
+	luaL_getmetatable(L, CSVReader::MetaName);
+	lua_pushcfunction(L, lua_csvreaderread);
+	lua_setfield(L, -2, "__call");
+	lua_pop(L, 1);
+
+	luaL_newlib(L, MsgPack);
+	lua_setfield(L, -2, "MsgPack");
+
+	luaL_newlib(L, OrderedMap);
+	lua_setfield(L, -2, "OrderedMap");
+	lua_registerobject<BTreeMap>(L, OrderedMapMethods);
+	lua_registerobject<BTreeCursor>(L, OrderedMapCursorMethods);
+
+	luaL_newlib(L, Pool);
+	lua_setfield(L, -2, "Pool");
+	lua_registerobject<TablePool>(L, PoolMethods);
+
+	luaL_newlib(L, PriorityQueue);
+	lua_setfield(L, -2, "PriorityQueue");
+	lua_registerobject<PriorityHeap>(L, PriorityQueueMethods);
+
+	luaL_newlib(L, SpatialIndex);
+	lua_setfield(L, -2, "SpatialIndex");
+	lua_registerobject<SpatialGrid>(L, SpatialIndexMethods);
+
+	luaL_newlib(L, Series);
+	lua_setfield(L, -2, "TimeSeries");
+	lua_registerobject<TimeSeries>(L, TimeSeriesMethods);
+
+	luaL_newlib(L, Table);
+	lua_setfield(L, -2, "Table");
+
+	luaL_newlib(L, Trie);
+	lua_setfield(L, -2, "Trie");
+	lua_registerobject<PrefixTrie>(L, TrieMethods);
+
+	luaL_newlib(L, Vec3Array);
+	lua_setfield(L, -2, "Vec3Array");
+	lua_registerobject<Vec3SoA>(L, Vec3ArrayMethods);
 
 	luaL_newlib(L, Keyboard);
 	lua_newtable(L);